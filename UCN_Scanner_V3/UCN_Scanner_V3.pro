@@ -1,20 +1,47 @@
-QT += core gui serialport
+QT += core gui network serialport
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets serialport
 
 CONFIG += c++17 \
           qt
 
+# scanner_protocol.h and motion_profile.h are shared with the Arduino sketch
+INCLUDEPATH += ../stepper_control_GUI_Ver2
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
     main.cpp \
-    mainwindow.cpp
+    adaptive_scan.cpp \
+    binary_link.cpp \
+    daq_client.cpp \
+    frame_parser.cpp \
+    mainwindow.cpp \
+    point_timing.cpp \
+    rate_source.cpp \
+    scan_estimator.cpp \
+    scan_grid.cpp \
+    scan_store.cpp \
+    serial_worker.cpp
 
 HEADERS += \
-    mainwindow.h
+    adaptive_scan.h \
+    binary_link.h \
+    daq_client.h \
+    frame_parser.h \
+    mainwindow.h \
+    point_timing.h \
+    rate_source.h \
+    scan_estimator.h \
+    scan_grid.h \
+    scan_store.h \
+    scanner_frame.h \
+    serial_worker.h \
+    spsc_queue.h \
+    ../stepper_control_GUI_Ver2/motion_profile.h \
+    ../stepper_control_GUI_Ver2/scanner_protocol.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,137 @@
+#include "adaptive_scan.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+AdaptiveScan::AdaptiveScan(int numRows, int numCols, const std::vector<MaskRun> &selection, double cellSpacing,
+                           const AdaptiveSettings &adaptive)
+    : rows(std::max(0, numRows)),
+      cols(std::max(0, numCols)),
+      spacing(cellSpacing),
+      settings(adaptive),
+      stride(1 << std::min(std::max(0, adaptive.levels), 10))
+{
+    std::vector<char> selected(std::size_t(rows) * std::size_t(cols), 0);
+    for (const MaskRun &run : selection) {
+        if (run.row < 0 || run.row >= rows)
+            continue;
+        for (int c = std::max(0, int(run.col)); c < std::min(cols, run.col + run.len); ++c)
+            selected[index(run.row, c)] = 1;
+    }
+    selectedSum.assign(std::size_t(rows + 1) * std::size_t(cols + 1), 0);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            selectedSum[std::size_t(r + 1) * (cols + 1) + c + 1] = selected[index(r, c)]
+                    + selectedSum[std::size_t(r) * (cols + 1) + c + 1]
+                    + selectedSum[std::size_t(r + 1) * (cols + 1) + c]
+                    - selectedSum[std::size_t(r) * (cols + 1) + c];
+        }
+    }
+    rate.assign(selected.size(), std::numeric_limits<double>::quiet_NaN());
+    visited.assign(selected.size(), 0);
+
+    for (int r = 0; r < rows; r += stride)
+        for (int c = 0; c < cols; c += stride)
+            if (cellsInBox(r, c, stride, stride) > 0)
+                squares.push_back(GridPoint{r, c});
+    collectPoints();
+}
+
+bool AdaptiveScan::next(const std::vector<double> &rates)
+{
+    for (std::size_t k = 0; k < points.size(); ++k) {
+        std::size_t i = index(points[k].row, points[k].col);
+        visited[i] = 1;
+        if (k < rates.size())
+            rate[i] = rates[k];
+    }
+    measured += points.size();
+    points.clear();
+    if (stride > 1) {
+        split();
+        collectPoints();
+    }
+    return !points.empty();
+}
+
+// Splits the squares that need a closer look, see the class comment
+void AdaptiveScan::split()
+{
+    const int half = stride / 2;
+    std::vector<GridPoint> children;
+    for (const GridPoint &s : squares) {
+        // The square's corners that have a rate: its own point and those of
+        // the squares to the right, below and diagonally, where measured
+        const int offsets[4][2] = {{0, 0}, {0, stride}, {stride, 0}, {stride, stride}};
+        int corner[4][2];
+        double v[4];
+        int n = 0;
+        for (const auto &d : offsets) {
+            int r = s.row + d[0];
+            int c = s.col + d[1];
+            if (r >= rows || c >= cols || std::isnan(rate[index(r, c)]))
+                continue;
+            corner[n][0] = d[0];
+            corner[n][1] = d[1];
+            v[n++] = rate[index(r, c)];
+        }
+        bool refine = std::isnan(rate[index(s.row, s.col)]);
+        for (int a = 0; a < n && !refine; ++a) {
+            if (settings.rateThreshold > 0.0 && v[a] >= settings.rateThreshold)
+                refine = true;
+            for (int b = a + 1; b < n && !refine && settings.gradientThreshold > 0.0; ++b) {
+                double cm = std::hypot(corner[a][0] - corner[b][0], corner[a][1] - corner[b][1]) * spacing;
+                refine = std::abs(v[a] - v[b]) / cm >= settings.gradientThreshold;
+            }
+        }
+        if (!refine)
+            continue;
+        for (int dr = 0; dr < stride; dr += half)
+            for (int dc = 0; dc < stride; dc += half)
+                if (s.row + dr < rows && s.col + dc < cols && cellsInBox(s.row + dr, s.col + dc, half, half) > 0)
+                    children.push_back(GridPoint{s.row + dr, s.col + dc});
+    }
+    squares.swap(children);
+    stride = half;
+}
+
+// The new corners of this step. A step can come up empty when none of its
+// corners is selected; the squares are split further until one does not.
+void AdaptiveScan::collectPoints()
+{
+    while (true) {
+        for (const GridPoint &s : squares) {
+            std::size_t i = index(s.row, s.col);
+            if (!visited[i] && cellsInBox(s.row, s.col, 1, 1) > 0)
+                points.push_back(s);
+        }
+        if (!points.empty() || stride == 1 || squares.empty())
+            break;
+        split();
+    }
+
+    // Serpentine by rows, like SCAN_ORDER_SERPENTINE
+    std::sort(points.begin(), points.end(), [](const GridPoint &a, const GridPoint &b) {
+        return a.row != b.row ? a.row < b.row : a.col < b.col;
+    });
+    bool backwards = false;
+    for (auto first = points.begin(); first != points.end();) {
+        auto last = std::find_if(first, points.end(), [&](const GridPoint &p) { return p.row != first->row; });
+        if (backwards)
+            std::reverse(first, last);
+        backwards = !backwards;
+        first = last;
+    }
+}
+
+std::size_t AdaptiveScan::cellsInBox(int row, int col, int nRows, int nCols) const
+{
+    int r1 = std::min(rows, row + nRows);
+    int c1 = std::min(cols, col + nCols);
+    if (r1 <= row || c1 <= col)
+        return 0;
+    const std::size_t w = std::size_t(cols + 1);
+    return selectedSum[std::size_t(r1) * w + c1] - selectedSum[std::size_t(row) * w + c1]
+           - selectedSum[std::size_t(r1) * w + col] + selectedSum[std::size_t(row) * w + col];
+}
@@ -0,0 +1,73 @@
+#ifndef ADAPTIVE_SCAN_H
+#define ADAPTIVE_SCAN_H
+
+#include <cstddef>
+#include <vector>
+
+#include "scanner_protocol.h"
+
+// Coarse-to-fine scan of the selected grid cells. The first pass samples
+// every 2^levels-th cell in both directions, each point standing for the
+// square of cells up to the next one. After each pass a square is split in
+// four (quadtree) when the rate at any of its four corners, or the rate
+// difference per cm between two of them, reaches its threshold; the new
+// corners are the next pass, down to single cells. Squares with nothing
+// going on are never looked at finer.
+// Squares whose corner is not selected have no rate of their own and are
+// always split, so ragged selections still get every cell they need.
+//
+// Points are in the GUI's grid (rows along Y, columns along X, spacing apart),
+// aligned to the grid origin like scan() in the sketch.
+
+struct GridPoint
+{
+    int row;
+    int col;
+};
+
+struct AdaptiveSettings
+{
+    int levels = 2;                 // the first pass samples every 2^levels cells
+    double rateThreshold = 0.0;     // counts/s at which a square is split, 0 = off
+    double gradientThreshold = 0.0; // counts/s per cm between corners of a square, 0 = off
+};
+
+class AdaptiveScan
+{
+public:
+    AdaptiveScan(int rows, int cols, const std::vector<MaskRun> &selection, double spacing,
+                 const AdaptiveSettings &settings);
+
+    // Points of the current pass, serpentine by rows; empty once finished
+    const std::vector<GridPoint> &pass() const { return points; }
+    int step() const { return stride; } // cells between neighbouring points of this pass
+    bool finished() const { return points.empty(); }
+
+    // Takes the rates measured at pass() (same order, NaN where there is
+    // none) and plans the next pass. False when the scan is finished.
+    bool next(const std::vector<double> &rates);
+
+    std::size_t measuredCount() const { return measured; }
+    std::size_t selectedCount() const { return cellsInBox(0, 0, rows, cols); }
+
+private:
+    void split();
+    void collectPoints();
+    std::size_t cellsInBox(int row, int col, int nRows, int nCols) const;
+    std::size_t index(int row, int col) const { return std::size_t(row) * std::size_t(cols) + std::size_t(col); }
+
+    int rows;
+    int cols;
+    double spacing;
+    AdaptiveSettings settings;
+    int stride;
+
+    std::vector<std::size_t> selectedSum; // (rows + 1) x (cols + 1) prefix sums of the selection
+    std::vector<double> rate;             // per cell, NaN until measured
+    std::vector<char> visited;            // per cell, whether a pass went there
+    std::vector<GridPoint> squares;       // top-left corners of the squares of this step still in play
+    std::vector<GridPoint> points;
+    std::size_t measured = 0;
+};
+
+#endif // ADAPTIVE_SCAN_H
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = frame_parser_bench
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../.. ../../../stepper_control_GUI_Ver2
+
+DEFINES += SESSION_LOG=\\\"$$PWD/scan_session.log\\\"
+
+SOURCES += \
+    main.cpp \
+    ../../frame_parser.cpp
+
+HEADERS += \
+    ../../frame_parser.h \
+    ../../scanner_frame.h \
+    ../../../stepper_control_GUI_Ver2/scanner_protocol.h
@@ -0,0 +1,129 @@
+// Micro-benchmark for FrameParser.
+// Replays a recorded Arduino session (scan_session.log by default) until the
+// requested number of megabytes has gone through, in randomly sized chunks the
+// way readyRead hands them over, and compares against the old split-per-tick loop.
+//
+// usage: frame_parser_bench [capture file] [megabytes]
+
+#include "frame_parser.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifndef SESSION_LOG
+#define SESSION_LOG "scan_session.log"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<std::size_t> chunkSizes(std::size_t total)
+{
+    // Deterministic 1..64 byte chunks, about what readyRead delivers at 9600 baud
+    std::vector<std::size_t> sizes;
+    std::uint32_t seed = 12345;
+    std::size_t used = 0;
+    while (used < total) {
+        seed = seed * 1664525u + 1013904223u;
+        std::size_t n = 1 + (seed >> 8) % 64;
+        if (n > total - used)
+            n = total - used;
+        sizes.push_back(n);
+        used += n;
+    }
+    return sizes;
+}
+
+// What checkArduinoScanComplete used to do on every 100 ms tick:
+// append, split the whole buffer on '>', search each piece, keep the tail
+std::size_t splitPerTick(const std::string &traffic, const std::vector<std::size_t> &sizes)
+{
+    std::string incoming;
+    std::size_t frames = 0;
+    std::size_t pos = 0;
+    for (std::size_t n : sizes) {
+        incoming.append(traffic, pos, n);
+        pos += n;
+
+        std::vector<std::string> parts;
+        std::size_t from = 0, gt;
+        while ((gt = incoming.find('>', from)) != std::string::npos) {
+            parts.push_back(incoming.substr(from, gt - from));
+            from = gt + 1;
+        }
+        parts.push_back(incoming.substr(from));
+
+        for (std::size_t i = 0; i + 1 < parts.size(); ++i) {
+            std::size_t lt = parts[i].find('<');
+            if (lt == std::string::npos)
+                continue;
+            std::string message = parts[i].substr(lt);
+            if (message.find("<SCAN_DONE") != std::string::npos)
+                ++frames;
+            ++frames;
+        }
+        incoming = parts.back();
+    }
+    return frames;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : SESSION_LOG;
+    const double megabytes = argc > 2 ? std::atof(argv[2]) : 16.0;
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "cannot open capture %s\n", path);
+        return 1;
+    }
+    const std::string session((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (session.empty()) {
+        std::fprintf(stderr, "capture %s is empty\n", path);
+        return 1;
+    }
+
+    const std::size_t target = std::size_t(megabytes * 1024 * 1024);
+    std::string traffic;
+    traffic.reserve(target + session.size());
+    while (traffic.size() < target)
+        traffic += session;
+    const std::vector<std::size_t> sizes = chunkSizes(traffic.size());
+
+    std::size_t counts[7] = {};
+    FrameParser parser;
+    auto t0 = Clock::now();
+    std::size_t pos = 0;
+    for (std::size_t n : sizes) {
+        parser.feed(traffic.data() + pos, n, [&counts](const FrameView &frame) {
+            ++counts[int(frame.type)];
+        });
+        pos += n;
+    }
+    auto t1 = Clock::now();
+    std::size_t baselineFrames = splitPerTick(traffic, sizes);
+    auto t2 = Clock::now();
+
+    const double mb = traffic.size() / (1024.0 * 1024.0);
+    const double parseSec = std::chrono::duration<double>(t1 - t0).count();
+    const double splitSec = std::chrono::duration<double>(t2 - t1).count();
+
+    std::printf("capture      %s (%zu bytes), replayed to %.1f MB in %zu chunks\n",
+                path, session.size(), mb, sizes.size());
+    std::printf("FrameParser  %8.3f s  %8.1f MB/s  %6.2f ns/byte\n",
+                parseSec, mb / parseSec, parseSec * 1e9 / traffic.size());
+    std::printf("split/tick   %8.3f s  %8.1f MB/s  %6.2f ns/byte  (%zu frames)\n",
+                splitSec, mb / splitSec, splitSec * 1e9 / traffic.size(), baselineFrames);
+    std::printf("frames       text %zu, echo %zu, scan_index %zu, scan_done %zu, debug %zu, position %zu, stop %zu\n",
+                counts[0], counts[1], counts[2], counts[3], counts[4], counts[5], counts[6]);
+    return 0;
+}
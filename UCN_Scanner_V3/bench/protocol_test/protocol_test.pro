@@ -0,0 +1,28 @@
+TEMPLATE = app
+TARGET = protocol_test
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../.. ../../../stepper_control_GUI_Ver2
+
+DEFINES += VIRTUAL_ARDUINO=\\\"$$PWD/../../../virtual_arduino/virtual_arduino\\\" \
+           MOCK_DAQ=\\\"$$PWD/../../../mock_daq/mock_daq\\\"
+
+SOURCES += \
+    main.cpp \
+    ../../adaptive_scan.cpp \
+    ../../binary_link.cpp \
+    ../../frame_parser.cpp \
+    ../../point_timing.cpp \
+    ../../scan_store.cpp
+
+HEADERS += \
+    ../../adaptive_scan.h \
+    ../../binary_link.h \
+    ../../frame_parser.h \
+    ../../point_timing.h \
+    ../../scan_store.h \
+    ../../scanner_frame.h \
+    ../../../stepper_control_GUI_Ver2/motion_profile.h \
+    ../../../stepper_control_GUI_Ver2/scanner_protocol.h
@@ -0,0 +1,202 @@
+// End-to-end benchmark for the serial path: SerialWorker, the parsers and the
+// sketch on the other end, normally the virtual Arduino (virtual_arduino/).
+// Measures the command round trip ('T' until its echo or ACK) and the wall time
+// of a small scan from the scan command to SCAN_DONE, next to the uncalibrated
+// estimate of scan_estimator.h.
+//
+// usage: transport_bench [port] [link baud] [round trips] [gap ms] [scan size]
+//   defaults: /tmp/ttyVACM0 9600 200 200 5
+// A link baud other than 9600 is negotiated the way the GUI does after start-up.
+// Keep the gap above the line time of a command and its echo or the round trips queue up.
+
+#include "scan_estimator.h"
+#include "serial_worker.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const int readyTimeoutMs = 30000; // reset and homing, up to the sketch's READY as in the GUI
+const int replyTimeoutMs = 2000;
+
+enum class Phase { Settle, Link, RoundTrip, Scan, Done };
+
+double percentile(std::vector<double> v, double p)
+{
+    if (v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, std::size_t(p * (v.size() - 1) + 0.5))];
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const QString portName = args.value(1, "/tmp/ttyVACM0");
+    const qint32 linkBaud = args.value(2, "9600").toInt();
+    const int roundTrips = args.value(3, "200").toInt();
+    const int gapMs = args.value(4, "200").toInt();
+    const int scanSize = std::max(1, args.value(5, "5").toInt());
+
+    qRegisterMetaType<ScanPacket>("ScanPacket");
+    QThread serialThread;
+    SerialWorker *serial = new SerialWorker;
+    serial->moveToThread(&serialThread);
+    QObject::connect(&serialThread, &QThread::finished, serial, &QObject::deleteLater);
+    serialThread.start();
+
+    Phase phase = Phase::Settle;
+    QElapsedTimer clock;
+    QTimer replyTimer;
+    replyTimer.setSingleShot(true);
+    std::vector<double> rttMs;
+    int sent = 0;
+    int lost = 0;
+    int scanIndices = 0;
+    double firstIndexMs = 0.0;
+    double lastIndexMs = 0.0;
+    qint32 activeBaud = PROTO_ASCII_BAUD;
+
+    auto finish = [&](int code) {
+        phase = Phase::Done;
+        replyTimer.stop();
+        QMetaObject::invokeMethod(serial, "closePort", Qt::QueuedConnection);
+        QTimer::singleShot(100, &app, [&app, code] { app.exit(code); });
+    };
+
+    auto startScan = [&] {
+        phase = Phase::Scan;
+        ScanPacket scan = {};
+        scan.spacing = 1.0f;
+        scan.timing = 0.1f;
+        scan.rowMin = 0;
+        scan.rowMax = std::int16_t(scanSize - 1);
+        scan.colMin = 0;
+        scan.colMax = std::int16_t(scanSize - 1);
+        clock.start();
+        replyTimer.start(600000);
+        QMetaObject::invokeMethod(serial, "sendScan", Qt::QueuedConnection, Q_ARG(ScanPacket, scan));
+    };
+
+    auto report = [&] {
+        std::printf("round trip: %zu/%d replies, %d lost\n", rttMs.size(), sent, lost);
+        std::printf("  p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+                    percentile(rttMs, 0.50), percentile(rttMs, 0.90),
+                    percentile(rttMs, 0.99), percentile(rttMs, 1.0));
+    };
+
+    auto sendProbe = [&] {
+        if (sent == roundTrips) {
+            report();
+            startScan();
+            return;
+        }
+        ++sent;
+        clock.start();
+        replyTimer.start(replyTimeoutMs);
+        QMetaObject::invokeMethod(serial, "sendCommand", Qt::QueuedConnection,
+                                  Q_ARG(char, 'T'), Q_ARG(float, float(sent)), Q_ARG(float, 0.0f));
+    };
+
+    auto startRoundTrips = [&] {
+        phase = Phase::RoundTrip;
+        sendProbe();
+    };
+
+    QObject::connect(&replyTimer, &QTimer::timeout, &app, [&] {
+        if (phase == Phase::RoundTrip) {
+            ++lost;
+            sendProbe();
+        } else {
+            std::fprintf(stderr, "transport_bench: no SCAN_DONE\n");
+            finish(1);
+        }
+    });
+
+    auto startLink = [&] {
+        std::printf("ready after %.0f ms\n", clock.nsecsElapsed() / 1.0e6);
+        if (linkBaud == PROTO_ASCII_BAUD) {
+            startRoundTrips();
+            return;
+        }
+        phase = Phase::Link;
+        QMetaObject::invokeMethod(serial, "negotiateLink", Qt::QueuedConnection, Q_ARG(qint32, linkBaud));
+    };
+
+    QObject::connect(serial, &SerialWorker::portOpened, &app, [&](bool ok, const QString &error) {
+        if (!ok) {
+            std::fprintf(stderr, "transport_bench: %s: %s\n", qPrintable(portName), qPrintable(error));
+            finish(1);
+            return;
+        }
+        std::printf("%s open, waiting for READY\n", qPrintable(portName));
+        QTimer::singleShot(readyTimeoutMs, &app, [&] {
+            if (phase != Phase::Settle)
+                return;
+            std::fprintf(stderr, "transport_bench: no READY\n");
+            finish(1);
+        });
+    });
+
+    QObject::connect(serial, &SerialWorker::portError, &app, [&](const QString &error) {
+        std::fprintf(stderr, "transport_bench: %s\n", qPrintable(error));
+        finish(1);
+    });
+
+    QObject::connect(serial, &SerialWorker::linkChanged, &app, [&](bool binary, qint32 baud) {
+        if (phase != Phase::Link)
+            return;
+        std::printf("link: %s at %d baud\n", binary ? "binary" : "ASCII", baud);
+        activeBaud = binary ? baud : PROTO_ASCII_BAUD;
+        startRoundTrips();
+    });
+
+    QObject::connect(serial, &SerialWorker::framesReady, &app, [&] {
+        serial->rearmNotify();
+        SerialFrame frame;
+        while (serial->takeFrame(frame)) {
+            double ms = clock.nsecsElapsed() / 1.0e6;
+            if (phase == Phase::Settle
+                && (frame.type == FrameType::Ready || (frame.type == FrameType::Id && frame.status == '1'))) {
+                startLink();
+            } else if (phase == Phase::RoundTrip && frame.type == FrameType::Echo && replyTimer.isActive()) {
+                rttMs.push_back(ms);
+                replyTimer.stop();
+                QTimer::singleShot(gapMs, &app, sendProbe);
+            } else if (phase == Phase::Scan && frame.type == FrameType::ScanIndex) {
+                if (scanIndices++ == 0)
+                    firstIndexMs = ms;
+                lastIndexMs = ms;
+            } else if (phase == Phase::Scan && frame.type == FrameType::ScanDone) {
+                std::printf("scan %dx%d: %d indices, first after %.1f ms, done after %.1f ms (%.1f ms per point)\n",
+                            scanSize, scanSize, scanIndices, firstIndexMs, ms,
+                            scanIndices > 1 ? (lastIndexMs - firstIndexMs) / (scanIndices - 1) : 0.0);
+                ScanPlan plan;
+                plan.spacing = 1.0;
+                plan.timing = 0.1;
+                plan.rowMax = scanSize - 1;
+                plan.colMax = scanSize - 1;
+                plan.linkBaud = activeBaud;
+                std::printf("  estimate: SCAN_DONE after %.1f ms\n", ScanEstimator(activeBaud).estimate(plan).doneMs);
+                finish(scanIndices == scanSize * scanSize ? 0 : 1);
+            }
+        }
+    });
+
+    clock.start();
+    QMetaObject::invokeMethod(serial, "discoverPort", Qt::QueuedConnection, Q_ARG(QStringList, QStringList{portName}));
+
+    int code = app.exec();
+    serialThread.quit();
+    serialThread.wait();
+    return code;
+}
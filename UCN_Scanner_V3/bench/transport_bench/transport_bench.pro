@@ -0,0 +1,25 @@
+TEMPLATE = app
+TARGET = transport_bench
+
+QT = core serialport
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../.. ../../../stepper_control_GUI_Ver2
+
+SOURCES += \
+    main.cpp \
+    ../../binary_link.cpp \
+    ../../frame_parser.cpp \
+    ../../scan_estimator.cpp \
+    ../../serial_worker.cpp
+
+HEADERS += \
+    ../../binary_link.h \
+    ../../frame_parser.h \
+    ../../scan_estimator.h \
+    ../../scanner_frame.h \
+    ../../serial_worker.h \
+    ../../spsc_queue.h \
+    ../../../stepper_control_GUI_Ver2/motion_profile.h \
+    ../../../stepper_control_GUI_Ver2/scanner_protocol.h
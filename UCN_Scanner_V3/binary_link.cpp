@@ -0,0 +1,101 @@
+#include "binary_link.h"
+
+#include <cstring>
+
+std::size_t encodePacket(std::uint8_t type, std::uint8_t seq, const void *payload, std::uint8_t len, char *out)
+{
+    if (len > PROTO_MAX_PAYLOAD)
+        len = PROTO_MAX_PAYLOAD;
+
+    std::uint8_t *p = reinterpret_cast<std::uint8_t *>(out);
+    p[0] = PROTO_SYNC;
+    p[1] = type;
+    p[2] = seq;
+    p[3] = len;
+    if (len)
+        std::memcpy(p + PROTO_HEADER_LEN, payload, len);
+
+    std::uint16_t crc = protoCrc16(p + 1, std::uint8_t(PROTO_HEADER_LEN - 1 + len), 0xFFFF);
+    p[PROTO_HEADER_LEN + len] = std::uint8_t(crc & 0xFF);
+    p[PROTO_HEADER_LEN + len + 1] = std::uint8_t(crc >> 8);
+    return PROTO_HEADER_LEN + len + PROTO_CRC_LEN;
+}
+
+void PacketDecoder::reset()
+{
+    state = State::Sync;
+    count = 0;
+    rawLen = 0;
+    replayLen = 0;
+    replayPos = 0;
+}
+
+void PacketDecoder::resync()
+{
+    // Re-run everything after the false sync, ahead of any replay still pending.
+    // Each failure drops at least its sync byte, so this always fits in replay.
+    std::uint8_t pending[MaxPacketSize];
+    std::size_t n = 0;
+    for (std::size_t i = 1; i < rawLen; ++i)
+        pending[n++] = raw[i];
+    for (std::size_t i = replayPos; i < replayLen && n < MaxPacketSize; ++i)
+        pending[n++] = replay[i];
+    std::memcpy(replay, pending, n);
+    replayLen = n;
+    replayPos = 0;
+    rawLen = 0;
+    state = State::Sync;
+}
+
+bool PacketDecoder::step(std::uint8_t b, PacketView &out)
+{
+    if (state != State::Sync && rawLen < MaxPacketSize)
+        raw[rawLen++] = b;
+
+    switch (state) {
+    case State::Sync:
+        if (b == PROTO_SYNC) {
+            state = State::Header;
+            count = 0;
+            raw[0] = b;
+            rawLen = 1;
+        }
+        return false;
+    case State::Header:
+        header[count++] = b;
+        if (count == sizeof(header)) {
+            count = 0;
+            if (header[2] > PROTO_MAX_PAYLOAD)
+                resync(); // cannot be ours
+            else
+                state = header[2] ? State::Payload : State::CrcLo;
+        }
+        return false;
+    case State::Payload:
+        payload[count++] = b;
+        if (count == header[2])
+            state = State::CrcLo;
+        return false;
+    case State::CrcLo:
+        crcLo = b;
+        state = State::CrcHi;
+        return false;
+    case State::CrcHi:
+        break;
+    }
+
+    state = State::Sync;
+    std::uint16_t crc = protoCrc16(header, sizeof(header), 0xFFFF);
+    crc = protoCrc16(payload, header[2], crc);
+    if (crc != std::uint16_t(crcLo | (b << 8))) {
+        ++badCrc;
+        resync();
+        return false;
+    }
+    rawLen = 0;
+    out.type = header[0];
+    out.seq = header[1];
+    out.len = header[2];
+    out.payload = payload;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef BINARY_LINK_H
+#define BINARY_LINK_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "scanner_protocol.h"
+
+// One checked packet as seen by PacketDecoder. payload points into the decoder
+// and is only valid inside the sink callback that receives it.
+struct PacketView {
+    std::uint8_t type = 0;
+    std::uint8_t seq = 0;
+    std::uint8_t len = 0;
+    const std::uint8_t *payload = nullptr;
+};
+
+// Largest encoded packet, see scanner_protocol.h
+constexpr std::size_t MaxPacketSize = PROTO_HEADER_LEN + PROTO_MAX_PAYLOAD + PROTO_CRC_LEN;
+
+// Writes sync, header, payload and crc into out (at least MaxPacketSize bytes), returns the size
+std::size_t encodePacket(std::uint8_t type, std::uint8_t seq, const void *payload, std::uint8_t len, char *out);
+
+// Streaming decoder for the binary link. Hunts for PROTO_SYNC, so it recovers
+// from line noise and from ASCII left in flight when the link was switched.
+// When a candidate fails its crc, the bytes after its sync are re-run, so a
+// stray sync byte in the noise does not swallow the real packet behind it.
+class PacketDecoder
+{
+public:
+    template <typename Sink>
+    void feed(const char *data, std::size_t len, Sink &&sink)
+    {
+        PacketView packet;
+        for (std::size_t i = 0; i < len; ++i) {
+            if (step(std::uint8_t(data[i]), packet))
+                sink(static_cast<const PacketView &>(packet));
+            while (replayPos < replayLen) {
+                if (step(replay[replayPos++], packet))
+                    sink(static_cast<const PacketView &>(packet));
+            }
+        }
+    }
+
+    void reset();
+    unsigned long crcErrors() const { return badCrc; }
+
+private:
+    enum class State { Sync, Header, Payload, CrcLo, CrcHi };
+
+    bool step(std::uint8_t b, PacketView &out);
+    void resync();
+
+    State state = State::Sync;
+    std::uint8_t header[3] = {}; // type, seq, len
+    std::uint8_t payload[PROTO_MAX_PAYLOAD] = {};
+    std::uint8_t count = 0;
+    std::uint8_t crcLo = 0;
+    unsigned long badCrc = 0;
+
+    // Bytes of the current candidate, and what is left to re-run after a bad one
+    std::uint8_t raw[MaxPacketSize] = {};
+    std::size_t rawLen = 0;
+    std::uint8_t replay[MaxPacketSize] = {};
+    std::size_t replayLen = 0;
+    std::size_t replayPos = 0;
+};
+
+#endif // BINARY_LINK_H
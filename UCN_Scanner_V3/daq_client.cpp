@@ -0,0 +1,135 @@
+#include "daq_client.h"
+#include <QStringList>
+#include <QtDebug>
+#include <algorithm>
+
+namespace {
+const quint16 defaultDaqPort = 5555;
+}
+
+DaqClient::DaqClient(QObject *parent) :
+    QObject(parent),
+    socket(new QTcpSocket(this))
+{
+    connect(socket, &QTcpSocket::readyRead, this, &DaqClient::onReadyRead);
+    connect(socket, &QTcpSocket::connected, this, [this]() {
+        emit connectionChanged(true, QString());
+    });
+    connect(socket, &QTcpSocket::disconnected, this, [this]() {
+        opened.clear();
+        emit connectionChanged(false, socket->errorString());
+    });
+    connect(socket, &QTcpSocket::errorOccurred, this, [this](QAbstractSocket::SocketError) {
+        // A failed connect; a lost connection also gets disconnected()
+        if (socket->state() != QAbstractSocket::ConnectedState && socket->state() != QAbstractSocket::ClosingState)
+            emit connectionChanged(false, socket->errorString());
+    });
+}
+
+void DaqClient::connectTo(const QString &address)
+{
+    disconnectFrom();
+    hostPort = address.trimmed();
+    int colon = hostPort.lastIndexOf(':');
+    QString host = colon < 0 ? hostPort : hostPort.left(colon);
+    bool ok = true;
+    quint16 port = colon < 0 ? defaultDaqPort : hostPort.mid(colon + 1).toUShort(&ok);
+    if (host.isEmpty() || !ok || port == 0) {
+        emit connectionChanged(false, QString("Expected host:port, got \"%1\"").arg(hostPort));
+        return;
+    }
+    closed.clear();
+    socket->connectToHost(host, port);
+}
+
+void DaqClient::disconnectFrom()
+{
+    if (socket->state() != QAbstractSocket::UnconnectedState)
+        socket->abort();
+    opened.clear();
+}
+
+bool DaqClient::isConnected() const
+{
+    return socket->state() == QAbstractSocket::ConnectedState;
+}
+
+bool DaqClient::check()
+{
+    return send("CHECK");
+}
+
+bool DaqClient::requestRunNumber()
+{
+    return send("RUN?");
+}
+
+bool DaqClient::start(long points, double seconds)
+{
+    return send(QString("START %1 %2").arg(points).arg(seconds, 0, 'f', 3));
+}
+
+bool DaqClient::open(long n, const QPointF &pointCm, double seconds)
+{
+    if (!send(QString("OPEN %1 %2 %3 %4").arg(n).arg(pointCm.x(), 0, 'f', 3).arg(pointCm.y(), 0, 'f', 3).arg(seconds, 0, 'f', 3)))
+        return false;
+    opened.push_back(DaqWindow{n, pointCm, 0.0, 0.0});
+    return true;
+}
+
+bool DaqClient::stop()
+{
+    return send("STOP");
+}
+
+bool DaqClient::send(const QString &line)
+{
+    if (!isConnected())
+        return false;
+    socket->write(line.toUtf8() + '\n');
+    return true;
+}
+
+void DaqClient::onReadyRead()
+{
+    while (socket->canReadLine()) {
+        const QString line = QString::fromUtf8(socket->readLine()).trimmed();
+        const QStringList fields = line.split(' ', Qt::SkipEmptyParts);
+        if (fields.isEmpty())
+            continue;
+        const QString &verb = fields[0];
+        const QString rest = line.mid(verb.size()).trimmed();
+        const long value = fields.size() > 1 ? fields[1].toLong() : -1;
+
+        if (verb == "READY") {
+            emit checked(true, QString());
+        } else if (verb == "BUSY") {
+            emit checked(false, rest);
+        } else if (verb == "RUN" && fields.size() == 2) {
+            emit runNumber(value);
+        } else if (verb == "STARTED" && fields.size() == 2) {
+            emit started(value);
+        } else if (verb == "OPENED" && fields.size() == 2) {
+            emit windowOpened(value);
+        } else if (verb == "CLOSED" && fields.size() == 4) {
+            auto w = std::find_if(opened.begin(), opened.end(), [value](const DaqWindow &o) { return o.n == value; });
+            if (w == opened.end()) {
+                qDebug() << "DAQ closed a window that was not open:" << line;
+                continue;
+            }
+            DaqWindow window = *w;
+            opened.erase(w);
+            window.counts = fields[2].toDouble();
+            window.liveS = fields[3].toDouble();
+            closed.push_back(window);
+            emit windowClosed(window);
+        } else if (verb == "STOPPED") {
+            opened.clear();
+            emit stopped(value);
+        } else if (verb == "ERROR") {
+            emit daqError(rest);
+        } else {
+            emit daqError(QString("Unexpected reply \"%1\"").arg(line));
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef DAQ_CLIENT_H
+#define DAQ_CLIENT_H
+
+#include <QObject>
+#include <QPointF>
+#include <QString>
+#include <QTcpSocket>
+#include <vector>
+
+// Connection to the DAQ run control, one text line per message. The DAQ
+// answers every request with one line; CLOSED follows OPENED once the
+// window's live time is up. mock_daq/ serves the same for tests.
+//
+//   CHECK                       READY | BUSY <why>
+//   RUN?                        RUN <run>            (current, or the last one)
+//   START <points> <seconds>    STARTED <run>        (when it takes windows)
+//   OPEN <n> <x> <y> <seconds>  OPENED <n>, then CLOSED <n> <counts> <live s>
+//   STOP                        STOPPED <run>
+//   anything it cannot do       ERROR <text>
+//
+// x and y are the stage position in cm. The GUI gates the sketch on these
+// (see scanner_protocol.h): a scan starts on STARTED and leaves a point on
+// its CLOSED.
+struct DaqWindow
+{
+    long n;
+    QPointF pointCm;
+    double counts;
+    double liveS;
+};
+
+class DaqClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DaqClient(QObject *parent = nullptr);
+
+    // "host:port"; replaces any connection there is
+    void connectTo(const QString &address);
+    void disconnectFrom();
+    bool isConnected() const;
+    QString address() const { return hostPort; }
+
+    // False when not connected
+    bool check();
+    bool requestRunNumber();
+    bool start(long points, double seconds);
+    bool open(long n, const QPointF &pointCm, double seconds);
+    bool stop();
+
+    // Every window closed since the connection was made, in order
+    const std::vector<DaqWindow> &closedWindows() const { return closed; }
+
+signals:
+    void connectionChanged(bool connected, const QString &error);
+    void checked(bool ready, const QString &why);
+    void runNumber(long run);
+    void started(long run);
+    void windowOpened(long n);
+    void windowClosed(const DaqWindow &window);
+    void stopped(long run);
+    void daqError(const QString &error);
+
+private:
+    bool send(const QString &line);
+    void onReadyRead();
+
+    QTcpSocket *socket;
+    QString hostPort;
+    std::vector<DaqWindow> opened; // OPEN sent, no CLOSED yet
+    std::vector<DaqWindow> closed;
+};
+
+#endif // DAQ_CLIENT_H
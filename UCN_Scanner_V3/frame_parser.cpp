@@ -0,0 +1,282 @@
+#include "frame_parser.h"
+
+#include "scanner_protocol.h"
+
+namespace {
+
+bool startsWith(std::string_view s, std::string_view prefix)
+{
+    return s.substr(0, prefix.size()) == prefix;
+}
+
+bool endsWith(std::string_view s, std::string_view suffix)
+{
+    return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
+}
+
+bool isBlank(std::string_view s)
+{
+    for (char c : s) {
+        if (c != ' ' && c != '\t')
+            return false;
+    }
+    return true;
+}
+
+// Cuts the next comma separated field off the front of rest
+std::string_view nextField(std::string_view &rest)
+{
+    std::size_t comma = rest.find(',');
+    std::string_view field = rest.substr(0, comma);
+    rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+    return field;
+}
+
+bool parseInt(std::string_view s, int &out)
+{
+    std::size_t i = 0;
+    bool neg = false;
+    if (i < s.size() && s[i] == '-') {
+        neg = true;
+        ++i;
+    }
+    if (i == s.size())
+        return false;
+    int value = 0;
+    for (; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+        value = value * 10 + (s[i] - '0');
+    }
+    out = neg ? -value : value;
+    return true;
+}
+
+bool parseUnsigned(std::string_view s, std::uint32_t &out)
+{
+    if (s.empty() || s.size() > 10)
+        return false;
+    std::uint64_t value = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + std::uint64_t(c - '0');
+    }
+    if (value > 0xFFFFFFFFu)
+        return false;
+    out = std::uint32_t(value);
+    return true;
+}
+
+// [-]digits[.digits] and nothing else, which is all Serial.print(double) produces
+bool parseNumber(std::string_view s, double &out)
+{
+    std::size_t i = 0;
+    bool neg = false;
+    bool digits = false;
+    if (i < s.size() && s[i] == '-') {
+        neg = true;
+        ++i;
+    }
+    double value = 0.0;
+    for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i) {
+        value = value * 10.0 + (s[i] - '0');
+        digits = true;
+    }
+    if (i < s.size() && s[i] == '.') {
+        double scale = 0.1;
+        for (++i; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i) {
+            value += (s[i] - '0') * scale;
+            scale *= 0.1;
+            digits = true;
+        }
+    }
+    if (!digits || i != s.size())
+        return false;
+    out = neg ? -value : value;
+    return true;
+}
+
+const std::string_view echoMarker = "Received: ";
+
+} // namespace
+
+void FrameParser::reset()
+{
+    head = 0;
+    restart();
+    state = State::Text;
+    statusCandidate = 0;
+    echoPrefix = false;
+    havePendingX = false;
+    pendingX = 0.0;
+}
+
+void FrameParser::put(char c)
+{
+    ring[head] = c;
+    ring[head + Capacity] = c;
+    head = (head + 1) & (Capacity - 1);
+    ++length;
+}
+
+void FrameParser::restart()
+{
+    start = head;
+    length = 0;
+}
+
+std::string_view FrameParser::token() const
+{
+    return std::string_view(ring + start, length);
+}
+
+bool FrameParser::step(char c, FrameView &out)
+{
+    if (state == State::Frame) {
+        if (c == '>') {
+            bool ready = finishFrame(out);
+            restart();
+            state = State::Text;
+            return ready;
+        }
+        if (c == '<') {
+            restart(); // unterminated frame, start over
+            statusCandidate = 0;
+            echoPrefix = false;
+            return false;
+        }
+        if (length >= MaxFrame) {
+            restart(); // too long to be ours, drop it as noise
+            state = State::Text;
+            statusCandidate = 0;
+            echoPrefix = false;
+            return false;
+        }
+        put(c);
+        return false;
+    }
+
+    if (c == '<') {
+        // Whatever text came before the marker is flushed here
+        std::string_view text = token();
+        bool ready = false;
+        statusCandidate = 0;
+        echoPrefix = false;
+        if (text.size() == 1 && (text[0] == '9' || text[0] == '0')) {
+            statusCandidate = text[0];
+        } else {
+            if (endsWith(text, echoMarker)) {
+                echoPrefix = true;
+                text.remove_suffix(echoMarker.size());
+            }
+            if (!isBlank(text)) {
+                out = FrameView();
+                out.type = FrameType::Text;
+                out.body = text;
+                ready = true;
+            }
+        }
+        restart();
+        state = State::Frame;
+        return ready;
+    }
+    if (c == '\n')
+        return finishText(out);
+    if (c == '\r')
+        return false;
+
+    put(c);
+    if (length == Capacity)
+        return finishText(out); // overlong line, hand it over in pieces
+    return false;
+}
+
+bool FrameParser::finishText(FrameView &out)
+{
+    std::string_view text = token();
+    restart();
+    if (isBlank(text))
+        return false;
+    out = FrameView();
+    out.type = FrameType::Text;
+    out.body = text;
+    return true;
+}
+
+bool FrameParser::finishFrame(FrameView &out)
+{
+    std::string_view body = token();
+    char candidate = statusCandidate;
+    bool echo = echoPrefix;
+    statusCandidate = 0;
+    echoPrefix = false;
+
+    out = FrameView();
+    out.body = body;
+
+    double value = 0.0;
+    if (echo) {
+        out.type = FrameType::Echo;
+    } else if (startsWith(body, "SCAN_INDEX,")) {
+        std::string_view rest = body.substr(11);
+        out.type = FrameType::ScanIndex;
+        out.point = -1;
+        if (!parseInt(nextField(rest), out.row) || !parseInt(nextField(rest), out.col)
+            || (!rest.empty() && !parseInt(nextField(rest), out.point)))
+            out.type = FrameType::Echo;
+    } else if (startsWith(body, "CREDIT,")) {
+        out.type = FrameType::Credit;
+        if (!parseInt(body.substr(7), out.credits))
+            out.type = FrameType::Echo;
+    } else if (startsWith(body, "POINT_TIME,")) {
+        std::string_view rest = body.substr(11);
+        out.type = FrameType::PointTime;
+        if (!parseInt(nextField(rest), out.point))
+            out.type = FrameType::Echo;
+        for (std::uint32_t &us : out.us) {
+            if (!parseUnsigned(nextField(rest), us))
+                out.type = FrameType::Echo;
+        }
+        int x = 0;
+        int y = 0;
+        if (!parseInt(nextField(rest), x) || !parseInt(nextField(rest), y))
+            out.type = FrameType::Echo;
+        out.x = x;
+        out.y = y;
+    } else if (startsWith(body, "ID,")) {
+        // Any other device's ID is just an echo
+        std::string_view rest = body.substr(3);
+        out.type = FrameType::Id;
+        std::string_view ready;
+        if (nextField(rest) != SCANNER_ID || !parseInt(nextField(rest), out.point) || (ready = nextField(rest)).empty())
+            out.type = FrameType::Echo;
+        else
+            out.status = ready[0];
+    } else if (startsWith(body, "READY,")) {
+        out.type = FrameType::Ready;
+        out.status = body.size() > 6 ? body[6] : 0;
+    } else if (startsWith(body, "SCAN_DONE")) {
+        out.type = FrameType::ScanDone;
+    } else if (startsWith(body, "DEBUG")) {
+        out.type = FrameType::Debug;
+    } else if (parseNumber(body, value)) {
+        // Reply to a stop: optional status byte, then <X><Y> back to back
+        if (!havePendingX) {
+            pendingX = value;
+            havePendingX = true;
+            if (candidate == 0)
+                return false;
+            out.type = FrameType::StopStatus;
+            out.status = candidate;
+            return true;
+        }
+        out.type = FrameType::Position;
+        out.x = pendingX;
+        out.y = value;
+    } else {
+        out.type = FrameType::Echo;
+    }
+    havePendingX = false;
+    return true;
+}
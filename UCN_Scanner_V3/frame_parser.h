@@ -0,0 +1,71 @@
+#ifndef FRAME_PARSER_H
+#define FRAME_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "scanner_frame.h"
+
+// One message as seen by FrameParser. body points into the parser's ring buffer
+// and is only valid inside the sink callback that receives it.
+struct FrameView {
+    FrameType type = FrameType::Text;
+    std::string_view body; // text between < and >, or the text line without \r\n
+    int row = 0;
+    int col = 0;
+    int point = -1;
+    double x = 0.0;
+    double y = 0.0;
+    char status = 0;
+    int credits = 0;
+    std::uint32_t us[4] = {};
+};
+
+// Streaming parser for the Arduino's <...> protocol.
+// Bytes are pushed in whatever chunks the port delivers; partial frames carry
+// over to the next feed() and anything outside markers is reported as text lines.
+// No allocation happens after construction.
+class FrameParser
+{
+public:
+    static constexpr std::size_t Capacity = 256; // longest text line kept, power of two
+    static constexpr std::size_t MaxFrame = 96;  // longer <...> runs are treated as noise
+
+    template <typename Sink>
+    void feed(const char *data, std::size_t len, Sink &&sink)
+    {
+        FrameView frame;
+        for (std::size_t i = 0; i < len; ++i) {
+            if (step(data[i], frame))
+                sink(static_cast<const FrameView &>(frame));
+        }
+    }
+
+    void reset();
+
+private:
+    enum class State { Text, Frame };
+
+    bool step(char c, FrameView &out);
+    bool finishFrame(FrameView &out);
+    bool finishText(FrameView &out);
+    void put(char c);
+    void restart();
+    std::string_view token() const;
+
+    // Mirrored ring: every byte is stored at i and i + Capacity, so any run of
+    // up to Capacity bytes starting anywhere in the ring is contiguous in memory.
+    char ring[2 * Capacity] = {};
+    std::size_t head = 0;  // next write position, 0 <= head < Capacity
+    std::size_t start = 0; // first byte of the current token
+    std::size_t length = 0;
+
+    State state = State::Text;
+    char statusCandidate = 0; // lone '9'/'0' right before '<' (reply to a stop)
+    bool echoPrefix = false;  // "Received: " right before '<'
+    bool havePendingX = false;
+    double pendingX = 0.0;
+};
+
+#endif // FRAME_PARSER_H
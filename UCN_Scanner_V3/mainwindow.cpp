@@ -8,12 +8,93 @@
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QThread>
+#include <QDir>
+#include <QFile>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <algorithm>
+#include <cstring>
 //#include <cmath> //Derek added
 
+namespace {
+const int rateTimeoutMs = 30000; // for the rates of an adaptive pass, then its gaps are refined anyway
+
+// Indexed by SCAN_ORDER_* (scanner_protocol.h)
+const char *const scanOrderNames[] = {"Rows", "Serpentine", "Columns", "Column serpentine"};
+
+QString formatDuration(double ms)
+{
+    qint64 s = qint64(ms / 1000.0 + 0.5);
+    return QString("%1:%2:%3").arg(s / 3600).arg(s / 60 % 60, 2, 10, QChar('0')).arg(s % 60, 2, 10, QChar('0'));
+}
+
+// Ports the scanner may be on, all probed at once by SerialWorker::discoverPort():
+// the USB ones (the Uno, or a USB serial adapter), not the motherboard's
+// ttyS*, and the virtual Arduino's pty if it runs
+QStringList scannerPortCandidates()
+{
+    QStringList names;
+    for (const QSerialPortInfo &info : QSerialPortInfo::availablePorts()) {
+        if (info.hasVendorIdentifier())
+            names << info.systemLocation();
+    }
+    if (QFileInfo::exists("/tmp/ttyVACM0"))
+        names << "/tmp/ttyVACM0";
+    return names;
+}
+
+// Path file: one waypoint per line, "x y [dwell]" in cm and s, separated by
+// spaces, tabs or commas; '#' starts a comment. No dwell means defaultDwell.
+bool loadPath(const QString &fileName, double defaultDwell, QVector<WaypointPacket> &path, QString &error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        error = file.errorString();
+        return false;
+    }
+    QTextStream in(&file);
+    const QRegularExpression separators("[\\s,]+");
+    int lineNo = 0;
+    while (!in.atEnd()) {
+        ++lineNo;
+        QString line = in.readLine();
+        line.truncate(line.indexOf('#') < 0 ? line.size() : line.indexOf('#'));
+        const QStringList fields = line.split(separators, Qt::SkipEmptyParts);
+        if (fields.isEmpty())
+            continue;
+
+        bool okX = false, okY = false, okDwell = true;
+        WaypointPacket w;
+        w.x = fields[0].toFloat(&okX);
+        w.y = fields.size() > 1 ? fields[1].toFloat(&okY) : 0.0f;
+        w.dwell = fields.size() > 2 ? fields[2].toFloat(&okDwell) : float(defaultDwell);
+        if (!okX || !okY || !okDwell || fields.size() > 3) {
+            error = QString("Line %1: expected x y [dwell]").arg(lineNo);
+            return false;
+        }
+        if (w.x < 0 || w.x > 59.0f || w.y < 0 || w.y > 28.0f || w.dwell < 0) {
+            error = QString("Line %1: outside 0-59 cm (x), 0-28 cm (y) or negative dwell").arg(lineNo);
+            return false;
+        }
+        w.row = -1;
+        w.col = -1;
+        path.append(w);
+    }
+    if (path.isEmpty()) {
+        error = "No waypoints in the file";
+        return false;
+    }
+    return true;
+}
+}
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    port(new QSerialPort(this))
+    serial(new SerialWorker)
 {
     ui->setupUi(this);
     ui->label_4->setPixmap(QPixmap(":/images/label_4.png"));
@@ -27,8 +108,65 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->runTimeEnd->setAlignment(Qt::AlignCenter);
     ui->runTimeEnd->setText("--/--, --:--, --");
 
-    scanMonitorTimer = new QTimer(this);
-    connect(scanMonitorTimer, &QTimer::timeout, this, &MainWindow::checkArduinoScanComplete);
+    // Link used after connecting; the Arduino always starts in ASCII at 9600
+    ui->linkBox->addItem("ASCII 9600", PROTO_ASCII_BAUD);
+    ui->linkBox->addItem("Binary 115200", 115200);
+    ui->linkBox->addItem("Binary 250000", 250000);
+    ui->linkBox->addItem("Binary 500000", 500000);
+    ui->linkBox->addItem("Binary 1000000", 1000000);
+    ui->linkBox->setCurrentIndex(1);
+
+    // Serpentine skips the flyback to colMin after every row
+    for (int order = SCAN_ORDER_ROWS; order <= SCAN_ORDER_COLUMN_SERPENTINE; ++order)
+        ui->orderBox->addItem(scanOrderNames[order], order);
+    ui->orderBox->setCurrentIndex(SCAN_ORDER_SERPENTINE);
+
+    // Each order's estimated duration, refreshed shortly after the selection settles
+    orderEstimateTimer = new QTimer(this);
+    orderEstimateTimer->setSingleShot(true);
+    orderEstimateTimer->setInterval(250);
+    connect(orderEstimateTimer, &QTimer::timeout, this, &MainWindow::updateOrderEstimates);
+    connect(ui->scanGrid, &ScanGrid::selectionChanged, orderEstimateTimer, QOverload<>::of(&QTimer::start));
+    connect(ui->sampleTime, &QLineEdit::editingFinished, orderEstimateTimer, QOverload<>::of(&QTimer::start));
+    connect(ui->rehomeBox, QOverload<int>::of(&QSpinBox::valueChanged), orderEstimateTimer, QOverload<>::of(&QTimer::start));
+
+    // Past runs calibrate the scan time estimate
+    QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dataDir);
+    timingLogPath = dataDir + "/scan_timing.log";
+    pointLogPath = dataDir + "/point_windows.log";
+    resultDir = dataDir + "/runs";
+    QDir().mkpath(resultDir);
+    checkpointPath = dataDir + "/scan_checkpoint.log";
+    refitEstimator(PROTO_ASCII_BAUD);
+
+    // DAQ handshake for gated scans, see daq_client.h; fixed waits without it
+    blind = true;
+    sis_is_running = false;
+    runnumber = 0;
+    socket_control = new DaqClient(this);
+    connect(socket_control, &DaqClient::connectionChanged, this, &MainWindow::onDaqConnection);
+    connect(socket_control, &DaqClient::checked, this, [=](bool ready, const QString &why) {
+        ui->statusBar->showMessage(ready ? QString("DAQ ready") : QString("DAQ busy: %1").arg(why), 5000);
+    });
+    connect(socket_control, &DaqClient::runNumber, this, [=](long run) {
+        runnumber = int(run);
+        qDebug() << "DAQ run number" << runnumber;
+    });
+    connect(socket_control, &DaqClient::started, this, &MainWindow::onDaqStarted);
+    connect(socket_control, &DaqClient::windowClosed, this, &MainWindow::onDaqWindowClosed);
+    connect(socket_control, &DaqClient::stopped, this, [](long run) {
+        qDebug() << "DAQ run" << run << "stopped";
+    });
+    connect(socket_control, &DaqClient::daqError, this, &MainWindow::onDaqError);
+
+    // Polls for the rates of an adaptive pass once the stage is done with it
+    rateTimer = new QTimer(this);
+    rateTimer->setInterval(500);
+    connect(rateTimer, &QTimer::timeout, this, &MainWindow::onRateTimer);
+
+    testSerialTimer = new QTimer(this);
+    connect(testSerialTimer, &QTimer::timeout, this, &MainWindow::onTestSerialTick);
     connect(ui->sampleSpacing, &QLineEdit::editingFinished, this, &MainWindow::setupScanGrid);
 
     setupScanGrid();
@@ -37,8 +175,10 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {
+    // Worker closes the port and is deleted when the thread finishes
+    serialThread.quit();
+    serialThread.wait();
     delete ui;
-    //port->close(); // Close  arduino serial port on exit
 }
 
 //**********************
@@ -52,100 +192,403 @@ MainWindow::~MainWindow()
 //Run Scan == 5; Stop == 6 //
 //Update Position == 7;    //
 //Return Home == 8;        //
+//Motion limits, X and Y:  //
+//V RPM; A RPM/s; J RPM/s^2//
+//Path == P; Waypoint == W//
 //Total length = 59cm//
 //Total width = 28cm  //
 //*************************//
 
-void MainWindow::checkArduinoScanComplete()
+void MainWindow::init_port()
+{
+    // The port lives on serialThread; the UI only queues packets and drains parsed frames
+    qRegisterMetaType<ScanPacket>("ScanPacket");
+    qRegisterMetaType<QVector<WaypointPacket>>("QVector<WaypointPacket>");
+    qRegisterMetaType<QVector<MaskRun>>("QVector<MaskRun>");
+    serial->moveToThread(&serialThread);
+    connect(&serialThread, &QThread::finished, serial, &QObject::deleteLater);
+    connect(this, &MainWindow::portDiscoveryRequested, serial, &SerialWorker::discoverPort);
+    connect(this, &MainWindow::linkRequested, serial, &SerialWorker::negotiateLink);
+    connect(this, &MainWindow::commandRequested, serial, &SerialWorker::sendCommand);
+    connect(this, &MainWindow::scanRequested, serial, &SerialWorker::sendScan);
+    connect(this, &MainWindow::maskRequested, serial, &SerialWorker::sendMask);
+    connect(this, &MainWindow::pathRequested, serial, &SerialWorker::sendPath);
+    connect(serial, &SerialWorker::portOpened, this, &MainWindow::onPortOpened);
+    connect(serial, &SerialWorker::portDiscovered, this, [this](const QString &name) {
+        qDebug() << "Scanner found on" << name;
+        ui->statusBar->showMessage(QString("Scanner on %1, starting up. Please wait...").arg(name));
+    });
+    connect(serial, &SerialWorker::linkChanged, this, &MainWindow::onLinkChanged);
+    connect(serial, &SerialWorker::framesReady, this, &MainWindow::onSerialFramesReady);
+    connect(serial, &SerialWorker::portError, this, [](const QString &error) {
+        qDebug() << "Serial port error: " << error;
+    });
+    serialThread.start();
+
+    emit portDiscoveryRequested(scannerPortCandidates());
+
+    // Disable UI to prevent bugs
+    this->setEnabled(false);
+    ui->statusBar->showMessage("Looking for the scanner. Please wait...");
+    // Ended by its READY, which comes once it has homed (up to some 20 s from
+    // the far corner) or at once when it did not have to; the timeout only
+    // frees the UI of a board that never sends one
+    initTimer = new QTimer(this);
+    initTimer->setSingleShot(true);
+    connect(initTimer, &QTimer::timeout, this, [this]() {
+        qDebug() << "No READY from the Arduino";
+        endInit();
+    });
+    initTimer->start(30000);
+}
+
+void MainWindow::endInit()
+{
+    if (isEnabled())
+        return;
+    initTimer->stop();
+    ui->statusBar->clearMessage();
+    this->setEnabled(true);
+    // Arduino is past its reset and homing by now, ask for the faster link
+    if (portOpen)
+        emit linkRequested(ui->linkBox->currentData().toInt());
+}
+
+void MainWindow::onPortOpened(bool ok, const QString &error)
+{
+    portOpen = ok;
+    if (!ok) {
+        qDebug() << "Failed to open serial port: " << error;
+        QMessageBox::warning(this, "PORT ERROR", "No scanner found!\n" + error);
+        endInit(); // no READY to wait for
+    } else {
+        qDebug() << "Serial port opened successfully.";
+    }
+    // Opening the port resets the Arduino to its default limits and its clock
+    motionX = ScanPlan().limitsX;
+    motionY = ScanPlan().limitsY;
+    arduinoClock.reset();
+    positionKnown = true;
+    travelSinceHome = 0.0;
+}
+
+void MainWindow::onLinkChanged(bool binary, qint32 baudRate)
 {
-    QByteArray response;
-    if (port->waitForReadyRead(200)) {
-        readArduino(&response);
-        incomingBuffer += response;
+    QString link = QString("%1 link at %2 baud").arg(binary ? "Binary" : "ASCII").arg(baudRate);
+    qDebug() << "Serial link:" << link;
+    ui->statusBar->showMessage(link, 5000);
+    binaryLink = binary;
 
+    // Show what is actually in use, e.g. after falling back to ASCII
+    int index = ui->linkBox->findData(binary ? baudRate : PROTO_ASCII_BAUD);
+    if (index >= 0)
+        ui->linkBox->setCurrentIndex(index);
+
+    refitEstimator(binary ? baudRate : PROTO_ASCII_BAUD);
+}
+
+void MainWindow::on_linkBox_activated(int index)
+{
+    if (portOpen)
+        emit linkRequested(ui->linkBox->itemData(index).toInt());
+}
+
+void MainWindow::onSerialFramesReady()
+{
+    serial->rearmNotify();
+    SerialFrame frame;
+    while (serial->takeFrame(frame))
+        handleFrame(frame);
+}
+
+void MainWindow::handleFrame(const SerialFrame &frame)
+{
+    QPointF pointCm;
+    switch (frame.type) {
+    case FrameType::ScanDone:
+        endRunCells(ScanGrid::CellState::Error);
+        resultStore.finish(ScanStoreDone, arduinoClock.driftPpm());
+        if (currentPath.isEmpty())
+            QFile::remove(checkpointPath); // nothing left to resume
+        logPointWindows();
+        endGate();
+        if (scanActive) {
+            currentRun.doneMs = scanClock.nsecsElapsed() / 1.0e6;
+            logScanRun();
+        }
+        ui->runTimeEnd->setText(("--/--, --:--, --"));
+        qDebug() << "Scan complete: received '<SCAN_DONE>' from Arduino.";
+        if (adaptive) {
+            // The next pass depends on the rates of this one
+            rateWait.start();
+            rateTimer->start();
+            ui->statusBar->showMessage(QString("Adaptive pass %1 done, waiting for its rates").arg(adaptivePass + 1));
+            break;
+        }
+        ui->runScan->setEnabled(true);
+        ui->runPath->setEnabled(true);
+        ui->resumeScan->setEnabled(true);
+        ui->runAdaptive->setEnabled(true);
+        ui->stopScan->setEnabled(false);
+        break;
+    case FrameType::ScanIndex:
         if (ui->debugBox->isChecked())
-            qDebug() << "<DEBUG> Arduino Response: " << incomingBuffer;
-
-        QList<QByteArray> parts = incomingBuffer.split('>');
-        for (int i = 0; i < parts.size() - 1; ++i) {
-            const QByteArray& part = parts[i];
-            int startIdx = part.indexOf('<');
-            if (startIdx == -1) continue;
-
-            QByteArray message = part.mid(startIdx);
-
-            if (message.contains("<SCAN_DONE")) {
-                scanMonitorTimer->stop();
-                ui->runScan->setEnabled(true);
-                ui->runTimeEnd->setText(("--/--, --:--, --"));
-                ui->stopScan->setEnabled(false);
-                qDebug() << "Scan complete: received '<SCAN_DONE>' from Arduino.";
-                incomingBuffer.clear();
-                return;
+            qDebug() << "<DEBUG> Scan index:" << frame.row << "," << frame.col;
+        pointCm = pointPositionCm(frame);
+        if (!blind && sis_is_running) {
+            // The point's acquisition window; the sketch stays until it is closed
+            double seconds = gateTiming;
+            if (!currentPath.isEmpty())
+                seconds = currentPath[qBound(0, int(frame.point), int(currentPath.size()) - 1)].dwell;
+            socket_control->open(frame.point, pointCm, seconds);
+        }
+        if (frame.point >= 0) {
+            PointWindow w;
+            w.n = frame.point;
+            w.row = frame.row;
+            w.col = frame.col;
+            w.xCm = pointCm.x();
+            w.yCm = pointCm.y();
+            pointWindows.push_back(w);
+
+            // Points skipped over were reached, but nothing said so
+            for (long k = runIndexed + 1; k < frame.point; ++k)
+                setRunCellState(k, ScanGrid::CellState::Error);
+            setRunCellState(frame.point, ScanGrid::CellState::Dwelling);
+            runIndexed = std::max(runIndexed, long(frame.point));
+
+            ScanRecord rec = {};
+            rec.n = std::uint32_t(frame.point);
+            rec.row = qint16(frame.row);
+            rec.col = qint16(frame.col);
+            rec.xCm = float(pointCm.x());
+            rec.yCm = float(pointCm.y());
+            rec.xCmdSteps = qint32(pointCm.x() * Stage::stepsPerCmX * Stage::usteps + 0.5);
+            rec.yCmdSteps = qint32(pointCm.y() * Stage::stepsPerCmY * Stage::usteps + 0.5);
+            rec.status = ScanRecordIndexed;
+            rec.indexUs = frame.hostUs + storeEpochUs;
+            if (resultStore.isOpen() && !resultStore.put(rec))
+                qDebug() << "Result file:" << QString::fromStdString(resultStore.error());
+        }
+        if (scanActive) {
+            // Re-anchor the end time on every point; n from the firmware survives a lost line
+            currentRun.indexMs.push_back(scanClock.nsecsElapsed() / 1.0e6);
+            std::size_t k = frame.point >= 0 ? std::size_t(frame.point) : currentRun.indexMs.size() - 1;
+            if (k < currentEstimate.pointMs.size()) {
+                double remainingMs = currentEstimate.totalMs - currentEstimate.pointMs[k];
+                QDateTime finishTime = QDateTime::currentDateTime().addMSecs(qint64(remainingMs));
+                ui->runTimeEnd->setText(finishTime.toString("MM/dd, hh:mm, ap"));
             }
         }
-        incomingBuffer = parts.last();
+        break;
+    case FrameType::PointTime: {
+        setRunCellState(frame.point, ScanGrid::CellState::Done);
+        setRunCellState(frame.point + 1, ScanGrid::CellState::Moving);
+        stageMovedTo(frame.x, frame.y);
+
+        // Sent right after its dwell end stamp, so that and the time the
+        // message started on the line make a clock sample. ASCII: '<' body '>' "\r\n"
+        const double bytes = binaryLink ? PROTO_HEADER_LEN + sizeof(PointTimePacket) + PROTO_CRC_LEN
+                                        : std::strlen(frame.text) + 4;
+        arduinoClock.add(frame.us[3], frame.hostUs - qint64(bytes * 10.0e6 / estimator.linkBaud()));
+        auto w = std::find_if(pointWindows.rbegin(), pointWindows.rend(), [&](const PointWindow &p) { return p.n == frame.point; });
+        if (w == pointWindows.rend())
+            break;
+        for (int k = 0; k < 4; ++k)
+            w->deviceUs[k] = arduinoClock.unwrap(frame.us[k]);
+        w->timed = true;
+
+        ScanRecord rec;
+        if (resultStore.get(std::uint32_t(frame.point), rec)) {
+            rec.xSteps = qint32(frame.x);
+            rec.ySteps = qint32(frame.y);
+            rec.moveStartUs = qint64(arduinoClock.toHost(w->deviceUs[0])) + storeEpochUs;
+            rec.moveEndUs = qint64(arduinoClock.toHost(w->deviceUs[1])) + storeEpochUs;
+            rec.triggerUs = qint64(arduinoClock.toHost(w->deviceUs[2])) + storeEpochUs;
+            rec.dwellEndUs = qint64(arduinoClock.toHost(w->deviceUs[3])) + storeEpochUs;
+            rec.liveS = float((rec.dwellEndUs - rec.triggerUs) / 1.0e6);
+            rec.status |= ScanRecordTimed;
+            if (!resultStore.put(rec))
+                qDebug() << "Result file:" << QString::fromStdString(resultStore.error());
+        }
+        if (ui->debugBox->isChecked())
+            qDebug() << "<DEBUG> Point" << frame.point << "live" << (frame.us[3] - frame.us[2]) / 1.0e6 << "s";
+        break;
+    }
+    case FrameType::StopStatus:
+        if (frame.status == '9') {
+            qDebug() << "Scan successfully stopped.";
+        } else {
+            qDebug() << "Scan was never running.";
+        }
+        break;
+    case FrameType::Position:
+        stageMovedTo(frame.x, frame.y);
+        qDebug() << "Parsed X:" << currentX << "Parsed Y:" << currentY;
+        updatePosDisplay();
+        qDebug() << "Stop procedure complete.";
+        break;
+    case FrameType::Id:
+        qDebug() << "Scanner firmware, protocol version" << frame.point;
+        if (frame.point != SCANNER_PROTOCOL_VERSION)
+            qWarning() << "The GUI speaks protocol version" << SCANNER_PROTOCOL_VERSION;
+        // Ready already: opening the port did not reset it, so it has not
+        // homed for us and where it is was not reported
+        if (frame.status == '1') {
+            positionKnown = false;
+            endInit();
+        }
+        break;
+    case FrameType::Ready:
+        // Homed, or back where it last stopped cleanly (the Position came just before)
+        qDebug() << "Arduino reset," << (frame.status == '1' ? "position restored" : "homed");
+        positionKnown = true;
+        if (frame.status != '1')
+            travelSinceHome = 0.0;
+        endInit();
+        break;
+    case FrameType::Debug:
+    case FrameType::Credit:
+    case FrameType::Echo:
+    case FrameType::Text:
+        qDebug() << "Arduino response:" << frame.text;
+        break;
     }
 }
 
-void MainWindow::readArduino(QByteArray* out=nullptr) {
-    QByteArray response;
-    if (port->waitForReadyRead(500)) {
-        response = port->readAll();
-        while (port->waitForReadyRead(100)) {
-            response += port->readAll();
-        }
-        response.replace("\r\n", ". ");
+// Where the point of a SCAN_INDEX is on the stage, in cm: the waypoint of a
+// path, else the cell of the scan, clipped like the sketch does
+QPointF MainWindow::pointPositionCm(const SerialFrame &frame) const
+{
+    QPointF pointCm(frame.col * currentRun.plan.spacing, frame.row * currentRun.plan.spacing);
+    if (!currentPath.isEmpty()) {
+        const WaypointPacket &w = currentPath[qBound(0, int(frame.point), int(currentPath.size()) - 1)];
+        pointCm = QPointF(w.x, w.y);
     }
-    if (out) {
-        *out = response;
-    } else {
-        qDebug() << "Arduino response:" << response;
+    return QPointF(qMin(pointCm.x(), 59.0), qMin(pointCm.y(), 28.0));
+}
+
+// The run that starts: its cells pending on the grid, the first one on the
+// way. An adaptive scan keeps the passes before on it.
+void MainWindow::paintGridByState()
+{
+    if (!adaptive || adaptivePass == 0)
+        ui->scanGrid->clearStates();
+    runIndexed = -1;
+    for (std::size_t n = 0; n < runCells.size(); ++n)
+        setRunCellState(long(n), n == 0 ? ScanGrid::CellState::Moving : ScanGrid::CellState::Pending);
+}
+
+void MainWindow::setRunCellState(long n, ScanGrid::CellState state)
+{
+    if (n >= 0 && std::size_t(n) < runCells.size())
+        ui->scanGrid->setCellState(runCells[std::size_t(n)].y(), runCells[std::size_t(n)].x(), state);
+}
+
+// The run is over: what did not get done is marked as such
+void MainWindow::endRunCells(ScanGrid::CellState unfinished)
+{
+    for (const QPoint &cell : runCells) {
+        if (ui->scanGrid->cellState(cell.y(), cell.x()) != ScanGrid::CellState::Done)
+            ui->scanGrid->setCellState(cell.y(), cell.x(), unfinished);
     }
+    runCells.clear();
 }
 
-void MainWindow::init_port()
+void MainWindow::on_rateColours_toggled(bool checked)
 {
-    //Set port configuration
-    port->setPortName("/dev/ttyACM0");
-    port->setBaudRate(QSerialPort::Baud9600);
-    port->setFlowControl(QSerialPort::NoFlowControl);
-    port->setParity(QSerialPort::NoParity);
-    port->setDataBits(QSerialPort::Data8);
-    port->setStopBits(QSerialPort::OneStop);
-
-    // Open port
-    if (!port->open(QIODevice::ReadWrite)) {
-        qDebug() << "Failed to open serial port: " << port->errorString();
-        QMessageBox::warning(this, "PORT ERROR", "Arduino port could not be opened!");
-    } else {
-        qDebug() << "Serial port opened successfully.";
-        qDebug() << "Port name:" << port->portName();
-        qDebug() << "Baud rate:" << port->baudRate();
+    ui->scanGrid->setRateColours(checked);
+}
+
+void MainWindow::openResultStore(const ScanPlan &plan, long points, bool path)
+{
+    ScanStoreHeader header = {};
+    header.flags = (path ? ScanStorePath : 0) | (blind ? 0 : ScanStoreGated);
+    storeEpochUs = QDateTime::currentMSecsSinceEpoch() * 1000 - hostMicros();
+    header.startEpochUs = hostMicros() + storeEpochUs;
+    header.spacing = plan.spacing;
+    header.timing = plan.timing;
+    header.rowMin = plan.rowMin;
+    header.rowMax = plan.rowMax;
+    header.colMin = plan.colMin;
+    header.colMax = plan.colMax;
+    header.order = path ? -1 : plan.order;
+    header.linkBaud = plan.linkBaud;
+    header.plannedPoints = std::uint32_t(points);
+    header.maskRuns = std::uint32_t(plan.mask.size());
+    header.usteps = float(Stage::usteps);
+    header.stepsPerCmX = float(Stage::stepsPerCmX);
+    header.stepsPerCmY = float(Stage::stepsPerCmY);
+    header.startRpm = float(Stage::startRpm);
+    header.limitsX = motionX;
+    header.limitsY = motionY;
+
+    QString fileName = resultDir + QDateTime::currentDateTime().toString(path ? "/path_yyyyMMdd_hhmmss.ucnscan" : "/scan_yyyyMMdd_hhmmss.ucnscan");
+    resultPath = fileName;
+    if (resultStore.open(QFile::encodeName(fileName).toStdString(), header))
+        qDebug() << "Writing results to" << fileName;
+    else
+        qDebug() << "Could not create result file" << fileName << ":" << QString::fromStdString(resultStore.error());
+}
+
+void MainWindow::saveCheckpoint(const ScanPlan &plan)
+{
+    // The plan as in the timing log, behind the result file it goes on in
+    QFile::remove(checkpointPath);
+    if (adaptive || !resultStore.isOpen())
+        return; // a pass of an adaptive scan is not resumed on its own
+    QFile file(checkpointPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Could not write scan checkpoint" << checkpointPath;
+        return;
     }
+    file.write("store " + resultPath.toUtf8() + "\n");
+    file.close();
+    ScanRun run;
+    run.plan = plan;
+    if (!ScanEstimator::appendRun(QFile::encodeName(checkpointPath).toStdString(), run))
+        qDebug() << "Could not write scan checkpoint" << checkpointPath;
+}
 
-    // Disable UI to prevent bugs
-    this->setEnabled(false);
-    ui->statusBar->showMessage("Initializing Arduino. Please wait...", 4500);
-    QTimer::singleShot(4500, this, [=]() {
-        this->setEnabled(true);
-    });
+bool MainWindow::loadCheckpoint(ScanPlan &plan, QString &storePath) const
+{
+    QFile file(checkpointPath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    const QString store = QString::fromUtf8(file.readLine()).trimmed();
+    file.close();
+    if (!store.startsWith("store "))
+        return false;
+    storePath = store.mid(6);
+    std::vector<ScanRun> runs = ScanEstimator::loadRuns(QFile::encodeName(checkpointPath).toStdString(), 1);
+    if (runs.empty())
+        return false;
+    plan = runs.back().plan;
+    return true;
 }
 
-void MainWindow::transmitVal(char cmd, float val1, float val2)
+void MainWindow::logPointWindows()
 {
-    QString valStr = QString::number(val1, 'f', 3);
-    QString valStr2 = QString::number(val2, 'f', 3);
+    if (pointWindows.empty())
+        return;
+    const qint64 epochOffsetUs = QDateTime::currentMSecsSinceEpoch() * 1000 - hostMicros();
+    if (!appendPointWindows(QFile::encodeName(pointLogPath).toStdString(), pointWindows, arduinoClock, epochOffsetUs, !blind))
+        qDebug() << "Could not write point window log" << pointLogPath;
+    else
+        qDebug() << "Point windows logged, Arduino clock drift" << arduinoClock.driftPpm() << "ppm";
+    pointWindows.clear();
+}
 
-    QString packet = QString("<%1,%2,%3>").arg(cmd).arg(valStr).arg(valStr2);
-    qDebug() << "Sending command:" << packet;
+void MainWindow::transmitVal(char cmd, float val1, float val2)
+{
+    // Encoded for the current link (ASCII or binary) on the serial thread
+    qDebug() << "Sending command:" << cmd << val1 << val2;
 
-    if (port->isOpen()) {
-        port->write(packet.toUtf8());
+    if (portOpen) {
+        emit commandRequested(cmd, val1, val2);
     } else {
         QMessageBox::warning(this, "PORT ERROR", "Arduino port is not open!");
     }
-    readArduino();
 }
 
 // Scanning Grid Setup
@@ -165,110 +608,47 @@ void MainWindow::setupScanGrid() {
         spacing = 1;
     }
 
-    // Save previous selected positions
-    QVector<QPointF> selectedPositions;
-    int oldNumRows = ui->scanGrid->rowCount();
-    int oldNumCols = ui->scanGrid->columnCount();
+    // Keep the selected cells in cm so they survive a spacing change
     double oldSpacing = lastSpacing > 0 ? lastSpacing : spacing;
-
-    for (int i = 0; i < oldNumRows; ++i) {
-        for (int j = 0; j < oldNumCols; ++j) {
-            QTableWidgetItem* item = ui->scanGrid->item(i, j);
-            if (item && item->isSelected()) {
-                double y_cm = i * oldSpacing;
-                double x_cm = j * oldSpacing;
-                selectedPositions.append(QPointF(x_cm, y_cm));
-            }
-        }
-    }
+    int oldRows = ui->scanGrid->rowCount();
+    int oldCols = ui->scanGrid->columnCount();
+    std::vector<MaskRun> oldRuns = ui->scanGrid->selectionRuns();
 
     int numCols = std::ceil(28.0 / spacing); // short side (Y)
     int numRows = std::ceil(59.0 / spacing); // long side (X)
 
-    ui->scanGrid->clear();
-    ui->scanGrid->setRowCount(numRows);
-    ui->scanGrid->setColumnCount(numCols);
-    ui->scanGrid->setSelectionMode(QAbstractItemView::ContiguousSelection);
-    ui->scanGrid->setSelectionBehavior(QAbstractItemView::SelectItems);
-    ui->scanGrid->setEditTriggers(QAbstractItemView::NoEditTriggers);
-
-    // Added Jun 24, 2025
     ui->scanGrid->setFixedSize(tableWidth, tableHeight);
-    ui->scanGrid->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
-    ui->scanGrid->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-    ui->scanGrid->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-
-    ui->scanGrid->horizontalHeader()->setSectionResizeMode(QHeaderView::Fixed);
-    ui->scanGrid->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
-    ui->scanGrid->horizontalHeader()->setVisible(false);
-    ui->scanGrid->verticalHeader()->setVisible(false);
-
-    int colWidth = tableWidth / numCols; // if this can be double then the table would fit
-    int rowHeight = tableHeight / numRows; // same as the line above
-
-    for (int col = 0; col < numCols; ++col)
-        ui->scanGrid->setColumnWidth(col, colWidth);
-
-    for (int row = 0; row < numRows; ++row)
-        ui->scanGrid->setRowHeight(row, rowHeight);
-
-    for (int i = 0; i < numRows; ++i) {
-        for (int j = 0; j < numCols; ++j) {
-            QTableWidgetItem* item = new QTableWidgetItem();
-            item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
-            ui->scanGrid->setItem(i, j, item);
-        }
-    }
-
-    if (ui->debugBox->isChecked())
-        qDebug() << "<DEBUG> Selected positions: " << selectedPositions;
+    ui->scanGrid->setGridSize(numRows, numCols);
 
     // Restore selection
-    if (selectedPositions.isEmpty()) {
+    if (oldRuns.empty()) {
         ui->scanGrid->selectAll();
     } else {
-        double xMin = selectedPositions.first().x();
-        double xMax = xMin;
-        double yMin = selectedPositions.first().y();
-        double yMax = yMin;
-
-        for (const QPointF& pos : selectedPositions) {
-            xMin = std::min(xMin, pos.x());
-            xMax = std::max(xMax, pos.x());
-            yMin = std::min(yMin, pos.y());
-            yMax = std::max(yMax, pos.y());
-        }
-
-        qDebug() << xMin << "," << xMax << "," << yMin << "," << yMax;
-
-        int rowMin = static_cast<int>(std::round(yMin / spacing));
-        int rowMax = static_cast<int>(std::round(yMax / spacing));
-        int colMin = static_cast<int>(std::round(xMin / spacing));
-        int colMax = static_cast<int>(std::round(xMax / spacing));
-
-        rowMin = std::max(0, rowMin);
-        rowMax = std::min(numRows - 1, rowMax);
-        colMin = std::max(0, colMin);
-        colMax = std::min(numCols - 1, colMax);
-
-        for (int i = rowMin; i <= rowMax; ++i) {
-            for (int j = colMin; j <= colMax; ++j) {
-                QTableWidgetItem* item = ui->scanGrid->item(i, j);
-                if (item) item->setSelected(true);
+        if (ui->debugBox->isChecked())
+            qDebug() << "<DEBUG> Selected" << oldRuns.size() << "runs of cells at" << oldSpacing << "cm";
+
+        // Each new cell takes the state of the old cell nearest to it
+        std::vector<char> old(std::size_t(oldRows) * std::size_t(oldCols), 0);
+        for (const MaskRun &run : oldRuns)
+            std::fill_n(old.begin() + std::ptrdiff_t(run.row) * oldCols + run.col, run.len, 1);
+        std::vector<MaskRun> runs;
+        for (int r = 0; r < numRows; ++r) {
+            int oldRow = static_cast<int>(std::round(r * spacing / oldSpacing));
+            if (oldRow >= oldRows)
+                break;
+            for (int c = 0; c < numCols; ++c) {
+                int oldCol = static_cast<int>(std::round(c * spacing / oldSpacing));
+                if (oldCol >= oldCols || !old[std::size_t(oldRow) * oldCols + oldCol])
+                    continue;
+                if (!runs.empty() && runs.back().row == r && runs.back().col + runs.back().len == c)
+                    ++runs.back().len;
+                else
+                    runs.push_back(MaskRun{qint16(r), qint16(c), 1});
             }
         }
+        ui->scanGrid->selectRuns(runs);
     }
 
-    connect(ui->scanGrid, &QTableWidget::itemSelectionChanged, this, [this]() {
-        for (int i = 0; i < ui->scanGrid->rowCount(); ++i) {
-            for (int j = 0; j < ui->scanGrid->columnCount(); ++j) {
-                QTableWidgetItem* item = ui->scanGrid->item(i, j);
-                if (!item) continue;
-                item->setBackground(item->isSelected() ? Qt::green : Qt::white);
-            }
-        }
-    });
-
     lastSpacing = spacing;
 }
 void MainWindow::updatePosDisplay()
@@ -290,136 +670,227 @@ void MainWindow::updatePosDisplay()
     ui->runScan->setEnabled(true);
 }
 
-double MainWindow::calcTime()
+void MainWindow::stageMovedTo(double x, double y)
 {
-    float spacing = 0.0;
-    float timing = 0.0;
-    double timeOut = 0.0;
-    double timeIn = 0.0;
-    double timeUp = 0.0;
-    double totalTime = 0.0; // total time for scan in minutes (min)
-    double minPerRot = 0.0;
-    double sec2min = 0.0;
-    double cmToStepsWid = 0.0;
-    double cmToStepsLen = 0.0;
-    double lengthUSteps = 0.0;
-    double widthUSteps = 0.0;
-
-
-    QString sampleTiming = ui->sampleTime->text();
-    timing = sampleTiming.toDouble();
-    sec2min = timing / 60.0;
-
-    QString sampleSpace = ui->sampleSpacing->text();
-    spacing = sampleSpace.toDouble();
-    cmToStepsWid = spacing * (71.0 + (5.0 / 32.0));
-    cmToStepsLen = spacing * (71.0 + (15.0 / 32.0));
-    lengthUSteps = cmToStepsLen * usteps;
-    widthUSteps = cmToStepsWid * usteps;
-
-    minPerRot = 1.0 / RPM;
-
-    timeOut = ((qFloor((MAX_STEPS_WIDTH * usteps) / widthUSteps) + 1) * sec2min)
-              + ((minPerRot * (widthUSteps / (200 * usteps))) * qFloor((MAX_STEPS_WIDTH * usteps) / widthUSteps));
+    travelSinceHome += qAbs(x - currentX) + qAbs(y - currentY);
+    currentX = x;
+    currentY = y;
+}
 
-    timeIn = (((qFloor(((MAX_STEPS_WIDTH * usteps) / widthUSteps)) * widthUSteps) / (200 * usteps)) * minPerRot);
+bool MainWindow::needsHoming() const
+{
+    const double limit = ui->rehomeBox->value() * 100.0 * Stage::stepsPerCmX * Stage::usteps;
+    return !positionKnown || (limit > 0.0 && travelSinceHome >= limit);
+}
 
-    timeUp = (((MAX_STEPS_LENGTH * usteps) / lengthUSteps) * (lengthUSteps / (200 * usteps)) * minPerRot);
+ScanPlan MainWindow::planForRegion(int rowMin, int rowMax, int colMin, int colMax)
+{
+    ScanPlan plan;
+    plan.spacing = ui->sampleSpacing->text().toDouble();
+    plan.timing = ui->sampleTime->text().toDouble();
+    plan.rowMin = rowMin;
+    plan.rowMax = rowMax;
+    plan.colMin = colMin;
+    plan.colMax = colMax;
+    // Only the selected cells of the box, unless that is all of them
+    if (ui->scanGrid->selectedCount() < std::size_t(rowMax - rowMin + 1) * std::size_t(colMax - colMin + 1))
+        plan.mask = ui->scanGrid->selectionRuns();
+    plan.startX = currentX;
+    plan.startY = currentY;
+    plan.homeFirst = needsHoming();
+    plan.order = ui->orderBox->currentData().toInt();
+    plan.linkBaud = estimator.linkBaud();
+    plan.gated = estimator.gated();
+    plan.limitsX = motionX;
+    plan.limitsY = motionY;
+    return plan;
+}
 
-    totalTime = (timeOut + timeIn) * (((MAX_STEPS_LENGTH * usteps) / lengthUSteps) + 1) + timeUp;
+// The plan's scan order walked from the corner of the box it is quickest
+// from, which is mostly the one nearest the stage
+ScanPlan MainWindow::fromBestCorner(const ScanPlan &plan) const
+{
+    std::vector<ScanPlan> corners;
+    for (int from : {0, SCAN_FROM_ROW_MAX, SCAN_FROM_COL_MAX, SCAN_FROM_ROW_MAX | SCAN_FROM_COL_MAX}) {
+        ScanPlan p = plan;
+        p.order = (plan.order & SCAN_ORDER_MASK) | from;
+        corners.push_back(p);
+    }
+    return corners[estimator.fastest(corners)];
+}
 
-    return totalTime;
+void MainWindow::updateOrderEstimates()
+{
+    int rowMin, rowMax, colMin, colMax;
+    bool haveRegion = ui->scanGrid->selectionBounds(rowMin, rowMax, colMin, colMax);
+
+    const ScanPlan region = planForRegion(rowMin, rowMax, colMin, colMax);
+    std::vector<ScanPlan> plans;
+    for (int i = 0; i < ui->orderBox->count(); ++i) {
+        ScanPlan plan = region;
+        plan.order = ui->orderBox->itemData(i).toInt();
+        plans.push_back(fromBestCorner(plan));
+    }
+    std::vector<ScanEstimate> estimates;
+    std::size_t best = estimator.fastest(plans, &estimates);
+
+    for (int i = 0; i < ui->orderBox->count(); ++i) {
+        QString text = scanOrderNames[plans[i].order & SCAN_ORDER_MASK];
+        if (haveRegion)
+            text += QString("  %1%2").arg(formatDuration(estimates[i].totalMs)).arg(std::size_t(i) == best ? " *" : "");
+        ui->orderBox->setItemText(i, text);
+    }
 }
 
 double MainWindow::calcTimeForRegion(int rowMin, int rowMax, int colMin, int colMax)
 {
-    double spacing = ui->sampleSpacing->text().toDouble();
-    double timing = ui->sampleTime->text().toDouble();
-
-    int rows = rowMax - rowMin + 1;
-    int cols = colMax - colMin + 1;
-    int totalPoints = rows * cols;
-
-    // Time spent at each point
-    double totalSampleTime = totalPoints * timing; // in seconds
-
-    // Estimate motor move time (assume 1 step per spacing)
-    double lenPerStep = spacing * (71.0 + 15.0 / 32.0);  // X motor
-    double widPerStep = spacing * (71.0 + 5.0 / 32.0);   // Y motor
-
-    double stepsX = (cols - 1) * lenPerStep * usteps;
-    double stepsY = (rows - 1) * widPerStep * usteps;
-
-    // Use RPM to get time per step (same formula as setup)
-    double minPerRot = 1.0 / RPM;
-    double timePerStep = minPerRot / (200.0);  // one full step
-
-    double moveTimeSec = (stepsX + stepsY) * timePerStep * 60.0;  // convert to seconds
+    // Minutes from the scan command to SCAN_DONE, see scan_estimator.h
+    return estimator.estimate(fromBestCorner(planForRegion(rowMin, rowMax, colMin, colMax))).totalMs / 60000.0;
+}
 
-    double totalTime = totalSampleTime + moveTimeSec;
-    return totalTime / 60.0;  // Return in minutes
+void MainWindow::refitEstimator(int linkBaud)
+{
+    // Coefficients come from the runs logged on this link, gated or timed like the next scan
+    estimator = ScanEstimator(linkBaud, ui->daqGate->isChecked());
+    std::size_t used = estimator.fit(ScanEstimator::loadRuns(QFile::encodeName(timingLogPath).toStdString(), 50));
+    if (ui->debugBox->isChecked()) {
+        const ScanTiming &t = estimator.timing();
+        qDebug() << "<DEBUG> Scan timing" << (estimator.gated() ? "(DAQ gated)" : "") << "fitted from" << used << "timestamps: start" << t.startMs
+                 << "ms, point" << t.pointMs << "ms, step" << t.stepUs << "us, dwell x" << t.dwellScale;
+    }
+    orderEstimateTimer->start();
 }
 
+void MainWindow::logScanRun()
+{
+    if (!scanActive)
+        return;
+    scanActive = false;
+    if (currentRun.indexMs.empty() || runResumed)
+        return;
+    if (!ScanEstimator::appendRun(QFile::encodeName(timingLogPath).toStdString(), currentRun))
+        qDebug() << "Could not write scan timing log" << timingLogPath;
+    refitEstimator(estimator.linkBaud());
+}
 
 void MainWindow::on_runScan_clicked()
 {
     double spacing = ui->sampleSpacing->text().toDouble();
-    double timing = ui->sampleTime->text().toDouble();
-    scanMonitorTimer->start(100);
 
     if (spacing <= 0 || spacing > 28.0) {
         QMessageBox::warning(this, "Invalid Spacing", "Sample spacing must be > 0 and < 28.0 cm"); //// commented out by derek////
         return;
     }
 
-    // Auto-return to home (0, 0) if needed
-    if (currentX != 0 || currentY != 0) {
-        transmitVal('8', 0, 0);  // Return home
-        currentX = 0;
-        currentY = 0;
-        ui->xPosEdit->setText("0.000");
-        ui->yPosEdit->setText("0.000");
-    }
-
-    int rowMin = ui->scanGrid->rowCount(), rowMax = -1;
-    int colMin = ui->scanGrid->columnCount(), colMax = -1;
-    for (int i = 0; i < ui->scanGrid->rowCount(); ++i) {
-        for (int j = 0; j < ui->scanGrid->columnCount(); ++j) {
-            QTableWidgetItem* item = ui->scanGrid->item(i, j);
-            if (item && item->isSelected()) {
-                rowMin = std::min(rowMin, i);
-                rowMax = std::max(rowMax, i);
-                colMin = std::min(colMin, j);
-                colMax = std::max(colMax, j);
-            }
-        }
-    }
-    if (rowMin > rowMax || colMin > colMax) {
+    int rowMin, rowMax, colMin, colMax;
+    if (!ui->scanGrid->selectionBounds(rowMin, rowMax, colMin, colMax)) {
         QMessageBox::warning(this, "No Region", "No scan region selected.");
         return;
     }
 
-    double runTime = calcTimeForRegion(rowMin, rowMax, colMin, colMax);
-    QDateTime now = QDateTime::currentDateTime();
-    QDateTime finishTime = now.addSecs(static_cast<int>(runTime * 60));
+    // Planned from where the stage is now, homing included if it is due
+    startScan(fromBestCorner(planForRegion(rowMin, rowMax, colMin, colMax)));
+}
+
+// fromPoint > 0 resumes the scan of the result file at resultPath at that point
+bool MainWindow::startScan(const ScanPlan &plan, long fromPoint)
+{
+    if (plan.mask.size() > MASK_MAX_RUNS) {
+        QMessageBox::warning(this, "Selection Too Complex",
+                             QString("The selection is %1 runs of cells along its rows, the Arduino holds at most %2. "
+                                     "Join some of them up, or scan it in parts.")
+                                 .arg(plan.mask.size()).arg(MASK_MAX_RUNS));
+        return false;
+    }
+    logScanRun();
+    logPointWindows();
+    currentRun = ScanRun();
+    currentRun.plan = plan;
+    currentEstimate = estimator.estimate(currentRun.plan);
+    currentPath.clear();
+    runResumed = fromPoint > 0;
+    if (!startGate(currentEstimate.points - fromPoint, plan.timing))
+        return false;
+    if (runResumed) {
+        storeEpochUs = QDateTime::currentMSecsSinceEpoch() * 1000 - hostMicros();
+        if (resultStore.resume(QFile::encodeName(resultPath).toStdString()))
+            qDebug() << "Writing results on to" << resultPath;
+        else
+            qDebug() << "Could not reopen result file" << resultPath << ":" << QString::fromStdString(resultStore.error());
+    } else {
+        openResultStore(plan, currentEstimate.points, false);
+    }
+    saveCheckpoint(plan);
+
+    // The cells in scan order, on the grid's spacing
+    runCells.clear();
+    const int nRows = plan.rowMax - plan.rowMin + 1;
+    const int nCols = plan.colMax - plan.colMin + 1;
+    const double scale = plan.spacing / lastSpacing;
+    for (long n = 0; n < long(nRows) * nCols; ++n) {
+        int row, col;
+        scanOrderPoint(quint8(plan.order), n, nRows, nCols, row, col);
+        row += plan.rowMin;
+        col += plan.colMin;
+        if (maskHasCell(plan.mask.data(), int(plan.mask.size()), row, col))
+            runCells.push_back(QPoint(qRound(col * scale), qRound(row * scale)));
+    }
+    paintGridByState();
+    double remainingMs = currentEstimate.totalMs;
+    if (runResumed) {
+        for (long n = 0; n < fromPoint; ++n)
+            setRunCellState(n, ScanGrid::CellState::Done);
+        setRunCellState(fromPoint, ScanGrid::CellState::Moving);
+        runIndexed = fromPoint - 1;
+        if (std::size_t(fromPoint) < currentEstimate.pointMs.size())
+            remainingMs -= currentEstimate.pointMs[std::size_t(fromPoint)]; // roughly, the setup is left out
+    }
+    QDateTime finishTime = QDateTime::currentDateTime().addMSecs(qint64(remainingMs));
     ui->runTimeEnd->setText(finishTime.toString("MM/dd, hh:mm, ap"));
 
-    QString packet = QString("<5,%1,%2,%3,%4,%5,%6>")
-                         .arg(spacing, 0, 'f', 3)
-                         .arg(timing, 0, 'f', 3)
-                         .arg(rowMin)
-                         .arg(rowMax)
-                         .arg(colMin)
-                         .arg(colMax);
+    // The mask goes first, while the Arduino still reads commands
+    if (!plan.mask.empty())
+        emit maskRequested(QVector<MaskRun>(plan.mask.begin(), plan.mask.end()));
+    if (runResumed)
+        emit commandRequested('K', float(fromPoint), 0.0f);
 
-    port->write(packet.toUtf8());
-    qDebug() << "Sent scan region:" << packet;
-    readArduino();
+    // Return to home (0, 0) only if it is due, see needsHoming()
+    if (plan.homeFirst) {
+        transmitVal('8', 0, 0);  // Return home
+        currentX = 0;
+        currentY = 0;
+        positionKnown = true;
+        travelSinceHome = 0.0;
+        ui->xPosEdit->setText("0.000");
+        ui->yPosEdit->setText("0.000");
+    }
+
+    ScanPacket scan;
+    scan.spacing = float(plan.spacing);
+    scan.timing = float(plan.timing);
+    scan.rowMin = qint16(plan.rowMin);
+    scan.rowMax = qint16(plan.rowMax);
+    scan.colMin = qint16(plan.colMin);
+    scan.colMax = qint16(plan.colMax);
+    scan.order = quint8(plan.order);
+
+    emit scanRequested(scan);
+    scanClock.start();
+    scanActive = true;
+    qDebug() << "Sent scan region: spacing" << plan.spacing << "timing" << plan.timing
+             << "rows" << plan.rowMin << plan.rowMax << "cols" << plan.colMin << plan.colMax
+             << "cells" << currentEstimate.points << "in" << plan.mask.size() << "mask runs"
+             << "order" << scanOrderNames[scan.order & SCAN_ORDER_MASK] << "from corner" << (scan.order >> 2)
+             << "point" << fromPoint << (plan.homeFirst ? "after homing" : "");
 
     ui->posUpdate->setEnabled(true);
     ui->returnHome->setEnabled(true);
     ui->runScan->setEnabled(false);
+    ui->runPath->setEnabled(false);
+    ui->resumeScan->setEnabled(false);
+    ui->runAdaptive->setEnabled(false);
     ui->stopScan->setEnabled(true);
+    return true;
 }
 
 void MainWindow::on_posUpdate_clicked()
@@ -445,8 +916,7 @@ void MainWindow::on_posUpdate_clicked()
         {
             transmitVal(command, xPosDesire, yPosDesire);
 
-            currentX = xPosDesire * (71.0 + (15.0 / 32.0)) * usteps;
-            currentY = yPosDesire * (71.0 + (5.0 / 32.0)) * usteps;
+            stageMovedTo(xPosDesire * (71.0 + (15.0 / 32.0)) * usteps, yPosDesire * (71.0 + (5.0 / 32.0)) * usteps);
             qDebug("%f usteps", currentX);
             qDebug("%f usteps", currentY);
         }
@@ -470,62 +940,38 @@ void MainWindow::on_returnHome_clicked()
     ui->yPosEdit->setText("0.000");
     currentX = 0.0;
     currentY = 0.0;
+    positionKnown = true;
+    travelSinceHome = 0.0;
 }
 
 void MainWindow::on_stopScan_clicked()
 {
-    scanMonitorTimer->stop();
-
     ui->posUpdate->setEnabled(true);
     ui->returnHome->setEnabled(true);
     ui->runScan->setEnabled(true);
+    ui->runPath->setEnabled(true);
+    ui->resumeScan->setEnabled(true);
+    ui->runAdaptive->setEnabled(true);
     ui->stopScan->setEnabled(false);
     ui->runTimeEnd->setText("--/--, --:--, --");
 
+    logScanRun(); // what ran so far still calibrates the estimator
+    // Cut short mid-move the motors may have lost steps: the next scan homes first
+    if (runIndexed + 1 >= 0 && std::size_t(runIndexed + 1) < runCells.size()) {
+        const QPoint next = runCells[std::size_t(runIndexed + 1)];
+        if (ui->scanGrid->cellState(next.y(), next.x()) == ScanGrid::CellState::Moving)
+            positionKnown = false;
+    }
+    endRunCells(ScanGrid::CellState::Skipped);
+    resultStore.finish(ScanStoreStopped, arduinoClock.driftPpm());
+    logPointWindows();
+    endGate();
+    if (adaptive)
+        endAdaptive(false);
+
+    // Stop status and the <X><Y> position reply arrive in handleFrame()
     command = '6';
     transmitVal(command, 0, 0); // Send stop command
-
-    QByteArray stopResponse;
-    readArduino(&stopResponse);
-
-    char status = stopResponse.isEmpty() ? '\0' : stopResponse[0];
-    if (status == '9') {
-        qDebug() << "Scan successfully stopped.";
-    } else if (status == '0') {
-        qDebug() << "Scan was never running.";
-    } else {
-        qDebug() << "Unexpected stop response: " << stopResponse;
-    }
-
-    QByteArray posResponse;
-    readArduino(&posResponse);
-
-    // Attempt to parse position (format: <X><Y>)
-    // Note: method indexOf returns -1 if character not found
-    int xStart = posResponse.indexOf('<');
-    int xEnd   = posResponse.indexOf('>', xStart);
-    int yStart = posResponse.indexOf('<', xEnd);
-    int yEnd   = posResponse.indexOf('>', yStart);
-
-    if (xStart != -1 && xEnd != -1 && yStart != -1 && yEnd != -1) {
-        // Note: method mid trims out < and >
-        QByteArray xStr = posResponse.mid(xStart + 1, xEnd - xStart - 1);
-        QByteArray yStr = posResponse.mid(yStart + 1, yEnd - yStart - 1);
-        currentX = xStr.toDouble();
-        currentY = yStr.toDouble();
-        qDebug() << "Parsed X:" << currentX << "Parsed Y:" << currentY;
-    } else {
-        qDebug() << "Failed to parse position from: " << posResponse;
-    }
-
-    updatePosDisplay();
-    qDebug() << "Stop procedure complete.";
-
-    QByteArray trailingGarbage;
-    readArduino(&trailingGarbage);
-    if (!trailingGarbage.isEmpty())
-        qDebug() << "Trailing serial data discarded:" << trailingGarbage;
-
 }
 
 void MainWindow::on_xBack_clicked()
@@ -598,56 +1044,463 @@ void MainWindow::on_yFor_clicked()
 
 void MainWindow::on_testSerial_clicked()
 {
-    if (!port->isOpen()) {
+    if (!portOpen) {
         QMessageBox::warning(this, "PORT ERROR", "Arduino port is not opened!");
         return;
     }
 
-    for (int i = 0; i < 10; ++i){
+    // Ten test packets, 150 ms apart; the echoes show up in handleFrame()
+    testSerialCount = 0;
+    testSerialTimer->start(150);
+}
 
-        // Preparing Messsage
-        QString cmd = QString("<T, %1, 0>").arg(i+1);
-        QByteArray packet = cmd.toUtf8();
+void MainWindow::onTestSerialTick()
+{
+    if (testSerialCount >= 10) {
+        testSerialTimer->stop();
+        return;
+    }
+    ++testSerialCount;
 
-        // Sending Message
-        qint64 bytesWritten = port->write(packet);
-        if (bytesWritten == -1) {
-            qDebug() << "Failed to write to port: " << port->errorString();
-            return;
-        } else if (bytesWritten != packet.size()) {
-            qDebug() << "Only partial data written to port.";
-            return;
-        } else {
-            qDebug() << bytesWritten << "bytes sent: " << packet;
+    emit commandRequested('T', float(testSerialCount), 0.0f);
+    qDebug() << "Test packet" << testSerialCount << "queued";
+}
+
+void MainWindow::on_debugBox_toggled(bool checked)
+{
+    if (portOpen) {
+        char cmd = '9';
+        float val1 = checked;
+        float val2 = 0.0;
+        transmitVal(cmd, val1, val2);
+        qDebug() << "Debug mode toggled. Sent <9," << val1 << "," << val2 << ">";
+    } else {
+        QMessageBox::warning(this, "PORT ERROR", "Arduino port is not open!");
+    }
+}
+
+void MainWindow::on_setMotion_clicked()
+{
+    if (!portOpen) {
+        QMessageBox::warning(this, "PORT ERROR", "Arduino port is not open!");
+        return;
+    }
+
+    // Moves start at RPM and ramp up to these; 0 jerk is a trapezoid
+    AxisLimits x = {float(ui->xSpeedBox->value()), float(ui->xAccelBox->value()), float(ui->xJerkBox->value())};
+    AxisLimits y = {float(ui->ySpeedBox->value()), float(ui->yAccelBox->value()), float(ui->yJerkBox->value())};
+    transmitVal('V', x.maxRpm, y.maxRpm);
+    transmitVal('A', x.accelRpm, y.accelRpm);
+    transmitVal('J', x.jerkRpm, y.jerkRpm);
+    motionX = x;
+    motionY = y;
+    orderEstimateTimer->start();
+}
+
+void MainWindow::on_runPath_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, "Open Scan Path", QString(), "Path files (*.txt *.csv);;All files (*)");
+    if (fileName.isEmpty())
+        return;
+
+    QVector<WaypointPacket> path;
+    QString error;
+    if (!loadPath(fileName, ui->sampleTime->text().toDouble(), path, error)) {
+        QMessageBox::warning(this, "Invalid Path", error);
+        return;
+    }
+    transmitScanPath(path);
+}
+
+bool MainWindow::transmitScanPath(const QVector<WaypointPacket> &path)
+{
+    // Streamed by the serial thread as the Arduino hands out credits. Reached
+    // waypoints come back as SCAN_INDEX, the end as SCAN_DONE and the position.
+    if (!portOpen) {
+        QMessageBox::warning(this, "PORT ERROR", "Arduino port is not open!");
+        return false;
+    }
+    if (path.isEmpty())
+        return false;
+    // Two waypoints in flight must fit the Arduino's RX buffer on the ASCII link too
+    for (int k = 0; k < path.size(); ++k) {
+        const QByteArray line = SerialWorker::waypointLine(path[k]);
+        if (line.size() > PATH_RX_LINE_MAX) {
+            QMessageBox::warning(this, "Invalid Path",
+                                 QString("Waypoint %1 would be sent as %2, %3 bytes; the Arduino takes "
+                                         "<W,...> lines of up to %4 bytes")
+                                         .arg(k + 1)
+                                         .arg(QString::fromUtf8(line))
+                                         .arg(line.size())
+                                         .arg(PATH_RX_LINE_MAX));
+            return false;
         }
+    }
+
+    logScanRun();
+    logPointWindows();
+    currentPath = path;
+    if (!startGate(path.size(), ui->sampleTime->text().toDouble()))
+        return false;
+
+    // The cells the waypoints are on, if any, make the result file's index
+    ScanPlan plan;
+    plan.spacing = adaptive ? adaptiveSpacing : 0.0;
+    plan.timing = ui->sampleTime->text().toDouble();
+    plan.linkBaud = estimator.linkBaud();
+    plan.rowMin = plan.colMin = 0;
+    plan.rowMax = plan.colMax = -1;
+    for (const WaypointPacket &w : path) {
+        if (w.row < 0 || w.col < 0)
+            continue;
+        bool first = plan.rowMax < plan.rowMin;
+        plan.rowMin = first ? w.row : std::min(plan.rowMin, int(w.row));
+        plan.rowMax = first ? w.row : std::max(plan.rowMax, int(w.row));
+        plan.colMin = first ? w.col : std::min(plan.colMin, int(w.col));
+        plan.colMax = first ? w.col : std::max(plan.colMax, int(w.col));
+    }
+    openResultStore(plan, path.size(), true);
 
-        if (!port->waitForBytesWritten(1000)) {
-            qDebug() << "Write timed out:" << port->errorString();
+    runCells.clear();
+    for (const WaypointPacket &w : path)
+        runCells.push_back(QPoint(qRound(w.x / lastSpacing), qRound(w.y / lastSpacing)));
+    paintGridByState();
+    emit pathRequested(path);
+    qDebug() << "Sent path of" << path.size() << "waypoints";
+
+    ui->runTimeEnd->setText("--/--, --:--, --");
+    ui->posUpdate->setEnabled(false);
+    ui->returnHome->setEnabled(false);
+    ui->runScan->setEnabled(false);
+    ui->runPath->setEnabled(false);
+    ui->resumeScan->setEnabled(false);
+    ui->runAdaptive->setEnabled(false);
+    ui->stopScan->setEnabled(true);
+    return true;
+}
+
+void MainWindow::on_resumeScan_clicked()
+{
+    ScanPlan plan;
+    QString storePath;
+    if (!loadCheckpoint(plan, storePath)) {
+        QMessageBox::information(this, "Nothing to Resume", "The last scan completed, or there was none to keep.");
+        return;
+    }
+    ScanStoreReader done;
+    if (!done.open(QFile::encodeName(storePath).toStdString())) {
+        QMessageBox::warning(this, "Cannot Resume", QString("The scan's result file %1 cannot be read: %2")
+                                                        .arg(storePath, QString::fromStdString(done.error())));
+        return;
+    }
+    // On from the point after the last one measured to the end of its dwell;
+    // the one a stop or crash cut into is measured again
+    long from = 0;
+    for (std::size_t n = 0; n < done.size(); ++n) {
+        if (done[n].status & ScanRecordTimed)
+            from = long(n) + 1;
+    }
+    const long planned = long(done.header().plannedPoints);
+    done.close();
+    if (from >= planned) {
+        QFile::remove(checkpointPath);
+        QMessageBox::information(this, "Nothing to Resume", QString("All %1 points of that scan were measured.").arg(planned));
+        return;
+    }
+    // The link, motion limits and stage are what they are now
+    plan.startX = currentX;
+    plan.startY = currentY;
+    plan.homeFirst = needsHoming();
+    QString question = QString("Go on with %1 at point %2 of %3, %4?")
+                           .arg(QFileInfo(storePath).fileName()).arg(from + 1).arg(planned)
+                           .arg(plan.homeFirst ? "homing the stage first" : "from where the stage is now");
+    if (from == 0)
+        question = QString("No point of %1 was measured. Start it over?").arg(QFileInfo(storePath).fileName());
+    if (QMessageBox::question(this, "Resume Scan", question) != QMessageBox::Yes)
+        return;
+    plan.linkBaud = estimator.linkBaud();
+    plan.gated = estimator.gated();
+    plan.limitsX = motionX;
+    plan.limitsY = motionY;
+    resultPath = storePath;
+    startScan(plan, from);
+}
+
+void MainWindow::on_runAdaptive_clicked()
+{
+    double spacing = ui->sampleSpacing->text().toDouble();
+    if (spacing <= 0 || spacing > 28.0) {
+        QMessageBox::warning(this, "Invalid Spacing", "Sample spacing must be > 0 and < 28.0 cm");
+        return;
+    }
+    std::vector<MaskRun> selection = ui->scanGrid->selectionRuns();
+    if (selection.empty()) {
+        QMessageBox::warning(this, "No Region", "No scan region selected.");
+        return;
+    }
+    if (!portOpen) {
+        QMessageBox::warning(this, "PORT ERROR", "Arduino port is not open!");
+        return;
+    }
+
+    // Gated scans have the rates from the DAQ's windows, else from a file, see rate_source.h
+    QString fileName;
+    if (!ui->daqGate->isChecked()) {
+        fileName = QFileDialog::getOpenFileName(this, "Detector Rate File", QString(), "Rate files (*.txt *.csv);;All files (*)");
+        if (fileName.isEmpty())
             return;
-        }
+    }
 
-        QByteArray response;
-        readArduino(&response);
+    AdaptiveSettings settings;
+    settings.levels = ui->adaptiveLevels->value();
+    settings.rateThreshold = ui->rateThreshold->value();
+    settings.gradientThreshold = ui->gradientThreshold->value();
+    adaptive.reset(new AdaptiveScan(ui->scanGrid->rowCount(), ui->scanGrid->columnCount(), selection, spacing, settings));
+    if (fileName.isEmpty())
+        rateSource.reset(new DaqRateSource(socket_control));
+    else
+        rateSource.reset(new FileRateSource(fileName));
+    adaptiveSpacing = spacing;
+    adaptiveTiming = ui->sampleTime->text().toDouble();
+    adaptivePass = 0;
+    qDebug() << "Adaptive scan of" << adaptive->selectedCount() << "cells, rates from" << rateSource->describe();
+    startAdaptivePass();
+}
 
-        if (response.isEmpty()) {
-            qDebug() << "Read timed out or no response received for iteration" << i;
+void MainWindow::startAdaptivePass()
+{
+    const std::vector<GridPoint> &pass = adaptive->pass();
+    const int step = adaptive->step();
+    if (pass.empty()) {
+        endAdaptive(true);
+        return;
+    }
+    adaptivePointsCm.clear();
+    for (const GridPoint &p : pass)
+        adaptivePointsCm.push_back(QPointF(p.col * adaptiveSpacing, p.row * adaptiveSpacing));
+    rateSource->beginPass();
+    qDebug() << "Adaptive pass" << adaptivePass + 1 << ":" << pass.size() << "points, every" << step << "cells";
+    ui->statusBar->showMessage(QString("Adaptive pass %1: %2 points").arg(adaptivePass + 1).arg(pass.size()));
+
+    // The coarse pass is a region scan at the coarse spacing over the same
+    // cells; it reports coarse indices in SCAN_INDEX
+    if (adaptivePass == 0) {
+        ScanPlan plan = planForRegion(0, 0, 0, 0);
+        plan.spacing = adaptiveSpacing * step;
+        plan.timing = adaptiveTiming;
+        plan.mask.clear();
+        std::vector<GridPoint> cells(pass);
+        std::sort(cells.begin(), cells.end(), [](const GridPoint &a, const GridPoint &b) {
+            return a.row != b.row ? a.row < b.row : a.col < b.col;
+        });
+        plan.rowMin = cells.front().row / step;
+        plan.rowMax = cells.back().row / step;
+        plan.colMin = plan.colMax = cells.front().col / step;
+        for (const GridPoint &p : cells) {
+            plan.colMin = std::min(plan.colMin, p.col / step);
+            plan.colMax = std::max(plan.colMax, p.col / step);
+            MaskRun *last = plan.mask.empty() ? nullptr : &plan.mask.back();
+            if (last && last->row == p.row / step && last->col + last->len == p.col / step)
+                ++last->len;
+            else
+                plan.mask.push_back(MaskRun{qint16(p.row / step), qint16(p.col / step), 1});
         }
+        if (cells.size() == std::size_t(plan.rowMax - plan.rowMin + 1) * std::size_t(plan.colMax - plan.colMin + 1))
+            plan.mask.clear();
+        // A ragged coarse mask the Arduino cannot hold runs as a path instead
+        if (plan.mask.size() <= MASK_MAX_RUNS) {
+            if (!startScan(fromBestCorner(plan)))
+                endAdaptive(false);
+            return;
+        }
+    }
 
-        QThread::msleep(150);
+    // Finer passes are paths through the new points, rows and columns in SCAN_INDEX as on the grid
+    QVector<WaypointPacket> path;
+    for (std::size_t k = 0; k < pass.size(); ++k) {
+        WaypointPacket w;
+        w.x = float(adaptivePointsCm[k].x());
+        w.y = float(adaptivePointsCm[k].y());
+        w.dwell = float(adaptiveTiming);
+        w.row = qint16(pass[k].row);
+        w.col = qint16(pass[k].col);
+        path.append(w);
     }
+    if (!transmitScanPath(path))
+        endAdaptive(false);
 }
 
-void MainWindow::on_debugBox_toggled(bool checked)
+void MainWindow::onRateTimer()
 {
-    if (port->isOpen()) {
-        char cmd = '9';
-        float val1 = checked;
-        float val2 = 0.0;
-        transmitVal(cmd, val1, val2);
-        qDebug() << "Debug mode toggled. Sent <9," << val1 << "," << val2 << ">";
-        readArduino();
+    std::vector<double> rates;
+    bool complete = rateSource->fetch(adaptivePointsCm, adaptiveSpacing / 4.0, rates);
+    if (!complete && rateWait.elapsed() < rateTimeoutMs)
+        return;
+    rateTimer->stop();
+    if (!complete) {
+        int missing = int(std::count_if(rates.begin(), rates.end(), [](double r) { return std::isnan(r); }));
+        qDebug() << "No rate for" << missing << "points of adaptive pass" << adaptivePass + 1 << "- refining around them";
+    }
+
+    if (adaptive->next(rates)) {
+        ++adaptivePass;
+        startAdaptivePass();
     } else {
-        QMessageBox::warning(this, "PORT ERROR", "Arduino port is not open!");
+        endAdaptive(true);
+    }
+}
+
+void MainWindow::endAdaptive(bool finished)
+{
+    rateTimer->stop();
+    QString summary = QString("Adaptive scan %1: %2 of %3 cells in %4 passes")
+                          .arg(finished ? "done" : "stopped")
+                          .arg(adaptive->measuredCount())
+                          .arg(adaptive->selectedCount())
+                          .arg(adaptivePass + 1);
+    qDebug() << summary;
+    ui->statusBar->showMessage(summary);
+    adaptive.reset();
+    rateSource.reset();
+
+    ui->posUpdate->setEnabled(true);
+    ui->returnHome->setEnabled(true);
+    ui->runScan->setEnabled(true);
+    ui->runPath->setEnabled(true);
+    ui->resumeScan->setEnabled(true);
+    ui->runAdaptive->setEnabled(true);
+    ui->stopScan->setEnabled(false);
+}
+
+bool MainWindow::CheckDaqConnections()
+{
+    return socket_control->isConnected();
+}
+
+void MainWindow::GetCurrentRunNumber()
+{
+    // The reply sets runnumber
+    socket_control->requestRunNumber();
+}
+
+bool MainWindow::SendCheck(DaqClient *sckt)
+{
+    return sckt->check();
+}
+
+bool MainWindow::SendStart(DaqClient *sckt)
+{
+    return sckt->start(gatePoints, gateTiming);
+}
+
+bool MainWindow::SendStop(DaqClient *sckt)
+{
+    return sckt->stop();
+}
+
+void MainWindow::on_connectDaq_clicked()
+{
+    if (CheckDaqConnections()) {
+        socket_control->disconnectFrom();
+        onDaqConnection(false, QString());
+        return;
     }
+    ui->connectDaq->setEnabled(false);
+    ui->statusBar->showMessage(QString("Connecting to the DAQ at %1...").arg(ui->daqAddress->text()));
+    socket_control->connectTo(ui->daqAddress->text());
+}
+
+void MainWindow::on_daqGate_toggled(bool)
+{
+    // Gated and timed scans are fitted apart
+    refitEstimator(estimator.linkBaud());
 }
 
+void MainWindow::onDaqConnection(bool connected, const QString &error)
+{
+    ui->connectDaq->setEnabled(true);
+    ui->connectDaq->setText(connected ? "Disconnect DAQ" : "Connect DAQ");
+    ui->daqAddress->setEnabled(!connected);
+    ui->daqGate->setEnabled(connected);
+    if (connected) {
+        ui->statusBar->showMessage(QString("DAQ connected at %1").arg(socket_control->address()), 5000);
+        SendCheck(socket_control);
+        GetCurrentRunNumber();
+        return;
+    }
+
+    ui->daqGate->setChecked(false);
+    if (!error.isEmpty())
+        qDebug() << "DAQ connection:" << error;
+    if (!blind) {
+        // The sketch would wait for the DAQ forever
+        QMessageBox::warning(this, "DAQ ERROR", QString("Lost the DAQ during a gated scan, it is stopped.\n%1").arg(error));
+        on_stopScan_clicked();
+    } else {
+        ui->statusBar->showMessage(error.isEmpty() ? QString("DAQ disconnected") : QString("DAQ: %1").arg(error), 5000);
+    }
+}
+
+// A gated scan or path has the sketch wait for the DAQ (<G,1,0>) and starts
+// a DAQ run for it; the sketch is let go on STARTED. False if gating is on
+// without a DAQ to gate on.
+bool MainWindow::startGate(long points, double timing)
+{
+    bool gated = ui->daqGate->isChecked();
+    if (gated && !CheckDaqConnections()) {
+        QMessageBox::warning(this, "DAQ ERROR", "Gate on DAQ is set but the DAQ is not connected!");
+        return false;
+    }
+    emit commandRequested('G', gated ? 1.0f : 0.0f, 0.0f);
+    blind = !gated;
+    sis_is_running = false;
+    if (gated) {
+        gatePoints = points;
+        gateTiming = timing;
+        SendStart(socket_control);
+    }
+    return true;
+}
+
+void MainWindow::endGate()
+{
+    if (!blind && CheckDaqConnections())
+        SendStop(socket_control);
+    blind = true;
+    sis_is_running = false;
+}
+
+void MainWindow::onDaqStarted(long run)
+{
+    runnumber = int(run);
+    if (blind)
+        return; // stopped in the meantime
+    sis_is_running = true;
+    qDebug() << "DAQ run" << run << "started";
+    ui->statusBar->showMessage(QString("DAQ run %1").arg(run));
+    emit commandRequested('N', 0.0f, 0.0f);
+}
+
+void MainWindow::onDaqWindowClosed(const DaqWindow &window)
+{
+    if (window.liveS > 0.0 && window.n >= 0 && std::size_t(window.n) < runCells.size()) {
+        const QPoint cell = runCells[std::size_t(window.n)];
+        ui->scanGrid->setCellRate(cell.y(), cell.x(), window.counts / window.liveS);
+    }
+    if (ui->debugBox->isChecked())
+        qDebug() << "<DEBUG> DAQ window" << window.n << ":" << window.counts << "counts in" << window.liveS << "s";
+    if (!blind)
+        emit commandRequested('N', 0.0f, 0.0f); // on to the next point
+}
+
+void MainWindow::onDaqError(const QString &error)
+{
+    qDebug() << "DAQ error:" << error;
+    if (blind) {
+        ui->statusBar->showMessage(QString("DAQ: %1").arg(error), 5000);
+        return;
+    }
+    // Whatever failed, the handshake is off and the sketch would wait for it forever
+    QMessageBox::warning(this, "DAQ ERROR", QString("The DAQ refused the gated scan, it is stopped.\n%1").arg(error));
+    on_stopScan_clicked();
+}
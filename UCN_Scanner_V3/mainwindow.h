@@ -3,10 +3,23 @@
 
 #include <QMainWindow>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QString>
+#include <QThread>
 #include <QTimer>
+#include <QVector>
+#include <memory>
+
+#include "adaptive_scan.h"
+#include "daq_client.h"
+#include "point_timing.h"
+#include "rate_source.h"
+#include "scan_grid.h"
+#include "scan_estimator.h"
+#include "scan_store.h"
+#include "serial_worker.h"
 
 
 QT_BEGIN_NAMESPACE
@@ -40,24 +53,26 @@ public:
 
     FILE *fSIS;
     //std::fstream fVMEpars;
-    bool blind;
+    bool blind; // the running scan or path dwells on timers, not on the DAQ
 
     QDateTime start_time,stop_time;
 
-    bool SendStart(void *sckt);
-    bool SendStop(void *sckt);
-    bool SendCheck(void *sckt);
+    bool SendStart(DaqClient *sckt);
+    bool SendStop(DaqClient *sckt);
+    bool SendCheck(DaqClient *sckt);
     bool CheckDaqConnections();
     void GetCurrentRunNumber();
     void init_port();
+    void endInit();
     void transmitVal(char cmd, float val1, float val2);
-    void transmitScanPath();
+    bool transmitScanPath(const QVector<WaypointPacket> &path);
     void setupScanGrid();
     double calcTimeForRegion(int rowMin, int rowMax, int colMin, int colMax);
+    ScanPlan planForRegion(int rowMin, int rowMax, int colMin, int colMax);
+    ScanPlan fromBestCorner(const ScanPlan &plan) const;
+    bool startScan(const ScanPlan &plan, long fromPoint = 0);
+    void updateOrderEstimates();
     void updatePosDisplay();
-    void checkArduinoScanComplete();
-    double calcTime();
-    void readArduino(QByteArray* out);
     void paintGridByState();
 
     // Realtime update spacing
@@ -65,20 +80,128 @@ public:
     const int tableWidth = 460;
     const int tableHeight = 520;
 
-    // Check scanning ends
-    QTimer* scanMonitorTimer;
-    QByteArray incomingBuffer;
-
 private:
     Ui::MainWindow *ui;
-    void *context;
-    void *socket_sis3316;
-    void *socket_control;
-    void *socket_parser;
 
-    QSerialPort *port;
+    // DAQ run control, see daq_client.h. A gated scan or path has its
+    // points' windows opened and closed by it, the sketch waits for each.
+    DaqClient *socket_control;
+    QVector<WaypointPacket> currentPath; // the path running, for where its windows are
+    double gateTiming = 0.0;             // window length of the gated scan, s
+    long gatePoints = 0;
+
+    bool startGate(long points, double timing);
+    void endGate();
+    void onDaqConnection(bool connected, const QString &error);
+    void onDaqStarted(long run);
+    void onDaqWindowClosed(const DaqWindow &window);
+    void onDaqError(const QString &error);
+
+    // Serial I/O runs on serialThread, see serial_worker.h
+    QThread serialThread;
+    SerialWorker *serial;
+    bool portOpen = false;
+    int testSerialCount = 0;
+    QTimer *testSerialTimer;
+    QTimer *initTimer; // UI locked from opening the port to the Arduino's READY
+
+    void handleFrame(const SerialFrame &frame);
+    QPointF pointPositionCm(const SerialFrame &frame) const;
+
+    // When each point of the running scan or path was really measured, from
+    // the sketch's POINT_TIME on the host clock (point_timing.h); logged at its end
+    ClockFit arduinoClock; // restarts with the Arduino, i.e. when the port opens
+    std::vector<PointWindow> pointWindows;
+    QString pointLogPath;
+    bool binaryLink = false;
+
+    void logPointWindows();
+
+    // Every point of the running scan or path, as it comes, in a result file
+    // of runs/ in the application data folder (scan_store.h)
+    ScanStoreWriter resultStore;
+    QString resultDir;
+    QString resultPath; // of resultStore
+    qint64 storeEpochUs = 0; // hostMicros() to epoch us, fixed per run
+
+    void openResultStore(const ScanPlan &plan, long points, bool path);
+
+    // The running scan's plan and result file, kept until it completes so
+    // that one stopped or cut short can be resumed from its last measured point
+    QString checkpointPath;
+    bool runResumed = false; // not from its start, so no timing run for the estimator
+
+    void saveCheckpoint(const ScanPlan &plan);
+    bool loadCheckpoint(ScanPlan &plan, QString &storePath) const;
+
+    // Grid cell (x = col, y = row) of each point of the running scan or
+    // path, in order; paintGridByState() shows them, SCAN_INDEX and
+    // POINT_TIME move them along
+    std::vector<QPoint> runCells;
+    long runIndexed = -1; // last SCAN_INDEX n
+
+    void setRunCellState(long n, ScanGrid::CellState state);
+    void endRunCells(ScanGrid::CellState unfinished);
+
+    // Scan time estimate, fitted from the SCAN_INDEX times of earlier runs
+    ScanEstimator estimator;
+    QString timingLogPath;
+    ScanRun currentRun;
+    ScanEstimate currentEstimate;
+    QElapsedTimer scanClock;
+    bool scanActive = false;
+    QTimer *orderEstimateTimer;
+
+    // Scans set off from where the stage is. It is homed first only when its
+    // position is in doubt, or after rehomeBox metres of travel since it was
+    // last homed, against steps lost on the way.
+    bool positionKnown = true; // the Arduino homes when it resets
+    double travelSinceHome = 0.0; // usteps, both axes
+
+    void stageMovedTo(double x, double y);
+    bool needsHoming() const;
+
+    // Motion limits the Arduino has used since its last reset (motion_profile.h)
+    AxisLimits motionX = ScanPlan().limitsX;
+    AxisLimits motionY = ScanPlan().limitsY;
+
+    void refitEstimator(int linkBaud);
+    void logScanRun();
+
+    // Adaptive scan in progress, see adaptive_scan.h; null otherwise
+    std::unique_ptr<AdaptiveScan> adaptive;
+    std::unique_ptr<RateSource> rateSource;
+    std::vector<QPointF> adaptivePointsCm; // the pass waiting for its rates
+    double adaptiveSpacing = 0.0;
+    double adaptiveTiming = 0.0;
+    int adaptivePass = 0;
+    QTimer *rateTimer;
+    QElapsedTimer rateWait;
+
+    void startAdaptivePass();
+    void onRateTimer();
+    void endAdaptive(bool finished);
+
+signals:
+    void portDiscoveryRequested(const QStringList &names);
+    void linkRequested(qint32 baudRate);
+    void commandRequested(char cmd, float val1, float val2);
+    void scanRequested(const ScanPacket &scan);
+    void maskRequested(const QVector<MaskRun> &mask);
+    void pathRequested(const QVector<WaypointPacket> &path);
 
 private slots:
+    void onSerialFramesReady();
+
+    void onPortOpened(bool ok, const QString &error);
+
+    void onLinkChanged(bool binary, qint32 baudRate);
+
+    void on_linkBox_activated(int index);
+
+    void onTestSerialTick();
+
+
     void on_posUpdate_clicked();
 
     void on_returnHome_clicked();
@@ -99,6 +222,19 @@ private slots:
 
     void on_debugBox_toggled(bool checked);
 
+    void on_setMotion_clicked();
+
+    void on_runPath_clicked();
+
+    void on_resumeScan_clicked();
+
+    void on_runAdaptive_clicked();
+
+    void on_connectDaq_clicked();
+
+    void on_daqGate_toggled(bool);
+    void on_rateColours_toggled(bool checked);
+
 };
 #endif // MAINWINDOW_H
 
@@ -0,0 +1,137 @@
+#include "point_timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+// z of the cross product (b - a) x (c - a); <= 0 means b is not below the line a-c
+double cross(double ax, double ay, double bx, double by, double cx, double cy)
+{
+    return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+} // namespace
+
+void ClockFit::reset()
+{
+    samples.clear();
+    offset = 0.0;
+    slope = 0.0;
+}
+
+void ClockFit::add(std::uint32_t deviceUs, std::int64_t hostUs)
+{
+    if (!samples.empty()) {
+        // Unwrapped against where the device should be by now, so gaps
+        // longer than a wrap come out right as well
+        const std::int64_t hostStep = hostUs - lastHost;
+        const std::int32_t miss = std::int32_t(deviceUs - std::uint32_t(lastRaw + std::uint32_t(hostStep)));
+        if (hostStep < 0 || std::fabs(double(miss)) > MaxDrift * double(hostStep) + 1.0e6) {
+            reset(); // not the same run of micros(): the board was reset
+        } else {
+            lastDevice += hostStep + miss;
+        }
+    }
+    if (samples.empty()) {
+        originDevice = lastDevice = deviceUs;
+        originHost = hostUs;
+    }
+    lastRaw = deviceUs;
+    lastHost = hostUs;
+
+    const double x = double(lastDevice - originDevice);
+    samples.push_back(Sample{x, double(hostUs - originHost) - x});
+    if (samples.size() > MaxSamples)
+        samples.pop_front();
+    refit();
+}
+
+void ClockFit::refit()
+{
+    // Lower hull, Andrew's monotone chain; device times only ever go up
+    std::vector<Sample> hull;
+    for (const Sample &s : samples) {
+        if (!hull.empty() && s.x <= hull.back().x) {
+            if (s.y < hull.back().y)
+                hull.back() = s;
+            continue;
+        }
+        while (hull.size() >= 2 && cross(hull[hull.size() - 2].x, hull[hull.size() - 2].y,
+                                         hull.back().x, hull.back().y, s.x, s.y) <= 0.0)
+            hull.pop_back();
+        hull.push_back(s);
+    }
+
+    slope = 0.0;
+    if (hull.size() >= 2 && samples.back().x - samples.front().x >= MinDriftSpanUs) {
+        double mean = 0.0;
+        for (const Sample &s : samples)
+            mean += s.x;
+        mean /= double(samples.size());
+        std::size_t k = 1;
+        while (k + 1 < hull.size() && hull[k].x < mean)
+            ++k;
+        slope = (hull[k].y - hull[k - 1].y) / (hull[k].x - hull[k - 1].x);
+        slope = std::max(-MaxDrift, std::min(MaxDrift, slope));
+    }
+
+    // The line with that slope through the lowest sample
+    offset = samples.front().y - slope * samples.front().x;
+    for (const Sample &s : samples)
+        offset = std::min(offset, s.y - slope * s.x);
+}
+
+double ClockFit::medianDelayUs() const
+{
+    if (samples.empty())
+        return 0.0;
+    std::vector<double> delays;
+    delays.reserve(samples.size());
+    for (const Sample &s : samples)
+        delays.push_back(s.y - offset - slope * s.x);
+    std::nth_element(delays.begin(), delays.begin() + delays.size() / 2, delays.end());
+    return delays[delays.size() / 2];
+}
+
+std::int64_t ClockFit::unwrap(std::uint32_t deviceUs) const
+{
+    return lastDevice + std::int32_t(deviceUs - lastRaw);
+}
+
+double ClockFit::toHost(std::int64_t deviceUs) const
+{
+    const double x = double(deviceUs - originDevice);
+    return double(originHost) + x + offset + slope * x;
+}
+
+bool appendPointWindows(const std::string &path, const std::vector<PointWindow> &points, const ClockFit &clock,
+                        std::int64_t epochOffsetUs, bool gated)
+{
+    std::size_t timed = 0;
+    for (const PointWindow &p : points)
+        timed += p.timed ? 1 : 0;
+    if (timed == 0 || !clock.valid())
+        return true;
+
+    std::ofstream out(path, std::ios::app);
+    if (!out)
+        return false;
+    char line[256];
+    std::snprintf(line, sizeof(line), "run %zu %.1f %zu %.0f %d\n", timed, clock.driftPpm(), clock.sampleCount(),
+                  clock.medianDelayUs(), gated ? 1 : 0);
+    out << line;
+    for (const PointWindow &p : points) {
+        if (!p.timed)
+            continue;
+        double t[4];
+        for (int k = 0; k < 4; ++k)
+            t[k] = (clock.toHost(p.deviceUs[k]) + double(epochOffsetUs)) / 1.0e6;
+        std::snprintf(line, sizeof(line), "point %ld %d %d %.3f %.3f %.6f %.6f %.6f %.6f %.6f\n", p.n, p.row, p.col,
+                      p.xCm, p.yCm, t[0], t[1], t[2], t[3], t[3] - t[2]);
+        out << line;
+    }
+    return bool(out);
+}
@@ -0,0 +1,89 @@
+#ifndef POINT_TIMING_H
+#define POINT_TIMING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// When each scan point was really measured, from the sketch's POINT_TIME
+// messages (scanner_protocol.h) put on the host clock.
+
+// Maps the Arduino's micros() onto the host clock (hostMicros(), in us).
+// Each sample pairs a device stamp with the host time the message carrying
+// it started on the line. That is later than the stamp by a delay that is
+// never negative and mostly short (bytes queued ahead, USB polling, the
+// serial thread waking up), so the mapping is the line under all samples:
+// the lower convex hull of (device, host - device), with offset and drift
+// from its edge over the middle of the samples, like NTP's one-way filters.
+// Drift needs a long baseline; over less than MinDriftSpanUs it is taken as 0.
+class ClockFit
+{
+public:
+    static constexpr std::size_t MaxSamples = 2048; // the oldest go first
+    static constexpr double MinDriftSpanUs = 30.0e6;
+    static constexpr double MaxDrift = 0.01; // a resonator is off by ~1000 ppm
+
+    void reset();
+
+    // A micros() stamp and the host time it was sent. A board that was reset
+    // in the meantime starts the fit over.
+    void add(std::uint32_t deviceUs, std::int64_t hostUs);
+
+    bool valid() const { return !samples.empty(); }
+    std::size_t sampleCount() const { return samples.size(); }
+    double driftPpm() const { return slope * 1.0e6; }
+
+    // Median of the samples' delays above the fit: how late a message
+    // typically was, and so about how far off a mapped time may be
+    double medianDelayUs() const;
+
+    // Unwraps a micros() stamp from within 35 minutes of the latest sample
+    std::int64_t unwrap(std::uint32_t deviceUs) const;
+
+    // Host time of an unwrapped device stamp
+    double toHost(std::int64_t deviceUs) const;
+
+private:
+    struct Sample
+    {
+        double x; // device us since the first sample
+        double y; // host - device, us, from the first sample's
+    };
+
+    void refit();
+
+    std::deque<Sample> samples;
+    std::int64_t originDevice = 0;
+    std::int64_t originHost = 0;
+    std::uint32_t lastRaw = 0;
+    std::int64_t lastDevice = 0; // lastRaw unwrapped
+    std::int64_t lastHost = 0;
+    double offset = 0.0; // y of the fit at x = 0
+    double slope = 0.0;  // of y over x, i.e. host runs 1 + slope times device
+};
+
+// One scan point or waypoint: where it was from SCAN_INDEX, when from POINT_TIME
+struct PointWindow
+{
+    long n = -1; // SCAN_INDEX n
+    int row = -1;
+    int col = -1;
+    double xCm = 0.0;
+    double yCm = 0.0;
+    bool timed = false; // its POINT_TIME came
+    std::int64_t deviceUs[4] = {}; // move start, move end, trigger, dwell end; unwrapped micros()
+};
+
+// Appends a run's points to the log, host times as epoch seconds
+// (hostMicros() + epochOffsetUs):
+//   run <points> <drift ppm> <clock samples> <median delay us> <gated 0|1>
+//   point <n> <row> <col> <x cm> <y cm> <move start> <move end> <trigger> <dwell end> <live s>
+// live s is trigger to dwell end on the host clock, what the point was
+// exposed for. Points whose POINT_TIME never came (stopped in the dwell)
+// are left out.
+bool appendPointWindows(const std::string &path, const std::vector<PointWindow> &points, const ClockFit &clock,
+                        std::int64_t epochOffsetUs, bool gated);
+
+#endif // POINT_TIMING_H
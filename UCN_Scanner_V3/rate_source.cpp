@@ -0,0 +1,141 @@
+#include "rate_source.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QMultiHash>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Matches measured positions to the points within toleranceCm. Points are
+// bucketed by toleranceCm, so a position only looks at the buckets around it.
+class PointMatcher
+{
+public:
+    PointMatcher(const std::vector<QPointF> &pts, double tol, std::vector<double> &out)
+        : points(pts),
+          toleranceCm(tol),
+          bucketCm(std::max(tol, 1e-6)),
+          rates(out)
+    {
+        rates.assign(points.size(), std::numeric_limits<double>::quiet_NaN());
+        for (std::size_t k = 0; k < points.size(); ++k)
+            byBucket.insert(bucket(points[k].x(), points[k].y()), k);
+    }
+
+    // A later rate for the same point wins
+    void add(double x, double y, double rate)
+    {
+        for (int dx = -1; dx <= 1; ++dx) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                const auto range = byBucket.equal_range(bucket(x + dx * bucketCm, y + dy * bucketCm));
+                for (auto it = range.first; it != range.second; ++it) {
+                    const QPointF &p = points[it.value()];
+                    if (std::abs(p.x() - x) > toleranceCm || std::abs(p.y() - y) > toleranceCm)
+                        continue;
+                    if (std::isnan(rates[it.value()]))
+                        ++found;
+                    rates[it.value()] = rate;
+                }
+            }
+        }
+    }
+
+    bool complete() const { return found == points.size(); }
+
+private:
+    quint64 bucket(double x, double y) const
+    {
+        return (quint64(quint32(qint32(std::floor(x / bucketCm)))) << 32) | quint32(qint32(std::floor(y / bucketCm)));
+    }
+
+    const std::vector<QPointF> &points;
+    double toleranceCm;
+    double bucketCm;
+    std::vector<double> &rates;
+    QMultiHash<quint64, std::size_t> byBucket;
+    std::size_t found = 0;
+};
+
+}
+
+FileRateSource::FileRateSource(const QString &name)
+    : fileName(name)
+{
+}
+
+void FileRateSource::beginPass()
+{
+    passStart = QFileInfo(fileName).size();
+}
+
+bool FileRateSource::fetch(const std::vector<QPointF> &points, double toleranceCm, std::vector<double> &rates)
+{
+    PointMatcher matcher(points, toleranceCm, rates);
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    if (file.size() < passStart) // truncated or replaced, read it all
+        passStart = 0;
+    file.seek(passStart);
+
+    // A line still being written is left for the next fetch
+    QByteArray data = file.readAll();
+    data.truncate(data.lastIndexOf('\n') + 1);
+    QTextStream in(data);
+    const QRegularExpression separators("[\\s,]+");
+    while (!in.atEnd()) {
+        QString line = in.readLine();
+        line.truncate(line.indexOf('#') < 0 ? line.size() : line.indexOf('#'));
+        const QStringList fields = line.split(separators, Qt::SkipEmptyParts);
+        if (fields.size() != 3)
+            continue;
+        bool okX = false, okY = false, okRate = false;
+        const double x = fields[0].toDouble(&okX);
+        const double y = fields[1].toDouble(&okY);
+        const double rate = fields[2].toDouble(&okRate);
+        if (!okX || !okY || !okRate)
+            continue;
+        matcher.add(x, y, rate);
+    }
+    return matcher.complete();
+}
+
+QString FileRateSource::describe() const
+{
+    return QString("rate file %1").arg(fileName);
+}
+
+DaqRateSource::DaqRateSource(const DaqClient *client)
+    : daq(client)
+{
+}
+
+void DaqRateSource::beginPass()
+{
+    passStart = daq->closedWindows().size();
+}
+
+bool DaqRateSource::fetch(const std::vector<QPointF> &points, double toleranceCm, std::vector<double> &rates)
+{
+    PointMatcher matcher(points, toleranceCm, rates);
+    const std::vector<DaqWindow> &windows = daq->closedWindows();
+    for (std::size_t k = std::min(passStart, windows.size()); k < windows.size(); ++k) {
+        const DaqWindow &w = windows[k];
+        if (w.liveS > 0.0)
+            matcher.add(w.pointCm.x(), w.pointCm.y(), w.counts / w.liveS);
+    }
+    return matcher.complete();
+}
+
+QString DaqRateSource::describe() const
+{
+    return QString("DAQ at %1").arg(daq->address());
+}
@@ -0,0 +1,63 @@
+#ifndef RATE_SOURCE_H
+#define RATE_SOURCE_H
+
+#include <QPointF>
+#include <QString>
+#include <vector>
+
+#include "daq_client.h"
+
+// Detector rates per scan point from the acquisition side, for adaptive scans
+// (adaptive_scan.h). Points are stage positions in cm; a rate is matched to a
+// point within toleranceCm. Implementations must not block the UI thread:
+// fetch() returns what has arrived so far and is polled until it is complete.
+class RateSource
+{
+public:
+    virtual ~RateSource() = default;
+
+    // A pass starts; only rates measured from here on count
+    virtual void beginPass() = 0;
+
+    // Fills rates (same order as points, NaN where none arrived yet).
+    // True once every point has one.
+    virtual bool fetch(const std::vector<QPointF> &points, double toleranceCm, std::vector<double> &rates) = 0;
+
+    virtual QString describe() const = 0;
+};
+
+// Without a DAQ connection: a text file the acquisition appends "x y rate" lines
+// to, in cm and counts/s, separated by spaces, tabs or commas; '#' starts a
+// comment. Only lines added after beginPass() are read, so old runs in the
+// same file do not count. A later line for the same point wins.
+class FileRateSource : public RateSource
+{
+public:
+    explicit FileRateSource(const QString &fileName);
+
+    void beginPass() override;
+    bool fetch(const std::vector<QPointF> &points, double toleranceCm, std::vector<double> &rates) override;
+    QString describe() const override;
+
+private:
+    QString fileName;
+    qint64 passStart = 0; // file size when the pass began
+};
+
+// Rates straight from the DAQ: counts over live time of the windows it
+// closes during the pass, matched to the points by where they were opened.
+class DaqRateSource : public RateSource
+{
+public:
+    explicit DaqRateSource(const DaqClient *daq);
+
+    void beginPass() override;
+    bool fetch(const std::vector<QPointF> &points, double toleranceCm, std::vector<double> &rates) override;
+    QString describe() const override;
+
+private:
+    const DaqClient *daq;
+    std::size_t passStart = 0; // windows closed before the pass
+};
+
+#endif // RATE_SOURCE_H
@@ -0,0 +1,472 @@
+#include "scan_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+const int numParams = 5; // startMs, pointMs, stepUs, dwellScale, endMs
+
+// Prior spread of each coefficient and of a timestamp, both in their own units
+const double priorSigma[numParams] = {300.0, 30.0, 30.0, 0.05, 200.0};
+const double noiseSigmaMs = 10.0;
+
+// DAQ handshake priors, START to STARTED and CLOSED to the GUI's go
+const double daqStartMs = 500.0;
+const double daqPointMs = 5.0;
+
+// One axis of updatePosition(), including its quirk of stepping back when
+// already past the end of travel. Returns the signed usteps.
+double moveAxis(double &pos, double target, double maxSteps)
+{
+    double toGo = std::round(target - pos);
+    if (toGo > 0 && pos < maxSteps * Stage::usteps) {
+        pos += toGo;
+        return toGo;
+    }
+    if (pos > 0) {
+        pos -= std::abs(toGo);
+        return -std::abs(toGo);
+    }
+    return 0.0;
+}
+
+// Sum of the step periods of a queued move of n pulses, see stepTick(); a
+// pulse is 1 << shift usteps and lasts that many of the table's periods
+class RampCost
+{
+public:
+    RampCost(const AxisLimits &limits, int shift)
+        : shift(shift)
+    {
+        buildRamp(table, float(Stage::startRpm), limits, float(Stage::stepsPerRev));
+        const long pulses = (table.steps + (1L << shift) - 1) >> shift;
+        prefix.resize(std::size_t(pulses) + 1, 0.0);
+        for (long r = 0; r < pulses; ++r)
+            prefix[std::size_t(r) + 1] = prefix[std::size_t(r)] + periodUs(rampDelay(table, r << shift));
+    }
+
+    // Up to the middle and mirrored back down
+    double moveUs(long n) const { return upTo((n + 1) / 2) + upTo(n / 2); }
+    // Homing: up only, it ends on the switches
+    double rampUpUs(long n) const { return upTo(n); }
+
+private:
+    double periodUs(std::uint16_t tableUs) const { return std::min(32767.0, double(tableUs) * double(1L << shift)); }
+
+    double upTo(long m) const
+    {
+        const long pulses = long(prefix.size()) - 1;
+        if (m <= pulses)
+            return prefix[std::size_t(m)];
+        return prefix.back() + double(m - pulses) * periodUs(table.delayUs[RAMP_TABLE_LEN]);
+    }
+
+    int shift;
+    RampTable table;
+    std::vector<double> prefix;
+};
+
+// The plan's ramps, indexed like ramps[] in the sketch: X only, Y only, both
+struct Ramps
+{
+    explicit Ramps(const ScanPlan &plan)
+        : axis{RampCost(plan.limitsX, 0), RampCost(plan.limitsY, 0),
+               RampCost(tighterLimits(plan.limitsX, plan.limitsY), 0)},
+          coarse{RampCost(plan.limitsX, COARSE_SHIFT), RampCost(plan.limitsY, COARSE_SHIFT),
+                 RampCost(tighterLimits(plan.limitsX, plan.limitsY), COARSE_SHIFT)},
+          startUs(rampPeriodUs(float(Stage::startRpm * Stage::stepsPerRev / 60.0))),
+          creepUs(std::floor(60.0e6 / (HOME_CREEP_RPM * Stage::stepsPerRev)))
+    {
+    }
+
+    // Step periods of a move from x, y, its ramp delays added to us. Split
+    // as queueMove() does, taking the drivers' indexer home at 0 (the sketch
+    // knows it, the GUI does not): the fine parts come out a few usteps off.
+    double move(double x, double y, double dx, double dy, double &us) const
+    {
+        MovePart part[3];
+        const int parts = splitMove(long(x), long(y), long(dx), long(dy), part);
+        long n = 0;
+        for (int i = 0; i < parts; ++i) {
+            const long ax = std::labs(part[i].dx) >> part[i].shift;
+            const long ay = std::labs(part[i].dy) >> part[i].shift;
+            const long p = std::max(ax, ay);
+            if (p > 0)
+                us += (part[i].shift ? coarse : axis)[(ax ? 1 : 0) + (ay ? 2 : 0) - 1].moveUs(p);
+            n += p;
+        }
+        if (parts > 1)
+            us += 2.0 * startUs; // the MODE pins switched there and back
+        return double(n);
+    }
+
+    // returnHome(): both axes back on the ramp, a fine lead-in and then
+    // coarse, until the switches; off them and back on at the creep speed.
+    // The indexer home is taken at 0 as in move().
+    double home(double x, double y, double &us) const
+    {
+        const long c = 1L << COARSE_SHIFT;
+        const long leadX = long(x) & (c - 1);
+        const long leadY = long(y) & (c - 1);
+        const long lead = std::max(leadX, leadY);
+        const long fast = std::max(std::max(0L, long(x) - leadX + c - 1), std::max(0L, long(y) - leadY + c - 1))
+                          >> COARSE_SHIFT;
+        const double backoff = HOME_BACKOFF * Stage::usteps;
+        us += axis[2].rampUpUs(lead) + coarse[2].rampUpUs(fast) + 2.0 * startUs; // and the MODE pins
+        us += backoff * (startUs + creepUs);
+        return double(lead + fast) + 2.0 * backoff;
+    }
+
+    RampCost axis[3];
+    RampCost coarse[3]; // transit pulses, see splitMove()
+    double startUs;
+    double creepUs;
+};
+
+// Bytes SerialWorker::sendMask() puts on the line for a mask
+double maskBytes(const std::vector<MaskRun> &mask, bool binary)
+{
+    if (mask.empty())
+        return 0.0;
+    const double packet = PROTO_HEADER_LEN + 2;
+    if (binary) {
+        const double packets = 1.0 + std::ceil(double(mask.size()) / MASK_RUNS_PER_PACKET);
+        return packets * packet + double(mask.size() + 1) * sizeof(MaskRun);
+    }
+    double bytes = 6.0; // <M,-1>
+    for (std::size_t i = 0; i < mask.size();) {
+        const int row = mask[i].row;
+        bytes += 4.0 + std::to_string(row).size(); // <M,row>
+        for (int n = 0; i < mask.size() && mask[i].row == row && n < MASK_SPANS_PER_LINE; ++i, ++n)
+            bytes += 2.0 + std::to_string(mask[i].col).size() + std::to_string(mask[i].len).size();
+    }
+    return bytes;
+}
+
+// Solves a * x = b in place by Gaussian elimination with partial pivoting
+bool solve(double a[numParams][numParams], double b[numParams], double x[numParams])
+{
+    for (int c = 0; c < numParams; ++c) {
+        int pivot = c;
+        for (int r = c + 1; r < numParams; ++r)
+            if (std::abs(a[r][c]) > std::abs(a[pivot][c]))
+                pivot = r;
+        if (std::abs(a[pivot][c]) < 1e-12)
+            return false;
+        std::swap(a[c], a[pivot]);
+        std::swap(b[c], b[pivot]);
+        for (int r = c + 1; r < numParams; ++r) {
+            double f = a[r][c] / a[c][c];
+            for (int k = c; k < numParams; ++k)
+                a[r][k] -= f * a[c][k];
+            b[r] -= f * b[c];
+        }
+    }
+    for (int r = numParams - 1; r >= 0; --r) {
+        double s = b[r];
+        for (int k = r + 1; k < numParams; ++k)
+            s -= a[r][k] * x[k];
+        x[r] = s / a[r][r];
+    }
+    return true;
+}
+
+} // namespace
+
+ScanTiming ScanTiming::defaults(int linkBaud, bool gated)
+{
+    const double byteMs = 10000.0 / linkBaud; // 8N1
+
+    ScanTiming t;
+    // The step interrupt does its work inside the ramp's periods
+    t.stepUs = 0.0;
+    t.dwellScale = 1.0;
+    t.byteMs = byteMs;
+
+    // Prints are buffered and go out behind the sketch's back, so they only
+    // delay an event by the line time of what is queued in front of it
+    if (linkBaud == PROTO_ASCII_BAUD) {
+        // The command itself, the 2 s wait, the SCAN_INDEX line
+        t.startMs = (37 + 24) * byteMs + 2000.0;
+        t.pointMs = 1.0;
+        t.endMs = (16 + 13 + 74 - 24) * byteMs; // last POINT_TIME and "Scan complete" lines ahead of SCAN_DONE
+        t.homeFirstMs = 20 * byteMs;
+        t.clipMs = 0.0;
+    } else {
+        const int cmdBytes = PROTO_HEADER_LEN + 2 + int(sizeof(CmdPacket));
+        const int scanBytes = PROTO_HEADER_LEN + 2 + int(sizeof(ScanPacket));
+        const int indexBytes = PROTO_HEADER_LEN + 2 + int(sizeof(ScanIndexPacket));
+        const int pointTimeBytes = PROTO_HEADER_LEN + 2 + int(sizeof(PointTimePacket));
+        t.startMs = (scanBytes + indexBytes) * byteMs + 2000.0;
+        t.pointMs = 1.0;
+        t.endMs = pointTimeBytes * byteMs; // the last POINT_TIME
+        t.homeFirstMs = cmdBytes * byteMs;
+        t.clipMs = 0.0;
+    }
+
+    // Gated, the DAQ run start replaces the 2 s and every point waits for a
+    // CLOSED on the network and the <N,...> on the line
+    if (gated) {
+        const double goMs = (linkBaud == PROTO_ASCII_BAUD ? 15 : PROTO_HEADER_LEN + 2 + int(sizeof(CmdPacket))) * byteMs;
+        t.startMs += daqStartMs + goMs - 2000.0;
+        t.pointMs += daqPointMs + goMs;
+    }
+    return t;
+}
+
+ScanEstimator::ScanEstimator(int linkBaud, bool gated)
+    : baud(linkBaud),
+      daqGated(gated),
+      model(ScanTiming::defaults(linkBaud, gated))
+{
+}
+
+ScanEstimator::Trace ScanEstimator::trace(const ScanPlan &plan)
+{
+    Trace t;
+    const Ramps ramps(plan);
+    double x = plan.startX;
+    double y = plan.startY;
+    double steps = 0.0;
+    double rampUs = 0.0;
+    int clips = 0;
+
+    t.maskBytes = maskBytes(plan.mask, plan.linkBaud != PROTO_ASCII_BAUD);
+
+    // startScan() sends '8' first when the plan says so, else the scan sets off from here
+    if (plan.homeFirst) {
+        t.homeFirst = ramps.home(x, y, t.homeFirstUs);
+        steps = t.homeFirst;
+        rampUs = t.homeFirstUs;
+        x = 0.0;
+        y = 0.0;
+    }
+
+    // The sketch receives spacing and timing as floats
+    const double spacing = float(plan.spacing);
+    t.dwellMs = double(int(double(float(plan.timing)) * 1000.0));
+    const int nRows = plan.rowMax - plan.rowMin + 1;
+    const int nCols = plan.colMax - plan.colMin + 1;
+    const long points = (nRows > 0 && nCols > 0) ? long(nRows) * nCols : 0;
+
+    // The mask as one flag per cell of the box; the sketch passes over the rest
+    std::vector<char> selected;
+    if (!plan.mask.empty()) {
+        selected.assign(std::size_t(points), 0);
+        for (const MaskRun &run : plan.mask) {
+            int r = run.row - plan.rowMin;
+            if (r < 0 || r >= nRows)
+                continue;
+            int c0 = std::max(0, run.col - plan.colMin);
+            int c1 = std::min(nCols, run.col + run.len - plan.colMin);
+            for (int c = c0; c < c1; ++c)
+                selected[std::size_t(r) * nCols + c] = 1;
+        }
+    }
+
+    t.steps.reserve(std::size_t(points));
+    t.rampUs.reserve(std::size_t(points));
+    t.clips.reserve(std::size_t(points));
+    for (long n = 0; n < points; ++n) {
+        int i, j;
+        scanOrderPoint(std::uint8_t(plan.order), n, nRows, nCols, i, j);
+        if (!selected.empty() && !selected[std::size_t(i) * nCols + j])
+            continue;
+        i += plan.rowMin;
+        j += plan.colMin;
+
+        // Rows run along Y and columns along X, as in scan(). It clips only
+        // its local copy, updatePosition() still gets the unclipped target.
+        double xCm = float(j * spacing);
+        double yCm = float(i * spacing);
+        if (xCm > Stage::lengthCm || yCm > Stage::widthCm)
+            ++clips;
+
+        // Both axes step together, the longer one sets the time
+        const double fromX = x;
+        const double fromY = y;
+        double dx = moveAxis(x, xCm * Stage::stepsPerCmX * Stage::usteps, Stage::maxStepsX);
+        double dy = moveAxis(y, yCm * Stage::stepsPerCmY * Stage::usteps, Stage::maxStepsY);
+        steps += ramps.move(fromX, fromY, dx, dy, rampUs);
+        t.steps.push_back(steps);
+        t.rampUs.push_back(rampUs);
+        t.clips.push_back(clips);
+    }
+    return t;
+}
+
+ScanEstimate ScanEstimator::estimate(const ScanPlan &plan) const
+{
+    const Trace t = trace(plan);
+    const double first = model.startMs + (plan.homeFirst ? model.homeFirstMs : 0.0) + model.byteMs * t.maskBytes;
+
+    ScanEstimate e;
+    e.points = int(t.steps.size());
+    e.pointMs.reserve(t.steps.size());
+    for (std::size_t k = 0; k < t.steps.size(); ++k)
+        e.pointMs.push_back(first + model.pointMs * k + (model.stepUs * t.steps[k] + t.rampUs[k]) / 1000.0
+                            + model.dwellScale * t.dwellMs * k + model.clipMs * t.clips[k]);
+
+    const double n = e.points;
+    const double moved = t.steps.empty() ? t.homeFirst : t.steps.back();
+    const double movedUs = t.rampUs.empty() ? t.homeFirstUs : t.rampUs.back();
+    const int clips = t.clips.empty() ? 0 : t.clips.back();
+    e.doneMs = first + model.pointMs * n + (model.stepUs * moved + movedUs) / 1000.0
+               + model.dwellScale * t.dwellMs * n + model.clipMs * clips + model.endMs;
+    e.totalMs = e.doneMs;
+    e.steps = moved;
+    return e;
+}
+
+std::size_t ScanEstimator::fit(const std::vector<ScanRun> &runs)
+{
+    // Ridge regression: minimise the squared timestamp errors plus the squared
+    // distance from the defaults, each scaled by its sigma
+    const ScanTiming prior = ScanTiming::defaults(baud, daqGated);
+    const double priorValue[numParams] = {prior.startMs, prior.pointMs, prior.stepUs, prior.dwellScale, prior.endMs};
+
+    double ata[numParams][numParams] = {};
+    double atb[numParams] = {};
+    for (int p = 0; p < numParams; ++p) {
+        double w = 1.0 / (priorSigma[p] * priorSigma[p]);
+        ata[p][p] += w;
+        atb[p] += w * priorValue[p];
+    }
+
+    const double w = 1.0 / (noiseSigmaMs * noiseSigmaMs);
+    std::size_t used = 0;
+    auto add = [&](const double f[numParams], double y) {
+        for (int r = 0; r < numParams; ++r) {
+            for (int c = 0; c < numParams; ++c)
+                ata[r][c] += w * f[r] * f[c];
+            atb[r] += w * f[r] * y;
+        }
+        ++used;
+    };
+
+    for (const ScanRun &run : runs) {
+        if (run.plan.linkBaud != baud || run.plan.gated != daqGated)
+            continue;
+        const Trace t = trace(run.plan);
+        const double fixed = (run.plan.homeFirst ? model.homeFirstMs : 0.0) + model.byteMs * t.maskBytes;
+        std::size_t n = std::min(run.indexMs.size(), t.steps.size());
+        for (std::size_t k = 0; k < n; ++k) {
+            const double f[numParams] = {1.0, double(k), t.steps[k] / 1000.0, t.dwellMs * k, 0.0};
+            add(f, run.indexMs[k] - fixed - t.rampUs[k] / 1000.0 - model.clipMs * t.clips[k]);
+        }
+        if (run.doneMs >= 0.0 && run.indexMs.size() == t.steps.size() && !t.steps.empty()) {
+            const double points = double(t.steps.size());
+            const double f[numParams] = {1.0, points, t.steps.back() / 1000.0, t.dwellMs * points, 1.0};
+            add(f, run.doneMs - fixed - t.rampUs.back() / 1000.0 - model.clipMs * t.clips.back());
+        }
+    }
+
+    double x[numParams];
+    if (used == 0 || !solve(ata, atb, x))
+        return 0;
+    model.startMs = x[0];
+    model.pointMs = x[1];
+    model.stepUs = x[2];
+    model.dwellScale = x[3];
+    model.endMs = x[4];
+    return used;
+}
+
+std::size_t ScanEstimator::fastest(const std::vector<ScanPlan> &plans, std::vector<ScanEstimate> *estimates) const
+{
+    std::size_t best = 0;
+    double bestMs = 0.0;
+    if (estimates)
+        estimates->clear();
+    for (std::size_t i = 0; i < plans.size(); ++i) {
+        ScanEstimate e = estimate(plans[i]);
+        if (i == 0 || e.totalMs < bestMs) {
+            best = i;
+            bestMs = e.totalMs;
+        }
+        if (estimates)
+            estimates->push_back(std::move(e));
+    }
+    return best;
+}
+
+// run <baud> <spacing> <timing> <rowMin> <rowMax> <colMin> <colMax> <startX> <startY> [order [limits [gated [home]]]]
+//   limits: <X rpm> <X accel> <X jerk> <Y rpm> <Y accel> <Y jerk>
+//   gated: 1 for a DAQ gated run, 0 or missing for a timed one
+//   home: 1 if it homed first; missing, it did unless it started at (0,0)
+// mask <row> <col> <len>   (one per run, none for the whole box)
+// index <ms>   (one per SCAN_INDEX, in arrival order)
+// done <ms>
+bool ScanEstimator::appendRun(const std::string &path, const ScanRun &run)
+{
+    std::ofstream out(path, std::ios::app);
+    if (!out)
+        return false;
+    // Hours into a scan, ms and usteps from (0,0) need more than the 6 default digits
+    out << std::setprecision(10);
+    const ScanPlan &p = run.plan;
+    out << "run " << p.linkBaud << ' ' << p.spacing << ' ' << p.timing << ' ' << p.rowMin << ' ' << p.rowMax
+        << ' ' << p.colMin << ' ' << p.colMax << ' ' << p.startX << ' ' << p.startY << ' ' << p.order
+        << ' ' << p.limitsX.maxRpm << ' ' << p.limitsX.accelRpm << ' ' << p.limitsX.jerkRpm
+        << ' ' << p.limitsY.maxRpm << ' ' << p.limitsY.accelRpm << ' ' << p.limitsY.jerkRpm
+        << ' ' << (p.gated ? 1 : 0) << ' ' << (p.homeFirst ? 1 : 0) << '\n';
+    for (const MaskRun &m : p.mask)
+        out << "mask " << m.row << ' ' << m.col << ' ' << m.len << '\n';
+    for (double ms : run.indexMs)
+        out << "index " << ms << '\n';
+    if (run.doneMs >= 0.0)
+        out << "done " << run.doneMs << '\n';
+    return bool(out);
+}
+
+std::vector<ScanRun> ScanEstimator::loadRuns(const std::string &path, std::size_t maxRuns)
+{
+    std::vector<ScanRun> runs;
+    std::ifstream in(path);
+    std::string line;
+    bool valid = false;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string tag;
+        fields >> tag;
+        if (tag == "run") {
+            ScanRun run;
+            ScanPlan &p = run.plan;
+            valid = bool(fields >> p.linkBaud >> p.spacing >> p.timing >> p.rowMin >> p.rowMax
+                         >> p.colMin >> p.colMax >> p.startX >> p.startY);
+            if (!(fields >> p.order))
+                p.order = SCAN_ORDER_ROWS;
+            p.homeFirst = p.startX != 0.0 || p.startY != 0.0;
+            AxisLimits x, y;
+            if (fields >> x.maxRpm >> x.accelRpm >> x.jerkRpm >> y.maxRpm >> y.accelRpm >> y.jerkRpm) {
+                p.limitsX = x;
+                p.limitsY = y;
+                int gated = 0;
+                p.gated = (fields >> gated) && gated != 0;
+                int home = 0;
+                if (fields >> home)
+                    p.homeFirst = home != 0;
+            }
+            if (valid)
+                runs.push_back(run);
+        } else if (valid && tag == "mask") {
+            int row, col, len;
+            if (fields >> row >> col >> len)
+                runs.back().plan.mask.push_back(MaskRun{std::int16_t(row), std::int16_t(col), std::int16_t(len)});
+        } else if (valid && tag == "index") {
+            double ms;
+            if (fields >> ms)
+                runs.back().indexMs.push_back(ms);
+        } else if (valid && tag == "done") {
+            fields >> runs.back().doneMs;
+        }
+    }
+    if (runs.size() > maxRuns)
+        runs.erase(runs.begin(), runs.end() - std::ptrdiff_t(maxRuns));
+    return runs;
+}
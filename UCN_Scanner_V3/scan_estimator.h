@@ -0,0 +1,129 @@
+#ifndef SCAN_ESTIMATOR_H
+#define SCAN_ESTIMATOR_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "motion_profile.h"
+#include "scanner_protocol.h"
+
+// Scan duration model. Walks a scan the way scan() and updatePosition() in
+// stepper_control_GUI_Ver2.ino do, point by point, and prices every part of it:
+// the 2 s acquisition wait (or the DAQ handshake), the line time of the prints, the trigger pulse,
+// dwell, the coordinated and ramped moves in the plan's scan order, and homing
+// before and after. The per-point coefficients are fitted from the
+// SCAN_INDEX arrival times of earlier runs (see fit() and the run log).
+
+// Stage geometry, same values as the Arduino sketch
+namespace Stage {
+constexpr double usteps = 32.0;
+constexpr double stepsPerCmX = 71.0 + 15.0 / 32.0; // long side, motor 1
+constexpr double stepsPerCmY = 71.0 + 5.0 / 32.0;  // short side, motor 2
+constexpr double maxStepsX = 4214.8215;            // 59 cm
+constexpr double maxStepsY = 1992.375;             // 28 cm
+constexpr double lengthCm = 59.0;
+constexpr double widthCm = 28.0;
+constexpr double startRpm = 60.0;                  // SPEED
+constexpr double stepsPerRev = 200.0 * usteps;
+}
+
+struct ScanPlan
+{
+    double spacing = 1.0; // cm
+    double timing = 1.0;  // dwell per point, s
+    int rowMin = 0;
+    int rowMax = 0;
+    int colMin = 0;
+    int colMax = 0;
+    std::vector<MaskRun> mask; // cells of the box that are scanned, empty for all of them
+    double startX = 0.0; // stage position in usteps when the scan is sent
+    double startY = 0.0;
+    bool homeFirst = false; // the GUI sends '8' ahead of the scan
+    int order = 0;       // SCAN_ORDER_* of scanner_protocol.h
+    int linkBaud = 9600; // 9600 is the ASCII link, anything else binary
+    bool gated = false;  // DAQ handshake instead of the 2 s wait and the timed dwell (scanner_protocol.h)
+    AxisLimits limitsX = {float(Stage::startRpm), float(MOTION_DEFAULT_ACCEL), float(MOTION_DEFAULT_JERK)};
+    AxisLimits limitsY = {float(Stage::startRpm), float(MOTION_DEFAULT_ACCEL), float(MOTION_DEFAULT_JERK)};
+};
+
+// An event arrives at:
+//   startMs + pointMs * k + stepUs * steps + ramp + dwellScale * dwell [+ endMs for SCAN_DONE]
+// where k, steps and dwell count what happened before it and ramp is the sum of
+// the step periods from motion_profile.h. The fixed parts below are not fitted:
+// homing echo, the mask upload, clip warnings and the tail after SCAN_DONE.
+struct ScanTiming
+{
+    double startMs = 0.0;     // scan command to the first SCAN_INDEX, without moves
+    double pointMs = 0.0;     // per point: trigger pulse and loop overhead
+    double stepUs = 0.0;      // per step period on top of its ramp delay
+    double dwellScale = 1.0;  // real ms per ms of dwell
+    double endMs = 0.0;       // last point to SCAN_DONE, less one pointMs
+
+    double homeFirstMs = 0.0; // the '8' command ahead of a scan that homes first
+    double byteMs = 0.0;      // line time per byte of a mask sent ahead of the scan
+    double clipMs = 0.0;      // clip warning, where it holds up the sketch
+
+    static ScanTiming defaults(int linkBaud, bool gated = false);
+};
+
+struct ScanEstimate
+{
+    int points = 0;
+    double steps = 0.0;          // step periods, homing first included
+    double doneMs = 0.0;         // scan command to SCAN_DONE
+    double totalMs = 0.0;        // scan command until the stage is free again: doneMs, it stays at the last point
+    std::vector<double> pointMs; // expected SCAN_INDEX arrivals, in scan order
+};
+
+// One logged run: SCAN_INDEX arrival times in ms after the scan was sent
+struct ScanRun
+{
+    ScanPlan plan;
+    std::vector<double> indexMs;
+    double doneMs = -1.0; // -1 if stopped before SCAN_DONE
+};
+
+class ScanEstimator
+{
+public:
+    explicit ScanEstimator(int linkBaud = 9600, bool gated = false);
+
+    int linkBaud() const { return baud; }
+    bool gated() const { return daqGated; }
+    const ScanTiming &timing() const { return model; }
+
+    ScanEstimate estimate(const ScanPlan &plan) const;
+
+    // Refits the coefficients to the runs on this link, gated or not. A ridge around the
+    // defaults keeps them sane with few runs or only one dwell time.
+    // Returns the number of timestamps used.
+    std::size_t fit(const std::vector<ScanRun> &runs);
+
+    // Index of the quickest plan, e.g. to compare spacings or scan orders
+    std::size_t fastest(const std::vector<ScanPlan> &plans, std::vector<ScanEstimate> *estimates = nullptr) const;
+
+    // Run log, plain text, one run per "run" line
+    static bool appendRun(const std::string &path, const ScanRun &run);
+    static std::vector<ScanRun> loadRuns(const std::string &path, std::size_t maxRuns);
+
+private:
+    struct Trace
+    {
+        double homeFirst = 0.0;        // step periods homing before the scan
+        double homeFirstUs = 0.0;      // and their ramp delays
+        double maskBytes = 0.0;        // the mask messages ahead of the scan command
+        std::vector<double> steps;     // step periods up to each point, homing first included
+        std::vector<double> rampUs;    // the ramp delays of those step periods
+        std::vector<int> clips;        // clip warnings up to each point
+        double dwellMs = 0.0;          // per point
+    };
+
+    static Trace trace(const ScanPlan &plan);
+
+    int baud;
+    bool daqGated;
+    ScanTiming model;
+};
+
+#endif // SCAN_ESTIMATOR_H
@@ -0,0 +1,407 @@
+#include "scan_grid.h"
+
+#include <QMouseEvent>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QRegion>
+#include <QScreen>
+#include <QTimer>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+const int minGridLinePx = 4; // below this grid lines would hide the cells
+const QColor stateColours[] = {
+    Qt::white,              // None, unselected
+    Qt::green,              // Pending
+    QColor(255, 165, 0),    // Moving
+    Qt::yellow,             // Dwelling
+    QColor(70, 130, 180),   // Done
+    QColor(200, 200, 200),  // Skipped
+    Qt::red                 // Error
+};
+}
+
+ScanGrid::ScanGrid(QWidget *parent)
+    : QWidget(parent),
+      repaintTimer(new QTimer(this))
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
+    repaintTimer->setSingleShot(true);
+    connect(repaintTimer, &QTimer::timeout, this, &ScanGrid::flushDirty);
+}
+
+void ScanGrid::setGridSize(int numRows, int numCols)
+{
+    rows = std::max(0, numRows);
+    cols = std::max(0, numCols);
+    bits.assign((std::size_t(rows) * std::size_t(cols) + 63) / 64, 0);
+    states.clear();
+    rates.clear();
+    rateMax = 0.0f;
+    dirtyCells.clear();
+    dragBase = bits;
+    anchor = QPoint();
+    dragRect = QRect();
+    update();
+}
+
+bool ScanGrid::isSelected(int row, int col) const
+{
+    if (row < 0 || row >= rows || col < 0 || col >= cols)
+        return false;
+    std::size_t i = index(row, col);
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+void ScanGrid::selectCells(int rowMin, int rowMax, int colMin, int colMax)
+{
+    clearSelection();
+    QRect cells = QRect(QPoint(colMin, rowMin), QPoint(colMax, rowMax)) & QRect(0, 0, cols, rows);
+    if (cells.isEmpty())
+        return;
+    dragBase = bits;
+    dragValue = true;
+    setCells(cells, true);
+    anchor = cells.topLeft();
+    dragRect = cells;
+    emit selectionChanged();
+}
+
+void ScanGrid::selectRuns(const std::vector<MaskRun> &runs)
+{
+    clearSelection();
+    bool any = false;
+    for (const MaskRun &run : runs) {
+        QRect cells = QRect(run.col, run.row, run.len, 1) & QRect(0, 0, cols, rows);
+        if (cells.isEmpty())
+            continue;
+        setCells(cells, true);
+        any = true;
+    }
+    if (any)
+        emit selectionChanged();
+}
+
+void ScanGrid::selectAll()
+{
+    selectCells(0, rows - 1, 0, cols - 1);
+}
+
+void ScanGrid::clearSelection()
+{
+    if (std::any_of(bits.begin(), bits.end(), [](quint64 w) { return w != 0; })) {
+        std::fill(bits.begin(), bits.end(), 0);
+        update();
+        emit selectionChanged();
+    }
+    dragRect = QRect();
+}
+
+bool ScanGrid::selectionBounds(int &rowMin, int &rowMax, int &colMin, int &colMax) const
+{
+    rowMin = rows;
+    rowMax = -1;
+    colMin = cols;
+    colMax = -1;
+    for (int r = 0; r < rows; ++r) {
+        std::size_t start = index(r, 0);
+        std::size_t end = start + std::size_t(cols);
+        std::size_t first = findBit(start, end, true);
+        if (first == end)
+            continue;
+        rowMin = std::min(rowMin, r);
+        rowMax = r;
+        colMin = std::min(colMin, int(first - start));
+        for (std::size_t p = first; p < end; p = findBit(p, end, true)) {
+            p = findBit(p, end, false);
+            colMax = std::max(colMax, int(p - start) - 1);
+        }
+    }
+    return rowMax >= 0;
+}
+
+std::vector<MaskRun> ScanGrid::selectionRuns() const
+{
+    std::vector<MaskRun> runs;
+    for (int r = 0; r < rows; ++r) {
+        std::size_t start = index(r, 0);
+        std::size_t end = start + std::size_t(cols);
+        for (std::size_t a = findBit(start, end, true); a < end; a = findBit(a, end, true)) {
+            std::size_t b = findBit(a, end, false);
+            runs.push_back(MaskRun{qint16(r), qint16(a - start), qint16(b - a)});
+            a = b;
+        }
+    }
+    return runs;
+}
+
+std::size_t ScanGrid::selectedCount() const
+{
+    std::size_t n = 0;
+    for (quint64 w : bits)
+        n += qPopulationCount(w);
+    return n;
+}
+
+ScanGrid::CellState ScanGrid::cellState(int row, int col) const
+{
+    if (states.empty() || row < 0 || row >= rows || col < 0 || col >= cols)
+        return CellState::None;
+    return states[index(row, col)];
+}
+
+void ScanGrid::setCellState(int row, int col, CellState state)
+{
+    if (row < 0 || row >= rows || col < 0 || col >= cols)
+        return;
+    if (states.empty()) {
+        if (state == CellState::None)
+            return;
+        states.assign(std::size_t(rows) * std::size_t(cols), CellState::None);
+    }
+    CellState &s = states[index(row, col)];
+    if (s == state)
+        return;
+    s = state;
+    markDirty(row, col);
+}
+
+void ScanGrid::setCellRate(int row, int col, double rate)
+{
+    if (row < 0 || row >= rows || col < 0 || col >= cols || !(rate >= 0.0))
+        return;
+    if (rates.empty())
+        rates.assign(std::size_t(rows) * std::size_t(cols), std::numeric_limits<float>::quiet_NaN());
+    rates[index(row, col)] = float(rate);
+    if (rate > rateMax) {
+        // Everything coloured so far moves on the scale; headroom keeps that rare
+        rateMax = float(rate * 1.5);
+        dirtyAll = dirtyAll || rateColours;
+    }
+    if (rateColours)
+        markDirty(row, col);
+}
+
+void ScanGrid::setRateColours(bool on)
+{
+    if (on == rateColours)
+        return;
+    rateColours = on;
+    if (!rates.empty())
+        update();
+}
+
+void ScanGrid::clearStates()
+{
+    if (states.empty() && rates.empty())
+        return;
+    states.clear();
+    rates.clear();
+    rateMax = 0.0f;
+    dirtyCells.clear();
+    update();
+}
+
+void ScanGrid::markDirty(int row, int col)
+{
+    // Runs along a row, as scans mostly go, make one rectangle
+    QRect cell(col, row, 1, 1);
+    if (!dirtyCells.empty()) {
+        QRect &last = dirtyCells.back();
+        if (last.contains(cell.topLeft()))
+            return;
+        if (last.top() == row && last.height() == 1 && (col == last.right() + 1 || col == last.left() - 1)) {
+            last |= cell;
+            return;
+        }
+    }
+    dirtyCells.push_back(cell);
+    if (!repaintTimer->isActive()) {
+        const qreal hz = screen() ? screen()->refreshRate() : 60.0;
+        repaintTimer->start(std::max(1, int(1000.0 / std::max<qreal>(hz, 1.0))));
+    }
+}
+
+void ScanGrid::flushDirty()
+{
+    if (dirtyAll) {
+        update();
+    } else {
+        for (const QRect &cells : dirtyCells)
+            update(pixelRect(cells));
+    }
+    dirtyAll = false;
+    dirtyCells.clear();
+}
+
+QColor ScanGrid::stateColour(std::size_t i) const
+{
+    const CellState s = states[i];
+    if (s == CellState::None)
+        return ((bits[i / 64] >> (i % 64)) & 1) ? Qt::green : Qt::white;
+    if (s == CellState::Done && rateColours && !rates.empty() && !std::isnan(rates[i]) && rateMax > 0.0f) {
+        // Blue for nothing to red at the top of the scale
+        const float t = std::min(1.0f, rates[i] / rateMax);
+        return QColor::fromHsvF(0.66f * (1.0f - t), 1.0f, 1.0f);
+    }
+    return stateColours[int(s)];
+}
+
+// First bit in [from, to) equal to value, or to
+std::size_t ScanGrid::findBit(std::size_t from, std::size_t to, bool value) const
+{
+    while (from < to) {
+        quint64 word = value ? bits[from / 64] : ~bits[from / 64];
+        word >>= from % 64;
+        if (word)
+            return std::min(to, from + qCountTrailingZeroBits(word));
+        from = (from / 64 + 1) * 64;
+    }
+    return to;
+}
+
+void ScanGrid::setCells(const QRect &cells, bool on)
+{
+    for (int r = cells.top(); r <= cells.bottom(); ++r) {
+        std::size_t i = index(r, cells.left());
+        std::size_t end = index(r, cells.right()) + 1;
+        while (i < end) {
+            std::size_t bit = i % 64;
+            std::size_t n = std::min<std::size_t>(64 - bit, end - i);
+            quint64 mask = (n == 64 ? ~quint64(0) : (quint64(1) << n) - 1) << bit;
+            if (on)
+                bits[i / 64] |= mask;
+            else
+                bits[i / 64] &= ~mask;
+            i += n;
+        }
+    }
+    update(pixelRect(cells));
+}
+
+// Back to the state the drag started from
+void ScanGrid::restoreCells(const QRect &cells)
+{
+    for (int r = cells.top(); r <= cells.bottom(); ++r) {
+        std::size_t i = index(r, cells.left());
+        std::size_t end = index(r, cells.right()) + 1;
+        while (i < end) {
+            std::size_t bit = i % 64;
+            std::size_t n = std::min<std::size_t>(64 - bit, end - i);
+            quint64 mask = (n == 64 ? ~quint64(0) : (quint64(1) << n) - 1) << bit;
+            bits[i / 64] = (bits[i / 64] & ~mask) | (dragBase[i / 64] & mask);
+            i += n;
+        }
+    }
+    update(pixelRect(cells));
+}
+
+void ScanGrid::dragTo(const QPoint &cell)
+{
+    // Only the cells entering or leaving the rectangle change
+    QRect next = QRect(anchor, cell).normalized();
+    if (next == dragRect)
+        return;
+    QRegion before(dragRect);
+    QRegion after(next);
+    for (const QRect &r : before.subtracted(after))
+        restoreCells(r);
+    for (const QRect &r : after.subtracted(before))
+        setCells(r, dragValue);
+    dragRect = next;
+    emit selectionChanged();
+}
+
+QPoint ScanGrid::cellAt(const QPoint &pos) const
+{
+    int col = int(qint64(std::max(0, pos.x())) * cols / std::max(1, width()));
+    int row = int(qint64(std::max(0, pos.y())) * rows / std::max(1, height()));
+    return QPoint(std::min(col, cols - 1), std::min(row, rows - 1));
+}
+
+QRect ScanGrid::pixelRect(const QRect &cells) const
+{
+    int x0 = int(qint64(cells.left()) * width() / cols);
+    int x1 = int(qint64(cells.right() + 1) * width() / cols);
+    int y0 = int(qint64(cells.top()) * height() / rows);
+    int y1 = int(qint64(cells.bottom() + 1) * height() / rows);
+    return QRect(x0, y0, std::max(1, x1 - x0), std::max(1, y1 - y0));
+}
+
+void ScanGrid::paintEvent(QPaintEvent *event)
+{
+    QPainter p(this);
+    const QRect dirty = event->rect();
+    p.fillRect(dirty, Qt::white);
+    if (rows == 0 || cols == 0)
+        return;
+
+    // One fill per run of selected cells in each row, or of cells in the
+    // same colour while a run's states are up
+    const QPoint first = cellAt(dirty.topLeft());
+    const QPoint last = cellAt(dirty.bottomRight());
+    for (int r = first.y(); r <= last.y() && !states.empty(); ++r) {
+        std::size_t start = index(r, 0);
+        std::size_t end = index(r, last.x()) + 1;
+        std::size_t a = index(r, first.x());
+        while (a < end) {
+            const QColor colour = stateColour(a);
+            std::size_t b = a + 1;
+            while (b < end && stateColour(b) == colour)
+                ++b;
+            if (colour != Qt::white)
+                p.fillRect(pixelRect(QRect(int(a - start), r, int(b - a), 1)), colour);
+            a = b;
+        }
+    }
+    for (int r = first.y(); r <= last.y() && states.empty(); ++r) {
+        std::size_t start = index(r, 0);
+        std::size_t end = index(r, last.x()) + 1;
+        for (std::size_t a = findBit(index(r, first.x()), end, true); a < end; a = findBit(a, end, true)) {
+            std::size_t b = findBit(a, end, false);
+            p.fillRect(pixelRect(QRect(int(a - start), r, int(b - a), 1)), Qt::green);
+            a = b;
+        }
+    }
+
+    if (width() / cols >= minGridLinePx && height() / rows >= minGridLinePx) {
+        p.setPen(palette().color(QPalette::Mid));
+        for (int c = first.x(); c <= last.x() + 1; ++c) {
+            int x = std::min(width() - 1, int(qint64(c) * width() / cols));
+            p.drawLine(x, dirty.top(), x, dirty.bottom());
+        }
+        for (int r = first.y(); r <= last.y() + 1; ++r) {
+            int y = std::min(height() - 1, int(qint64(r) * height() / rows));
+            p.drawLine(dirty.left(), y, dirty.right(), y);
+        }
+    }
+}
+
+void ScanGrid::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton || rows == 0 || cols == 0)
+        return;
+    QPoint cell = cellAt(event->pos());
+    if (!(event->modifiers() & Qt::ShiftModifier) || dragRect.isEmpty()) {
+        if (event->modifiers() & Qt::ControlModifier) {
+            dragValue = !isSelected(cell.y(), cell.x());
+        } else {
+            clearSelection();
+            dragValue = true;
+        }
+        dragBase = bits;
+        dragRect = QRect();
+        anchor = cell;
+    }
+    dragTo(cell);
+}
+
+void ScanGrid::mouseMoveEvent(QMouseEvent *event)
+{
+    if ((event->buttons() & Qt::LeftButton) && rows > 0 && cols > 0)
+        dragTo(cellAt(event->pos()));
+}
@@ -0,0 +1,108 @@
+#ifndef SCAN_GRID_H
+#define SCAN_GRID_H
+
+#include <QRect>
+#include <QWidget>
+#include <vector>
+
+class QTimer;
+
+#include "scanner_protocol.h"
+
+// The scanning grid: rows along the long (59 cm) side, columns along the short side.
+// Painted directly with one bit per cell instead of a QTableWidgetItem per cell,
+// so fine spacings (590 x 280 cells at 1 mm) stay cheap. Cells are stretched to
+// fill the widget and may be narrower than a pixel.
+//
+// Selection works like QAbstractItemView::ExtendedSelection: drag a rectangle,
+// shift-click extends it from the anchor, ctrl-drag adds a rectangle to the
+// selection, or takes it out when started on a selected cell. So any mask of
+// cells can be built up. Only the cells that changed are repainted.
+//
+// A run's progress is drawn over the selection as a state per cell. State
+// and rate changes only mark their cells; the marked cells are repainted
+// together at most once per display frame, however many messages come in.
+class ScanGrid : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ScanGrid(QWidget *parent = nullptr);
+
+    // Resizing clears the selection
+    void setGridSize(int rows, int cols);
+    int rowCount() const { return rows; }
+    int columnCount() const { return cols; }
+
+    bool isSelected(int row, int col) const;
+    // Replaces the selection with the given cells, clipped to the grid
+    void selectCells(int rowMin, int rowMax, int colMin, int colMax);
+    void selectAll();
+    // Replaces the selection with runs of cells along rows, clipped to the grid
+    void selectRuns(const std::vector<MaskRun> &runs);
+    void clearSelection();
+    // Bounding box of the selection, false if nothing is selected
+    bool selectionBounds(int &rowMin, int &rowMax, int &colMin, int &colMax) const;
+    // The selection as runs of cells along each row, top to bottom, left to right
+    std::vector<MaskRun> selectionRuns() const;
+    std::size_t selectedCount() const;
+
+    enum class CellState : quint8 {
+        None,     // not part of the run: the selection shows
+        Pending,
+        Moving,   // the stage is on its way there
+        Dwelling,
+        Done,     // coloured by its rate, if it has one and rate colours are on
+        Skipped,  // left out by a stop
+        Error     // no confirmation from the Arduino
+    };
+    CellState cellState(int row, int col) const;
+    void setCellState(int row, int col, CellState state);
+    // Counts/s measured at a cell
+    void setCellRate(int row, int col, double rate);
+    void setRateColours(bool on);
+    // Back to the plain selection
+    void clearStates();
+
+signals:
+    void selectionChanged();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+
+private:
+    std::size_t index(int row, int col) const { return std::size_t(row) * std::size_t(cols) + std::size_t(col); }
+    std::size_t findBit(std::size_t from, std::size_t to, bool value) const;
+    void setCells(const QRect &cells, bool on);
+    void restoreCells(const QRect &cells);
+    void dragTo(const QPoint &cell);
+    QPoint cellAt(const QPoint &pos) const;
+    QRect pixelRect(const QRect &cells) const;
+    QColor stateColour(std::size_t i) const;
+    void markDirty(int row, int col);
+    void flushDirty();
+
+    int rows = 0;
+    int cols = 0;
+    std::vector<quint64> bits; // row-major, one bit per cell
+
+    // Current drag rectangle in cell coordinates (x = col, y = row). Cells
+    // it leaves go back to how they were in dragBase, when the drag started.
+    QPoint anchor;
+    QRect dragRect;
+    std::vector<quint64> dragBase;
+    bool dragValue = true; // false: the drag deselects
+
+    // Run progress, allocated with the first state set
+    std::vector<CellState> states;
+    std::vector<float> rates; // NaN where none was measured
+    float rateMax = 0.0f;     // top of the colour scale, raised with headroom
+    bool rateColours = false;
+    std::vector<QRect> dirtyCells; // waiting for the next frame
+    bool dirtyAll = false;
+    QTimer *repaintTimer;
+};
+
+#endif // SCAN_GRID_H
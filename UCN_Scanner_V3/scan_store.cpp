@@ -0,0 +1,198 @@
+#include "scan_store.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+bool writeAt(int fd, const void *data, std::size_t len, std::uint64_t offset)
+{
+    const char *p = static_cast<const char *>(data);
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, p, len, off_t(offset));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= std::size_t(n);
+        offset += std::uint64_t(n);
+    }
+    return true;
+}
+
+} // namespace
+
+ScanStoreWriter::~ScanStoreWriter()
+{
+    close();
+}
+
+bool ScanStoreWriter::open(const std::string &path, const ScanStoreHeader &header)
+{
+    close();
+    head = header;
+    std::memcpy(head.magic, ScanStoreMagic, sizeof(head.magic));
+    head.version = ScanStoreVersion;
+    head.flags &= ScanStorePath | ScanStoreGated;
+    head.headerSize = sizeof(ScanStoreHeader);
+    head.recordSize = sizeof(ScanRecord);
+    if (head.rowMax < head.rowMin || head.colMax < head.colMin) {
+        head.indexRows = 0;
+        head.indexCols = 0;
+    } else {
+        head.indexRows = std::uint32_t(head.rowMax - head.rowMin + 1);
+        head.indexCols = std::uint32_t(head.colMax - head.colMin + 1);
+    }
+    head.indexOffset = sizeof(ScanStoreHeader);
+    const std::uint64_t indexBytes = std::uint64_t(head.indexRows) * head.indexCols * sizeof(std::uint32_t);
+    head.recordsOffset = (head.indexOffset + indexBytes + 63) & ~std::uint64_t(63);
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return fail("open");
+    // The index starts out all zeros, and sparse
+    if (::ftruncate(fd, off_t(head.recordsOffset)) != 0 || !writeAt(fd, &head, sizeof(head), 0))
+        return fail("write header");
+    return true;
+}
+
+bool ScanStoreWriter::resume(const std::string &path)
+{
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return fail("open");
+    if (::pread(fd, &head, sizeof(head), 0) != ssize_t(sizeof(head))
+        || std::memcmp(head.magic, ScanStoreMagic, sizeof(head.magic)) != 0 || head.version != ScanStoreVersion
+        || head.headerSize != sizeof(ScanStoreHeader) || head.recordSize != sizeof(ScanRecord)) {
+        close();
+        lastError = "not a scan result file, or another version";
+        return false;
+    }
+    head.flags &= ScanStorePath | ScanStoreGated;
+    if (!writeAt(fd, &head, sizeof(head), 0))
+        return fail("write header");
+    return true;
+}
+
+bool ScanStoreWriter::put(const ScanRecord &rec)
+{
+    if (fd < 0)
+        return false;
+    if (!writeAt(fd, &rec, sizeof(rec), head.recordsOffset + std::uint64_t(rec.n) * sizeof(ScanRecord)))
+        return fail("write record");
+    const long r = long(rec.row) - head.rowMin;
+    const long c = long(rec.col) - head.colMin;
+    if (rec.row >= 0 && r >= 0 && c >= 0 && r < long(head.indexRows) && c < long(head.indexCols)) {
+        const std::uint32_t entry = rec.n + 1;
+        const std::uint64_t at = head.indexOffset + (std::uint64_t(r) * head.indexCols + std::uint64_t(c)) * sizeof(entry);
+        if (!writeAt(fd, &entry, sizeof(entry), at))
+            return fail("write index");
+    }
+    return true;
+}
+
+bool ScanStoreWriter::get(std::uint32_t n, ScanRecord &rec) const
+{
+    if (fd < 0)
+        return false;
+    ssize_t got = ::pread(fd, &rec, sizeof(rec), off_t(head.recordsOffset + std::uint64_t(n) * sizeof(ScanRecord)));
+    return got == ssize_t(sizeof(rec)) && rec.status != 0;
+}
+
+void ScanStoreWriter::finish(std::uint32_t endFlags, double driftPpm)
+{
+    if (fd < 0)
+        return;
+    head.flags |= endFlags & (ScanStoreDone | ScanStoreStopped);
+    head.driftPpm = driftPpm;
+    if (!writeAt(fd, &head, sizeof(head), 0))
+        fail("write header");
+    close();
+}
+
+void ScanStoreWriter::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+bool ScanStoreWriter::fail(const char *what)
+{
+    lastError = std::string(what) + ": " + std::strerror(errno);
+    close();
+    return false;
+}
+
+ScanStoreReader::~ScanStoreReader()
+{
+    close();
+}
+
+bool ScanStoreReader::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        lastError = std::string("open: ") + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && std::size_t(st.st_size) >= sizeof(ScanStoreHeader))
+        map = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping stays
+    if (map == MAP_FAILED) {
+        lastError = "not a scan result file";
+        return false;
+    }
+    base = static_cast<const unsigned char *>(map);
+    length = std::size_t(st.st_size);
+
+    const ScanStoreHeader &h = header();
+    const std::uint64_t indexBytes = std::uint64_t(h.indexRows) * h.indexCols * sizeof(std::uint32_t);
+    if (std::memcmp(h.magic, ScanStoreMagic, sizeof(h.magic)) != 0 || h.version != ScanStoreVersion
+        || h.headerSize != sizeof(ScanStoreHeader) || h.recordSize != sizeof(ScanRecord)
+        || h.indexOffset + indexBytes > h.recordsOffset || h.recordsOffset > length || h.recordsOffset % 8 != 0) {
+        close();
+        lastError = "not a scan result file, or another version";
+        return false;
+    }
+    index = reinterpret_cast<const std::uint32_t *>(base + h.indexOffset);
+    records = reinterpret_cast<const ScanRecord *>(base + h.recordsOffset);
+    count = (length - h.recordsOffset) / sizeof(ScanRecord); // a record half written is left out
+    return true;
+}
+
+void ScanStoreReader::close()
+{
+    if (base)
+        ::munmap(const_cast<unsigned char *>(base), length);
+    base = nullptr;
+    length = 0;
+    index = nullptr;
+    records = nullptr;
+    count = 0;
+}
+
+const ScanRecord *ScanStoreReader::find(int row, int col) const
+{
+    if (!base)
+        return nullptr;
+    const ScanStoreHeader &h = header();
+    const long r = long(row) - h.rowMin;
+    const long c = long(col) - h.colMin;
+    if (r < 0 || c < 0 || r >= long(h.indexRows) || c >= long(h.indexCols))
+        return nullptr;
+    const std::uint32_t entry = index[std::size_t(r) * h.indexCols + std::size_t(c)];
+    if (entry == 0 || entry > count || records[entry - 1].status == 0)
+        return nullptr;
+    return &records[entry - 1];
+}
@@ -0,0 +1,158 @@
+#ifndef SCAN_STORE_H
+#define SCAN_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "motion_profile.h"
+
+// Result file of one scan or path, written as it runs and memory-mapped for
+// reading. Fixed-size parts, native byte order (x86 and the GUI only):
+//   ScanStoreHeader   run parameters and the firmware configuration
+//   uint32 index[indexRows * indexCols]   record + 1 of each cell of the box, 0 if not scanned
+//   ScanRecord[]      record n is SCAN_INDEX n, so the file only ever grows at its end
+// A record is written at its SCAN_INDEX and completed at its POINT_TIME. The
+// header is rewritten once more when the run ends; a file still without an
+// end flag was cut short (GUI closed or crashed), its records up to there are good.
+
+constexpr char ScanStoreMagic[8] = {'U', 'C', 'N', 'S', 'C', 'A', 'N', '\0'};
+constexpr std::uint32_t ScanStoreVersion = 1;
+
+// ScanStoreHeader::flags
+constexpr std::uint32_t ScanStorePath = 1;    // a path; rows and cols are its waypoints' cells, if any
+constexpr std::uint32_t ScanStoreGated = 2;   // paced by the DAQ
+constexpr std::uint32_t ScanStoreDone = 4;    // ended with SCAN_DONE
+constexpr std::uint32_t ScanStoreStopped = 8; // ended by a stop
+
+struct ScanStoreHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+    std::uint32_t headerSize; // sizeof(ScanStoreHeader)
+    std::uint32_t recordSize; // sizeof(ScanRecord)
+    std::uint64_t indexOffset; // from the start of the file
+    std::uint64_t recordsOffset;
+    std::int64_t startEpochUs;
+
+    // The run
+    double spacing; // cm, 0 for a path off the grid
+    double timing;  // dwell per point, s
+    std::int32_t rowMin; // the box, also what the index covers
+    std::int32_t rowMax;
+    std::int32_t colMin;
+    std::int32_t colMax;
+    std::uint32_t indexRows; // 0: no index
+    std::uint32_t indexCols;
+    std::int32_t order; // SCAN_ORDER_* | SCAN_FROM_*, -1 for a path
+    std::int32_t linkBaud;
+    std::uint32_t plannedPoints;
+    std::uint32_t maskRuns;
+
+    // Firmware configuration
+    float usteps;
+    float stepsPerCmX;
+    float stepsPerCmY;
+    float startRpm;
+    AxisLimits limitsX;
+    AxisLimits limitsY;
+
+    double driftPpm; // the Arduino's clock against the host's, when the run ended
+    char reserved[104];
+};
+
+// ScanRecord::status
+constexpr std::uint32_t ScanRecordIndexed = 1; // its SCAN_INDEX came
+constexpr std::uint32_t ScanRecordTimed = 2;   // and its POINT_TIME: the times and steps below are set
+
+struct ScanRecord
+{
+    std::uint32_t n;
+    std::int16_t row; // -1 for a waypoint off the grid
+    std::int16_t col;
+    float xCm; // commanded
+    float yCm;
+    std::int32_t xCmdSteps; // commanded, usteps from (0,0)
+    std::int32_t yCmdSteps;
+    std::int32_t xSteps; // as stepped, at rest
+    std::int32_t ySteps;
+    std::uint32_t status; // ScanRecord* flags, 0 for a hole
+    float liveS;          // trigger to dwell end
+    std::int64_t indexUs; // epoch us: SCAN_INDEX read
+    std::int64_t moveStartUs; // epoch us on the host clock, from the Arduino's micros()
+    std::int64_t moveEndUs;
+    std::int64_t triggerUs;
+    std::int64_t dwellEndUs;
+};
+
+static_assert(sizeof(ScanStoreHeader) == 256, "ScanStoreHeader layout");
+static_assert(sizeof(ScanRecord) == 80, "ScanRecord layout");
+
+// Writes a run's file with one pwrite per record (and one per index entry);
+// nothing is buffered, so what is on disk is always readable
+class ScanStoreWriter
+{
+public:
+    ScanStoreWriter() = default;
+    ScanStoreWriter(const ScanStoreWriter &) = delete;
+    ScanStoreWriter &operator=(const ScanStoreWriter &) = delete;
+    ~ScanStoreWriter();
+
+    // Creates path; header needs the run and configuration filled in, the
+    // layout fields are set here. Ends any run still open, without an end flag.
+    bool open(const std::string &path, const ScanStoreHeader &header);
+    // Reopens a file open() wrote, to add the rest of a run that was cut
+    // short; records keep their n. Its end flag is cleared until finish().
+    bool resume(const std::string &path);
+    bool isOpen() const { return fd >= 0; }
+    const std::string &error() const { return lastError; }
+
+    // Record rec.n, new or replacing what was there
+    bool put(const ScanRecord &rec);
+    bool get(std::uint32_t n, ScanRecord &rec) const;
+
+    // endFlags: ScanStoreDone or ScanStoreStopped
+    void finish(std::uint32_t endFlags, double driftPpm);
+
+private:
+    void close();
+    bool fail(const char *what);
+
+    int fd = -1;
+    ScanStoreHeader head = {};
+    std::string lastError;
+};
+
+// Maps a result file read-only; opening costs the same for a million records
+// as for ten. A file still being written shows the records it had when opened.
+class ScanStoreReader
+{
+public:
+    ScanStoreReader() = default;
+    ScanStoreReader(const ScanStoreReader &) = delete;
+    ScanStoreReader &operator=(const ScanStoreReader &) = delete;
+    ~ScanStoreReader();
+
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const { return base != nullptr; }
+    const std::string &error() const { return lastError; }
+
+    const ScanStoreHeader &header() const { return *reinterpret_cast<const ScanStoreHeader *>(base); }
+    std::size_t size() const { return count; } // records, holes included
+    const ScanRecord &operator[](std::size_t n) const { return records[n]; }
+
+    // The record of a cell of the box, null if it was not scanned
+    const ScanRecord *find(int row, int col) const;
+
+private:
+    const unsigned char *base = nullptr;
+    std::size_t length = 0;
+    const std::uint32_t *index = nullptr;
+    const ScanRecord *records = nullptr;
+    std::size_t count = 0;
+    std::string lastError;
+};
+
+#endif // SCAN_STORE_H
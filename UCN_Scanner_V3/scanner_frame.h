@@ -0,0 +1,45 @@
+#ifndef SCANNER_FRAME_H
+#define SCANNER_FRAME_H
+
+#include <chrono>
+#include <cstdint>
+
+// Kinds of messages the Arduino sends back (see stepper_control_GUI_Ver2.ino)
+enum class FrameType : std::uint8_t {
+    Text,       // plain line printed outside of <...> markers
+    Echo,       // command acknowledgement: "Received: <...>" echo, or PKT_ACK on the binary link
+    ScanIndex,  // <SCAN_INDEX,i,j,n>, n = point number in the scan order
+    ScanDone,   // <SCAN_DONE>
+    Debug,      // <DEBUG,...>
+    Position,   // <X><Y> pair in usteps, sent after a stop
+    StopStatus, // '9' if a scan was stopped, '0' if none was running
+    Credit,     // <CREDIT,n> path flow control, consumed by SerialWorker
+    PointTime,  // <POINT_TIME,n,...>, the micros() stamps of point n
+    Id,         // <ID,UCN_SCANNER,version,ready>, version in point, status '1' if ready, '0' if READY is to follow
+    Ready       // <READY,n> after a reset, status '1' if it took its position from EEPROM, '0' if it homed
+};
+
+// Host clock for SerialFrame::hostUs: monotonic, in us
+inline std::int64_t hostMicros()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// One parsed message, copied by value from the serial thread to the UI.
+// Fixed size on purpose so the hand-off never touches the heap.
+struct SerialFrame {
+    FrameType type = FrameType::Text;
+    int row = 0;
+    int col = 0;
+    int point = -1; // ScanIndex: position in the scan order, -1 from firmware that does not send it; Id: version
+    double x = 0.0; // Position, PointTime: usteps from (0,0)
+    double y = 0.0;
+    char status = 0;
+    std::uint8_t seq = 0; // binary link only: host seq acknowledged by an Echo
+    std::uint32_t us[4] = {}; // PointTime: move start, move end, trigger, dwell end (PointTimePacket)
+    std::int64_t hostUs = 0;  // hostMicros() when the bytes that completed it were read
+    char text[96] = {}; // raw message, truncated, for logging only
+};
+
+#endif // SCANNER_FRAME_H
@@ -0,0 +1,529 @@
+#include "serial_worker.h"
+#include <QtDebug>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+namespace {
+const int negotiateTimeoutMs = 2000;
+const int identifyRetryMs = 1000;
+const int discoverTimeoutMs = 5000; // bootloader and setup() of a board the open reset, with room to spare
+const char identifyCommand[] = "<I,0,0>";
+}
+
+SerialWorker::SerialWorker(QObject *parent) :
+    QObject(parent)
+{
+}
+
+SerialWorker::~SerialWorker()
+{
+    closePort();
+}
+
+bool SerialWorker::takeFrame(SerialFrame &out)
+{
+    return frames.pop(out);
+}
+
+void SerialWorker::rearmNotify()
+{
+    // Clear before draining: anything pushed after this point triggers a fresh framesReady()
+    notifyPending.store(false, std::memory_order_release);
+}
+
+void SerialWorker::openPort(const QString &name, qint32 baudRate)
+{
+    endProbes(nullptr);
+    attachPort(newPort(name, baudRate));
+    bool ok = port->open(QIODevice::ReadWrite);
+    emit portOpened(ok, ok ? QString() : port->errorString());
+}
+
+void SerialWorker::discoverPort(const QStringList &names)
+{
+    endProbes(nullptr);
+    if (port && port->isOpen())
+        port->close();
+
+    QStringList errors;
+    for (const QString &name : names) {
+        auto probe = std::make_unique<Probe>();
+        probe->port = newPort(name, PROTO_ASCII_BAUD);
+        if (!probe->port->open(QIODevice::ReadWrite)) {
+            errors << name + ": " + probe->port->errorString();
+            delete probe->port;
+            continue;
+        }
+        Probe *p = probe.get();
+        connect(p->port, &QSerialPort::readyRead, this, [this, p] { readProbe(p); });
+        p->port->write(identifyCommand);
+        probes.push_back(std::move(probe));
+    }
+    if (probes.empty()) {
+        emit portOpened(false, names.isEmpty() ? QString("No serial ports to try") : errors.join("; "));
+        return;
+    }
+
+    if (!probeTimer) {
+        probeTimer = new QTimer(this);
+        connect(probeTimer, &QTimer::timeout, this, &SerialWorker::onProbeTimeout);
+    }
+    probeNames = names;
+    probeRounds = 0;
+    probeTimer->start(identifyRetryMs);
+}
+
+void SerialWorker::onProbeTimeout()
+{
+    if (++probeRounds * identifyRetryMs >= discoverTimeoutMs) {
+        endProbes(nullptr);
+        emit portOpened(false, "No scanner answered on " + probeNames.join(", "));
+        return;
+    }
+    // The first one went to a bootloader, or to nothing yet; a board that
+    // talks is starting up and sends its ID unasked
+    for (const auto &probe : probes) {
+        if (!probe->heard)
+            probe->port->write(identifyCommand);
+    }
+}
+
+void SerialWorker::readProbe(Probe *probe)
+{
+    const QString name = probe->port->portName();
+    bool found = false;
+    char chunk[512];
+    qint64 n;
+    while (!found && (n = probe->port->read(chunk, sizeof(chunk))) > 0) {
+        readUs = hostMicros();
+        probe->heard = true;
+        probe->parser.feed(chunk, std::size_t(n), [&](const FrameView &view) {
+            if (!found && view.type == FrameType::Id) {
+                // Announced ahead of the ID so the UI has the port open when it reads it
+                found = true;
+                emit portDiscovered(name);
+                emit portOpened(true, QString());
+            }
+            if (found)
+                publish(view);
+        });
+    }
+    if (!found)
+        return;
+
+    // Keep this port, with what the parser holds of a frame cut off at the chunk's end
+    QSerialPort *kept = probe->port;
+    const FrameParser state = probe->parser;
+    disconnect(kept, &QSerialPort::readyRead, this, nullptr);
+    endProbes(probe);
+    attachPort(kept);
+    parser = state;
+    if (kept->bytesAvailable() > 0)
+        onReadyRead();
+}
+
+void SerialWorker::endProbes(Probe *keep)
+{
+    if (probeTimer)
+        probeTimer->stop();
+    for (const auto &probe : probes) {
+        if (probe.get() == keep)
+            continue;
+        probe->port->close();
+        probe->port->deleteLater();
+    }
+    probes.clear();
+}
+
+QSerialPort *SerialWorker::newPort(const QString &name, qint32 baudRate)
+{
+    // Created here so the port belongs to the serial thread
+    QSerialPort *p = new QSerialPort(this);
+    p->setPortName(name);
+    p->setBaudRate(baudRate);
+    p->setFlowControl(QSerialPort::NoFlowControl);
+    p->setParity(QSerialPort::NoParity);
+    p->setDataBits(QSerialPort::Data8);
+    p->setStopBits(QSerialPort::OneStop);
+    return p;
+}
+
+void SerialWorker::attachPort(QSerialPort *p)
+{
+    if (!negotiateTimer) {
+        negotiateTimer = new QTimer(this);
+        negotiateTimer->setSingleShot(true);
+        connect(negotiateTimer, &QTimer::timeout, this, &SerialWorker::onNegotiateTimeout);
+    }
+    delete port; // closes it
+    port = p;
+    connect(port, &QSerialPort::readyRead, this, &SerialWorker::onReadyRead);
+    connect(port, &QSerialPort::bytesWritten, this, &SerialWorker::onBytesWritten);
+    connect(port, &QSerialPort::errorOccurred, this, &SerialWorker::onErrorOccurred);
+    resetLink();
+}
+
+void SerialWorker::resetLink()
+{
+    txQueue.clear();
+    txInFlight = 0;
+    pathQueue.clear();
+    pathCredits = 0;
+    parser.reset();
+    decoder.reset();
+    binaryMode = false;
+    if (negotiateTimer)
+        negotiateTimer->stop();
+    negotiating = false;
+    haveRxSeq = false;
+}
+
+void SerialWorker::closePort()
+{
+    endProbes(nullptr);
+    txQueue.clear();
+    txInFlight = 0;
+    pathQueue.clear();
+    pathCredits = 0;
+    if (negotiateTimer)
+        negotiateTimer->stop();
+    negotiating = false;
+    if (port && port->isOpen())
+        port->close();
+}
+
+void SerialWorker::negotiateLink(qint32 baudRate)
+{
+    if (!port || !port->isOpen() || negotiating)
+        return;
+
+    bool wantBinary = baudRate != PROTO_ASCII_BAUD;
+    if (wantBinary == binaryMode && port->baudRate() == baudRate) {
+        emit linkChanged(binaryMode, baudRate);
+        return;
+    }
+
+    // Goes out ahead of anything queued; the queue is held until the reply or the timeout
+    negotiating = true;
+    negotiateBaud = baudRate;
+    negotiateSeq = txSeq;
+    CmdPacket request = {'B', float(baudRate), 0.0f};
+    QByteArray packet = binaryMode
+            ? encode(PKT_CMD, &request, sizeof(request))
+            : QString("<B,%1,0>").arg(baudRate).toUtf8();
+    qint64 written = port->write(packet);
+    if (written > 0)
+        txInFlight += written;
+    negotiateTimer->start(negotiateTimeoutMs);
+}
+
+void SerialWorker::onNegotiateTimeout()
+{
+    negotiating = false;
+    qDebug() << "No reply to link request, keeping" << (binaryMode ? "binary" : "ASCII") << "link.";
+    emit linkChanged(binaryMode, port->baudRate());
+    writeNext();
+}
+
+void SerialWorker::switchLink(qint32 baudRate)
+{
+    negotiateTimer->stop();
+    negotiating = false;
+    port->setBaudRate(baudRate);
+    binaryMode = baudRate != PROTO_ASCII_BAUD;
+    parser.reset();
+    decoder.reset();
+    haveRxSeq = false;
+    emit linkChanged(binaryMode, baudRate);
+    writeNext();
+}
+
+QByteArray SerialWorker::encode(std::uint8_t type, const void *payload, std::uint8_t len)
+{
+    char buf[MaxPacketSize];
+    std::size_t n = encodePacket(type, txSeq++, payload, len, buf);
+    return QByteArray(buf, int(n));
+}
+
+void SerialWorker::sendCommand(char cmd, float val1, float val2)
+{
+    if (cmd == '6') {
+        // The Arduino drops the path on a stop, so do the rest of it here
+        pathQueue.clear();
+        pathCredits = 0;
+    }
+    if (binaryMode) {
+        CmdPacket packet = {cmd, val1, val2};
+        send(encode(PKT_CMD, &packet, sizeof(packet)));
+        return;
+    }
+    QString valStr = QString::number(val1, 'f', 3);
+    QString valStr2 = QString::number(val2, 'f', 3);
+    send(QString("<%1,%2,%3>").arg(cmd).arg(valStr).arg(valStr2).toUtf8());
+}
+
+void SerialWorker::sendScan(const ScanPacket &scan)
+{
+    if (binaryMode) {
+        send(encode(PKT_SCAN, &scan, sizeof(scan)));
+        return;
+    }
+    send(QString("<5,%1,%2,%3,%4,%5,%6,%7>")
+             .arg(scan.spacing, 0, 'f', 3)
+             .arg(scan.timing, 0, 'f', 3)
+             .arg(scan.rowMin)
+             .arg(scan.rowMax)
+             .arg(scan.colMin)
+             .arg(scan.colMax)
+             .arg(scan.order)
+             .toUtf8());
+}
+
+void SerialWorker::sendMask(const QVector<MaskRun> &mask)
+{
+    // Replaces whatever mask the Arduino holds, see scanner_protocol.h
+    if (binaryMode) {
+        const MaskRun clear = {-1, 0, 0};
+        send(encode(PKT_MASK, &clear, sizeof(clear)));
+        for (int i = 0; i < mask.size(); i += MASK_RUNS_PER_PACKET) {
+            int n = std::min<int>(MASK_RUNS_PER_PACKET, mask.size() - i);
+            send(encode(PKT_MASK, mask.constData() + i, std::uint8_t(n * sizeof(MaskRun))));
+        }
+        return;
+    }
+    send(QByteArray("<M,-1>"));
+    for (int i = 0; i < mask.size();) {
+        const int row = mask[i].row;
+        QString line = QString("<M,%1").arg(row);
+        for (int n = 0; i < mask.size() && mask[i].row == row && n < MASK_SPANS_PER_LINE; ++i, ++n)
+            line += QString(",%1,%2").arg(mask[i].col).arg(mask[i].len);
+        send((line + ">").toUtf8());
+    }
+}
+
+void SerialWorker::sendPath(const QVector<WaypointPacket> &path)
+{
+    // Waypoints go out as credits come in, see addCredits()
+    pathQueue.clear();
+    for (const WaypointPacket &w : path)
+        pathQueue.enqueue(w);
+    pathCredits = 0;
+    sendCommand('P', float(path.size()), 0.0f);
+}
+
+void SerialWorker::addCredits(int credits)
+{
+    pathCredits += credits;
+    sendWaypoints();
+}
+
+void SerialWorker::sendWaypoints()
+{
+    while (pathCredits > 0 && !pathQueue.isEmpty()) {
+        const WaypointPacket w = pathQueue.dequeue();
+        --pathCredits;
+        if (binaryMode) {
+            send(encode(PKT_WAYPOINT, &w, sizeof(w)));
+            continue;
+        }
+        send(waypointLine(w));
+    }
+}
+
+QByteArray SerialWorker::waypointLine(const WaypointPacket &w)
+{
+    return QString("<W,%1,%2,%3,%4,%5>")
+            .arg(w.x, 0, 'f', 3)
+            .arg(w.y, 0, 'f', 3)
+            .arg(w.dwell, 0, 'f', 2)
+            .arg(w.row)
+            .arg(w.col)
+            .toUtf8();
+}
+
+void SerialWorker::send(const QByteArray &packet)
+{
+    txQueue.enqueue(packet);
+    if (txInFlight == 0)
+        writeNext();
+}
+
+void SerialWorker::writeNext()
+{
+    if (!port || !port->isOpen() || negotiating || txQueue.isEmpty())
+        return;
+
+    const QByteArray packet = txQueue.dequeue();
+    qint64 written = port->write(packet);
+    if (written == -1) {
+        emit portError(port->errorString());
+        return;
+    }
+    txInFlight = written;
+}
+
+void SerialWorker::onBytesWritten(qint64 bytes)
+{
+    txInFlight -= bytes;
+    if (txInFlight <= 0) {
+        txInFlight = 0;
+        writeNext();
+    }
+}
+
+void SerialWorker::onErrorOccurred(QSerialPort::SerialPortError error)
+{
+    if (error == QSerialPort::NoError)
+        return;
+    emit portError(port->errorString());
+}
+
+void SerialWorker::onReadyRead()
+{
+    // Read into a stack buffer and parse in place, readAll() would allocate per call
+    char chunk[512];
+    qint64 n;
+    while ((n = port->read(chunk, sizeof(chunk))) > 0) {
+        readUs = hostMicros();
+        if (binaryMode) {
+            decoder.feed(chunk, std::size_t(n), [this](const PacketView &packet) {
+                publish(packet);
+            });
+        } else {
+            parser.feed(chunk, std::size_t(n), [this](const FrameView &view) {
+                publish(view);
+            });
+        }
+    }
+}
+
+void SerialWorker::publish(const FrameView &view)
+{
+    if (view.type == FrameType::Credit) {
+        addCredits(view.credits);
+        return;
+    }
+
+    SerialFrame frame;
+    frame.hostUs = readUs;
+    frame.type = view.type;
+    frame.row = view.row;
+    frame.col = view.col;
+    frame.point = view.point;
+    frame.x = view.x;
+    frame.y = view.y;
+    frame.status = view.status;
+    std::copy(std::begin(view.us), std::end(view.us), frame.us);
+    std::memcpy(frame.text, view.body.data(), std::min(view.body.size(), sizeof(frame.text) - 1));
+    publish(frame);
+
+    // <LINK,baud> answers <B,baud,0>; the Arduino has already switched
+    if (negotiating && view.type == FrameType::Echo && view.body.substr(0, 5) == "LINK,") {
+        bool ok = false;
+        qint32 baud = QByteArray(view.body.data() + 5, int(view.body.size() - 5)).toInt(&ok);
+        if (ok && baud == negotiateBaud)
+            switchLink(baud);
+    }
+}
+
+void SerialWorker::publish(const PacketView &packet)
+{
+    if (haveRxSeq && packet.seq != rxSeq)
+        qWarning() << "Binary link lost" << int(std::uint8_t(packet.seq - rxSeq)) << "packet(s) from the Arduino";
+    rxSeq = std::uint8_t(packet.seq + 1);
+    haveRxSeq = true;
+
+    SerialFrame frame;
+    frame.hostUs = readUs;
+    switch (packet.type) {
+    case PKT_ACK: {
+        AckPacket ack;
+        if (packet.len < sizeof(ack))
+            return;
+        std::memcpy(&ack, packet.payload, sizeof(ack));
+        frame.type = FrameType::Echo;
+        frame.seq = ack.seq;
+        std::snprintf(frame.text, sizeof(frame.text), "ACK %u", unsigned(ack.seq));
+        publish(frame);
+        if (negotiating && ack.seq == negotiateSeq)
+            switchLink(negotiateBaud);
+        return;
+    }
+    case PKT_SCAN_INDEX: {
+        ScanIndexPacket index;
+        if (packet.len < sizeof(index))
+            return;
+        std::memcpy(&index, packet.payload, sizeof(index));
+        frame.type = FrameType::ScanIndex;
+        frame.row = index.row;
+        frame.col = index.col;
+        frame.point = int(index.point);
+        break;
+    }
+    case PKT_SCAN_DONE:
+        frame.type = FrameType::ScanDone;
+        break;
+    case PKT_POSITION: {
+        PositionPacket pos;
+        if (packet.len < sizeof(pos))
+            return;
+        std::memcpy(&pos, packet.payload, sizeof(pos));
+        frame.type = FrameType::Position;
+        frame.x = pos.x;
+        frame.y = pos.y;
+        break;
+    }
+    case PKT_STOP_STATUS: {
+        StopStatusPacket stop;
+        if (packet.len < sizeof(stop))
+            return;
+        std::memcpy(&stop, packet.payload, sizeof(stop));
+        frame.type = FrameType::StopStatus;
+        frame.status = stop.status;
+        break;
+    }
+    case PKT_CREDIT: {
+        CreditPacket credit;
+        if (packet.len < sizeof(credit))
+            return;
+        std::memcpy(&credit, packet.payload, sizeof(credit));
+        addCredits(credit.credits);
+        return;
+    }
+    case PKT_POINT_TIME: {
+        PointTimePacket time;
+        if (packet.len < sizeof(time))
+            return;
+        std::memcpy(&time, packet.payload, sizeof(time));
+        frame.type = FrameType::PointTime;
+        frame.point = int(time.point);
+        frame.us[0] = time.moveStartUs;
+        frame.us[1] = time.moveEndUs;
+        frame.us[2] = time.triggerUs;
+        frame.us[3] = time.dwellEndUs;
+        frame.x = time.x;
+        frame.y = time.y;
+        break;
+    }
+    case PKT_TEXT:
+        frame.type = FrameType::Text;
+        std::memcpy(frame.text, packet.payload, std::min<std::size_t>(packet.len, sizeof(frame.text) - 1));
+        break;
+    default:
+        qWarning() << "Unknown packet type" << packet.type << "on the binary link";
+        return;
+    }
+    publish(frame);
+}
+
+void SerialWorker::publish(const SerialFrame &frame)
+{
+    if (!frames.push(frame)) {
+        qWarning() << "Serial frame queue full, dropping frame:" << frame.text;
+        return;
+    }
+    if (!notifyPending.exchange(true, std::memory_order_acq_rel))
+        emit framesReady();
+}
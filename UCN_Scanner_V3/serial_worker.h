@@ -0,0 +1,136 @@
+#ifndef SERIAL_WORKER_H
+#define SERIAL_WORKER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QQueue>
+#include <QSerialPort>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "binary_link.h"
+#include "frame_parser.h"
+#include "scanner_frame.h"
+#include "spsc_queue.h"
+
+Q_DECLARE_METATYPE(ScanPacket)
+Q_DECLARE_METATYPE(QVector<WaypointPacket>)
+Q_DECLARE_METATYPE(QVector<MaskRun>)
+
+// Owns the Arduino serial port and lives on its own QThread.
+// Everything is driven by readyRead/bytesWritten, nothing here ever waits on the port.
+// Parsed frames go to the UI through a lock-free queue; framesReady() is emitted
+// once per batch so a burst of SCAN_INDEX lines costs the UI one queued event.
+//
+// discoverPort() opens every candidate at once and keeps the first one the
+// scanner firmware identifies itself on (its ID at power-up, or the answer to
+// <I,0,0>), see scanner_protocol.h.
+//
+// The link starts as ASCII at 9600 baud. negotiateLink() asks the Arduino for the
+// binary link of scanner_protocol.h; if it does not answer, ASCII stays in use.
+//
+// sendPath() streams a waypoint path: one waypoint per credit from the Arduino,
+// so its queue and RX buffer never overflow. A stop ('6') drops what is left.
+class SerialWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SerialWorker(QObject *parent = nullptr);
+    ~SerialWorker();
+
+    // Called from the UI thread only
+    bool takeFrame(SerialFrame &out);
+    void rearmNotify();
+
+    // A waypoint as sendPath() sends it on the ASCII link; longer than
+    // PATH_RX_LINE_MAX it would not fit the Arduino's RX buffer
+    static QByteArray waypointLine(const WaypointPacket &w);
+
+public slots:
+    void openPort(const QString &name, qint32 baudRate);
+    void discoverPort(const QStringList &names);
+    void closePort();
+    void negotiateLink(qint32 baudRate);
+    void sendCommand(char cmd, float val1, float val2);
+    void sendScan(const ScanPacket &scan);
+    void sendMask(const QVector<MaskRun> &mask);
+    void sendPath(const QVector<WaypointPacket> &path);
+
+signals:
+    void portOpened(bool ok, const QString &error);
+    void portDiscovered(const QString &name);
+    void portError(const QString &error);
+    void framesReady();
+    void linkChanged(bool binary, qint32 baudRate);
+
+private slots:
+    void onReadyRead();
+    void onBytesWritten(qint64 bytes);
+    void onErrorOccurred(QSerialPort::SerialPortError error);
+    void onNegotiateTimeout();
+    void onProbeTimeout();
+
+private:
+    struct Probe {
+        QSerialPort *port = nullptr;
+        FrameParser parser;
+        bool heard = false; // anything came back, ID or not
+    };
+
+    void attachPort(QSerialPort *p);
+    void resetLink();
+    QSerialPort *newPort(const QString &name, qint32 baudRate);
+    void readProbe(Probe *probe);
+    void endProbes(Probe *keep);
+
+    void publish(const FrameView &view);
+    void publish(const PacketView &packet);
+    void publish(const SerialFrame &frame);
+    void send(const QByteArray &packet);
+    void writeNext();
+    void switchLink(qint32 baudRate);
+    void addCredits(int credits);
+    void sendWaypoints();
+    QByteArray encode(std::uint8_t type, const void *payload, std::uint8_t len);
+
+    QSerialPort *port = nullptr;
+
+    // Ports being probed by discoverPort()
+    std::vector<std::unique_ptr<Probe>> probes;
+    QStringList probeNames;
+    QTimer *probeTimer = nullptr;
+    int probeRounds = 0;
+
+    FrameParser parser;
+    PacketDecoder decoder;
+    std::int64_t readUs = 0; // hostMicros() of the chunk being parsed, stamped on its frames
+
+    // Binary link state
+    bool binaryMode = false;
+    std::uint8_t txSeq = 0;
+    std::uint8_t rxSeq = 0;
+    bool haveRxSeq = false;
+    bool negotiating = false;
+    qint32 negotiateBaud = 0;
+    std::uint8_t negotiateSeq = 0;
+    QTimer *negotiateTimer = nullptr;
+
+    // Transmit side: one packet on the wire at a time so the 64 byte Arduino RX buffer is never flooded
+    QQueue<QByteArray> txQueue;
+    qint64 txInFlight = 0;
+
+    // Path waypoints not sent yet, and what the Arduino has room for
+    QQueue<WaypointPacket> pathQueue;
+    int pathCredits = 0;
+
+    SpscQueue<SerialFrame, 1024> frames;
+    std::atomic<bool> notifyPending{false};
+};
+
+#endif // SERIAL_WORKER_H
@@ -0,0 +1,48 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer / single-consumer queue.
+// One thread may push() and one other thread may pop(), without locks.
+// N must be a power of two; one slot is kept free to tell full from empty.
+template <typename T, std::size_t N>
+class SpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    bool push(const T &value)
+    {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        const std::size_t next = (head + 1) & (N - 1);
+        if (next == tail_.load(std::memory_order_acquire))
+            return false; // full
+        slots_[head] = value;
+        head_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &out)
+    {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return false; // empty
+        out = slots_[tail];
+        tail_.store((tail + 1) & (N - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+private:
+    T slots_[N];
+    alignas(64) std::atomic<std::size_t> head_{0}; // written by producer
+    alignas(64) std::atomic<std::size_t> tail_{0}; // written by consumer
+};
+
+#endif // SPSC_QUEUE_H
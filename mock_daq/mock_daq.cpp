@@ -0,0 +1,301 @@
+// Mock DAQ: serves the GUI's DAQ handshake (UCN_Scanner_V3/daq_client.h) on a
+// TCP port, so gated scans can be run and timed without the SIS3316 and its
+// readout. Runs and acquisition windows behave like the real ones from the
+// outside: a run takes a while to start, a window closes when its live time
+// is up and reports Poisson counts of a made-up rate map.
+//
+// usage: mock_daq [options]
+//   --port N             TCP port on localhost (default 5555)
+//   --setup-ms N         time from START to STARTED (default 500)
+//   --time-scale F       wall time per simulated time (default 1, 0.01 runs 100x faster)
+//   --hotspot X Y        centre of the rate map in cm (default 30 14)
+//   --peak R             counts/s at the centre, on top of the background (default 200)
+//   --width CM           gaussian sigma of the hotspot (default 4)
+//   --background R       counts/s everywhere (default 5)
+//   --seed N             for the counts (default 1)
+//
+// POSIX only.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+    int port = 5555;
+    double setupMs = 500.0;
+    double timeScale = 1.0;
+    double hotspotX = 30.0;
+    double hotspotY = 14.0;
+    double peak = 200.0;
+    double width = 4.0;
+    double background = 5.0;
+    unsigned seed = 1;
+} opts;
+
+using Clock = std::chrono::steady_clock;
+
+// Simulated ms from now, on the wall clock
+Clock::time_point after(double ms)
+{
+    return Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double, std::milli>(ms * opts.timeScale));
+}
+
+struct Window {
+    long n;
+    double x;
+    double y;
+    double seconds;
+    Clock::time_point due;
+};
+
+struct Client {
+    int fd;
+    std::string in;
+    std::vector<Window> windows;
+};
+
+std::vector<Client> clients;
+std::mt19937 rng;
+
+// One run at a time, owned by the client that started it
+int runOwner = -1; // fd, -1 when no run
+bool runStarting = false;
+Clock::time_point runStartDue;
+long runNumber = 0; // the current run, or the last one
+
+double rateAt(double x, double y)
+{
+    double dx = x - opts.hotspotX;
+    double dy = y - opts.hotspotY;
+    return opts.background + opts.peak * std::exp(-(dx * dx + dy * dy) / (2.0 * opts.width * opts.width));
+}
+
+void reply(Client &c, const std::string &line)
+{
+    std::string out = line + "\n";
+    ssize_t ignored = ::send(c.fd, out.data(), out.size(), MSG_NOSIGNAL);
+    (void)ignored;
+}
+
+void endRun(Client &c)
+{
+    c.windows.clear();
+    runOwner = -1;
+    runStarting = false;
+}
+
+void handleLine(Client &c, const std::string &line)
+{
+    std::istringstream fields(line);
+    std::string verb;
+    fields >> verb;
+    bool owner = runOwner == c.fd;
+
+    if (verb == "CHECK") {
+        if (runOwner < 0)
+            reply(c, "READY");
+        else
+            reply(c, "BUSY run " + std::to_string(runNumber) + " in progress");
+    } else if (verb == "RUN?") {
+        reply(c, "RUN " + std::to_string(runNumber));
+    } else if (verb == "START") {
+        if (runOwner >= 0) {
+            reply(c, "ERROR run " + std::to_string(runNumber) + " in progress");
+            return;
+        }
+        runOwner = c.fd;
+        runStarting = true;
+        runStartDue = after(opts.setupMs);
+        ++runNumber;
+        std::printf("run %ld starting: %s\n", runNumber, line.c_str());
+    } else if (verb == "OPEN") {
+        Window w;
+        if (!(fields >> w.n >> w.x >> w.y >> w.seconds) || w.seconds < 0) {
+            reply(c, "ERROR expected OPEN n x y seconds");
+            return;
+        }
+        if (!owner || runStarting) {
+            reply(c, "ERROR no run");
+            return;
+        }
+        w.due = after(w.seconds * 1000.0);
+        c.windows.push_back(w);
+        reply(c, "OPENED " + std::to_string(w.n));
+    } else if (verb == "STOP") {
+        if (!owner) {
+            reply(c, "ERROR no run");
+            return;
+        }
+        endRun(c);
+        std::printf("run %ld stopped\n", runNumber);
+        reply(c, "STOPPED " + std::to_string(runNumber));
+    } else if (!verb.empty()) {
+        reply(c, "ERROR unknown command " + verb);
+    }
+}
+
+// Replies that were waiting for their time
+void runDue()
+{
+    Clock::time_point now = Clock::now();
+    for (Client &c : clients) {
+        if (runOwner == c.fd && runStarting && runStartDue <= now) {
+            runStarting = false;
+            reply(c, "STARTED " + std::to_string(runNumber));
+        }
+        for (auto w = c.windows.begin(); w != c.windows.end();) {
+            if (w->due > now) {
+                ++w;
+                continue;
+            }
+            double mean = rateAt(w->x, w->y) * w->seconds;
+            long counts = mean > 0.0 ? std::poisson_distribution<long>(mean)(rng) : 0;
+            char line[96];
+            std::snprintf(line, sizeof(line), "CLOSED %ld %ld %.3f", w->n, counts, w->seconds);
+            reply(c, line);
+            w = c.windows.erase(w);
+        }
+    }
+}
+
+// Time until the next due reply, for poll(); -1 if nothing is waiting
+int nextTimeoutMs()
+{
+    bool any = false;
+    Clock::time_point next;
+    auto consider = [&](Clock::time_point t) {
+        if (!any || t < next)
+            next = t;
+        any = true;
+    };
+    if (runOwner >= 0 && runStarting)
+        consider(runStartDue);
+    for (const Client &c : clients)
+        for (const Window &w : c.windows)
+            consider(w.due);
+    if (!any)
+        return -1;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+    return int(std::max<long long>(0, ms + 1));
+}
+
+bool parseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](double &v) {
+            if (i + 1 >= argc)
+                return false;
+            v = std::atof(argv[++i]);
+            return true;
+        };
+        double v = 0.0;
+        if (a == "--port" && value(v))
+            opts.port = int(v);
+        else if (a == "--setup-ms" && value(v))
+            opts.setupMs = v;
+        else if (a == "--time-scale" && value(v) && v > 0.0)
+            opts.timeScale = v;
+        else if (a == "--hotspot" && value(opts.hotspotX) && value(opts.hotspotY))
+            ;
+        else if (a == "--peak" && value(opts.peak))
+            ;
+        else if (a == "--width" && value(v) && v > 0.0)
+            opts.width = v;
+        else if (a == "--background" && value(opts.background))
+            ;
+        else if (a == "--seed" && value(v))
+            opts.seed = unsigned(v);
+        else
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (!parseArgs(argc, argv)) {
+        std::fprintf(stderr, "usage: mock_daq [--port N] [--setup-ms N] [--time-scale F] [--hotspot X Y]\n"
+                             "                [--peak R] [--width CM] [--background R] [--seed N]\n");
+        return 2;
+    }
+    rng.seed(opts.seed);
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    int listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::uint16_t(opts.port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(listenFd, 4) < 0) {
+        std::perror("mock_daq");
+        return 1;
+    }
+    std::printf("mock DAQ on localhost:%d\n", opts.port);
+
+    for (;;) {
+        std::vector<pollfd> fds;
+        fds.push_back(pollfd{listenFd, POLLIN, 0});
+        for (const Client &c : clients)
+            fds.push_back(pollfd{c.fd, POLLIN, 0});
+        ::poll(fds.data(), fds.size(), nextTimeoutMs());
+
+        if (fds[0].revents & POLLIN) {
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                clients.push_back(Client{fd, std::string(), std::vector<Window>()});
+                std::printf("client connected\n");
+            }
+        }
+        for (std::size_t k = 1; k < fds.size(); ++k) {
+            if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            auto c = std::find_if(clients.begin(), clients.end(), [&](const Client &x) { return x.fd == fds[k].fd; });
+            char buf[512];
+            ssize_t n = ::recv(c->fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                // A client that goes away takes its run with it
+                if (runOwner == c->fd) {
+                    endRun(*c);
+                    std::printf("run %ld ended, client gone\n", runNumber);
+                }
+                ::close(c->fd);
+                clients.erase(c);
+                std::printf("client disconnected\n");
+                continue;
+            }
+            c->in.append(buf, std::size_t(n));
+            std::size_t eol;
+            while ((eol = c->in.find('\n')) != std::string::npos) {
+                std::string line = c->in.substr(0, eol);
+                c->in.erase(0, eol + 1);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                handleLine(*c, line);
+            }
+        }
+        runDue();
+    }
+}
@@ -0,0 +1,8 @@
+TEMPLATE = app
+TARGET = mock_daq
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+SOURCES += \
+    mock_daq.cpp
@@ -0,0 +1,205 @@
+/**************************************************************************
+*  Step timing for the sketch's ramped moves. Shared by the sketch and   *
+*  the GUI's scan estimator, which prices moves with the same table, so   *
+*  change it here only.                                                   *
+***************************************************************************/
+
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+#include <math.h>
+#include <stdint.h>
+
+/* A move starts and ends at the sketch's SPEED, which the motors can pull in
+ * from standstill, and ramps to the axis' maximum speed in between. With a
+ * jerk limit the acceleration itself ramps (S-curve), with jerk 0 it steps
+ * (trapezoid). The ramp is sampled every 2^shift steps into a table of step
+ * periods when the limits change; per step the sketch only interpolates it
+ * with integer arithmetic. Deceleration mirrors the ramp from the far end. */
+
+#define RAMP_TABLE_LEN 64
+#define MOTION_DEFAULT_ACCEL 300.0 // RPM/s
+#define MOTION_DEFAULT_JERK 0.0    // RPM/s^2, 0 = trapezoid
+
+struct AxisLimits {
+  float maxRpm;   // cruise speed, at most the start speed if below it
+  float accelRpm; // RPM/s, 0 = no ramp, stay at the start speed
+  float jerkRpm;  // RPM/s^2, 0 = trapezoid
+};
+
+struct RampTable {
+  uint16_t delayUs[RAMP_TABLE_LEN + 1]; // step period at step i << shift; the last entry is cruise
+  uint8_t shift;
+  long steps; // ramp length; steps beyond it cruise
+};
+
+// Both axes of a diagonal move run off one table: the lower of each limit
+inline AxisLimits tighterLimits(const AxisLimits &a, const AxisLimits &b)
+{
+  AxisLimits l;
+  l.maxRpm = a.maxRpm < b.maxRpm ? a.maxRpm : b.maxRpm;
+  l.accelRpm = a.accelRpm < b.accelRpm ? a.accelRpm : b.accelRpm;
+  l.jerkRpm = (a.jerkRpm > 0 && b.jerkRpm > 0) ? (a.jerkRpm < b.jerkRpm ? a.jerkRpm : b.jerkRpm)
+                                              : (a.jerkRpm > 0 ? a.jerkRpm : b.jerkRpm);
+  return l;
+}
+
+inline uint16_t rampPeriodUs(float stepsPerSec)
+{
+  float us = 1000000.0f / stepsPerSec;
+  return us >= 65535.0f ? 65535 : (uint16_t)us;
+}
+
+// stepsPerRev is in usteps
+inline void buildRamp(RampTable &t, float startRpm, const AxisLimits &l, float stepsPerRev)
+{
+  const float v0 = startRpm * stepsPerRev / 60.0f;
+  float v1 = l.maxRpm * stepsPerRev / 60.0f;
+  const float accel = l.accelRpm * stepsPerRev / 60.0f;
+  const float jerk = l.jerkRpm * stepsPerRev / 60.0f;
+  int i = 0;
+
+  t.shift = 0;
+  t.steps = 0;
+  if (v1 > v0 && accel <= 0)
+    v1 = v0;
+  if (v1 <= v0) {
+    for (i = 0; i <= RAMP_TABLE_LEN; i++)
+      t.delayUs[i] = rampPeriodUs(v1);
+    return;
+  }
+
+  // Jerk phase ta at each end, constant acceleration tc in the middle
+  const float dv = v1 - v0;
+  float ta = 0;
+  float tc = dv / accel;
+  float peak = accel;
+  if (jerk > 0) {
+    ta = accel / jerk;
+    if (dv < accel * ta) { // never reaches the acceleration limit
+      ta = sqrt(dv / jerk);
+      peak = jerk * ta;
+    }
+    tc = (dv - peak * ta) / peak;
+  }
+  const float total = 2 * ta + tc;
+
+  // Symmetric acceleration, so the mean speed is halfway
+  t.steps = (long)((v0 + v1) / 2 * total) + 1;
+  while (((long)RAMP_TABLE_LEN << t.shift) < t.steps)
+    t.shift++;
+
+  // Integrate position over time and sample the speed at every table step
+  const int slices = 2048;
+  const float dt = total / slices;
+  float s = 0;
+  float vPrev = v0;
+  int k = 0;
+  t.delayUs[0] = rampPeriodUs(v0);
+  i = 1;
+  for (k = 1; k <= slices && i < RAMP_TABLE_LEN; k++) {
+    float time = k * dt;
+    float v;
+    if (time < ta)
+      v = v0 + jerk * time * time / 2;
+    else if (time < ta + tc)
+      v = v0 + peak * ta / 2 + peak * (time - ta);
+    else if (time < total)
+      v = v1 - jerk * (total - time) * (total - time) / 2;
+    else
+      v = v1;
+    s += (vPrev + v) / 2 * dt;
+    vPrev = v;
+    while (i < RAMP_TABLE_LEN && s >= (float)((long)i << t.shift))
+      t.delayUs[i++] = rampPeriodUs(v);
+  }
+  for (; i <= RAMP_TABLE_LEN; i++)
+    t.delayUs[i] = rampPeriodUs(v1);
+}
+
+// Step period r steps from the nearer end of a move; integer only
+inline uint16_t rampDelay(const RampTable &t, long r)
+{
+  if (r >= t.steps)
+    return t.delayUs[RAMP_TABLE_LEN];
+  long i = r >> t.shift;
+  long f = r & ((1L << t.shift) - 1);
+  uint16_t a = t.delayUs[i];
+  uint16_t b = t.delayUs[i + 1];
+  return (uint16_t)(a - (((long)(a - b) * f) >> t.shift));
+}
+
+/* Transit in coarse steps. Both drivers share the MODE pins, so the
+ * resolution is switched per segment: a long move runs fine until every axis
+ * that moves sits on a coarse step of its driver's indexer (DRV8825: a pulse
+ * off one would only reach the next coarse state), coarse for the bulk, and
+ * fine again for what is left, so it still ends on the exact ustep. Positions
+ * and ramp tables stay in usteps; a coarse pulse takes 1 << COARSE_SHIFT of
+ * them and 1 << COARSE_SHIFT times the table's period. */
+
+#define COARSE_SHIFT 4       // 1/2 steps at 1/32; 5 would be full steps
+#define COARSE_MIN_PULSES 16 // moves with less coarse travel stay fine
+
+struct MovePart {
+  long dx; // usteps
+  long dy;
+  uint8_t shift; // usteps per pulse = 1 << shift
+};
+
+// Splits a move of dx, dy usteps that starts phaseX, phaseY usteps from the
+// indexers' home state into a fine lead-in, the coarse transit and a fine
+// end, or leaves it whole. Returns the number of parts; some may be empty.
+inline int splitMove(long phaseX, long phaseY, long dx, long dy, MovePart part[3])
+{
+  const long c = 1L << COARSE_SHIFT;
+  const long d[2] = { dx, dy };
+  const long phase[2] = { phaseX, phaseY };
+  long head[2];
+  long mid[2];
+  long most = 0; // coarse usteps of the longer axis
+  int a = 0;
+
+  for (a = 0; a < 2; a++) {
+    const long n = d[a] < 0 ? -d[a] : d[a];
+    const long h = (d[a] < 0 ? phase[a] : -phase[a]) & (c - 1); // to the next coarse state
+    if (n < h + c) { // no coarse pulse on this axis, all of it up front
+      head[a] = n;
+      mid[a] = 0;
+    } else {
+      head[a] = h;
+      mid[a] = (n - h) & ~(c - 1);
+    }
+    if (mid[a] > most)
+      most = mid[a];
+    if (d[a] < 0) {
+      head[a] = -head[a];
+      mid[a] = -mid[a];
+    }
+  }
+
+  if ((most >> COARSE_SHIFT) < COARSE_MIN_PULSES) {
+    part[0].dx = dx;
+    part[0].dy = dy;
+    part[0].shift = 0;
+    return 1;
+  }
+  part[0].dx = head[0];
+  part[0].dy = head[1];
+  part[0].shift = 0;
+  part[1].dx = mid[0];
+  part[1].dy = mid[1];
+  part[1].shift = COARSE_SHIFT;
+  part[2].dx = dx - head[0] - mid[0];
+  part[2].dy = dy - head[1] - mid[1];
+  part[2].shift = 0;
+  return 3;
+}
+
+/* Homing, see returnHome(): both axes back together on the ramp (coarse, after
+ * a fine lead-in onto a coarse state) until each one's switch trips, off the
+ * switches by HOME_BACKOFF full steps at the start speed, and back onto them
+ * at HOME_CREEP_RPM, which is where 0 is taken. */
+#define HOME_BACKOFF 8       // full steps, more than the fast approach overshoots
+#define HOME_CREEP_RPM 15.0
+
+#endif // MOTION_PROFILE_H
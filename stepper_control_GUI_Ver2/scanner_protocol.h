@@ -0,0 +1,248 @@
+/**************************************************************************
+*  Binary link between the UCN_Scanner_V3 GUI and this sketch.            *
+*  Shared by both sides: the Qt project adds this folder to INCLUDEPATH,  *
+*  so change it here only.                                                *
+***************************************************************************/
+
+#ifndef SCANNER_PROTOCOL_H
+#define SCANNER_PROTOCOL_H
+
+#include <stdint.h>
+
+/* The link always starts as ASCII <...> at 9600 baud. The GUI asks for the
+ * binary link with <B,baud,0>; the sketch answers <LINK,baud> and both sides
+ * switch. In binary mode the same 'B' command (baud 9600 = back to ASCII)
+ * is acknowledged with PKT_ACK before switching. A reset always returns to ASCII.
+ *
+ * Packet on the wire:
+ *   PROTO_SYNC | type | seq | len | payload[len] | crc lo | crc hi
+ * crc is CRC-16/CCITT-FALSE over type, seq, len and payload.
+ * seq counts packets per direction; PKT_ACK carries the host seq it answers.
+ * All multi-byte fields are little-endian (AVR and x86 both are). */
+
+#define PROTO_SYNC 0xA5
+#define PROTO_HEADER_LEN 4 // sync, type, seq, len
+#define PROTO_CRC_LEN 2
+#define PROTO_MAX_PAYLOAD 32
+#define PROTO_ASCII_BAUD 9600
+
+// host -> device
+#define PKT_CMD 0x01         // CmdPacket, same commands as the ASCII <cmd,val1,val2>
+#define PKT_SCAN 0x02        // ScanPacket, the ASCII <5,...> scan command
+#define PKT_WAYPOINT 0x03    // WaypointPacket, the ASCII <W,x,y,dwell,row,col>
+#define PKT_MASK 0x04        // 1 to MASK_RUNS_PER_PACKET MaskRuns, the ASCII <M,row,col,len,...>
+
+// device -> host
+#define PKT_ACK 0x80         // AckPacket
+#define PKT_SCAN_INDEX 0x81  // ScanIndexPacket
+#define PKT_SCAN_DONE 0x82   // no payload
+#define PKT_POSITION 0x83    // PositionPacket
+#define PKT_STOP_STATUS 0x84 // StopStatusPacket
+#define PKT_TEXT 0x85        // up to PROTO_MAX_PAYLOAD chars, not terminated
+#define PKT_CREDIT 0x86      // CreditPacket, the ASCII <CREDIT,n>
+#define PKT_POINT_TIME 0x87  // PointTimePacket, the ASCII <POINT_TIME,n,start,end,trigger,dwell end,x,y>
+
+// Scan orders: ScanPacket.order, and the optional 8th field of <5,...>
+#define SCAN_ORDER_ROWS 0              // row by row, each from colMin (raster)
+#define SCAN_ORDER_SERPENTINE 1        // row by row, every other row backwards
+#define SCAN_ORDER_COLUMNS 2           // column by column, each from rowMin
+#define SCAN_ORDER_COLUMN_SERPENTINE 3 // column by column, every other column backwards
+#define SCAN_ORDER_MASK 0x03
+// Or'd into the order, the scan starts from another corner of the box: the
+// same walk mirrored, rows from rowMax down and/or columns from colMax down
+#define SCAN_FROM_ROW_MAX 0x04
+#define SCAN_FROM_COL_MAX 0x08
+
+/* Paths: <P,count,0> starts a path of count waypoints from wherever the
+ * stage is. The host sends a waypoint only against a credit from the sketch.
+ * Credits cover both ends: the sketch hands out no more than it has free
+ * slots in its queue of PATH_QUEUE_LEN, and no more than the 64 byte RX
+ * buffer holds (PATH_RX_CREDITS_*), so nothing overflows even while the
+ * sketch is busy. It grants new ones as waypoints come in and as it takes
+ * them off the queue, so the queue fills up behind the moving stage.
+ * Each waypoint reached gets a SCAN_INDEX (its row and col, n counting
+ * waypoints) and a trigger pulse, then its dwell. SCAN_DONE and the
+ * position follow the last one; the stage stays there. */
+#define PATH_QUEUE_LEN 8 // power of two
+#define PATH_RX_BUFFER 64 // the Uno's serial RX buffer
+#define PATH_RX_LINE_MAX 31 // longest <W,...> line the host sends
+#define PATH_RX_CREDITS_BINARY (PATH_RX_BUFFER / (PROTO_HEADER_LEN + sizeof(WaypointPacket) + PROTO_CRC_LEN))
+#define PATH_RX_CREDITS_ASCII (PATH_RX_BUFFER / PATH_RX_LINE_MAX)
+
+/* Scan masks: the scan command still gives the bounding box, a mask sent
+ * ahead of it picks the cells inside it that are scanned. The mask is run
+ * length encoded per row, as runs of len selected cells from (row, col).
+ * ASCII: <M,row,col,len[,col,len]...> with up to MASK_SPANS_PER_LINE runs
+ * of one row. Binary: PKT_MASK with up to MASK_RUNS_PER_PACKET MaskRuns.
+ * A row < 0 (<M,-1>) clears the mask. The sketch holds MASK_MAX_RUNS runs
+ * and drops any beyond; a mask applies to the next scan only, without one
+ * the whole box is scanned. Cells outside the mask are skipped without
+ * moving to them, and SCAN_INDEX n counts the cells actually scanned.
+ * Send the mask while the sketch reads commands, i.e. before a homing '8'. */
+/* DAQ gating: <G,1,0> makes scans and paths wait for the host instead of
+ * timers, until <G,0,0>. The host runs the handshake with the DAQ (see
+ * daq_client.h in the GUI) and answers with <N,0,0>:
+ *   - once the DAQ run has started, in place of the scan's 2 s setup wait;
+ *     a path does not move to its first waypoint before it;
+ *   - at each point, after SCAN_INDEX and the trigger pulse, once the DAQ
+ *     has closed the point's acquisition window, in place of the dwell.
+ * While a scan waits only a stop ('6') and the harmless '9' and 'T' are
+ * carried out; an 'N' nothing waits for is ignored. */
+/* Point timing: every scan point and waypoint whose dwell is over gets a
+ * POINT_TIME, after its SCAN_INDEX and before the next one (so before
+ * SCAN_DONE for the last). Its times are the board's micros(): 4 us steps,
+ * wrapping every 71.6 minutes, on a ceramic resonator that is off by up to
+ * some 1000 ppm. The GUI maps them onto its own clock from the messages'
+ * arrival (point_timing.h). A point that needs no move has moveStart = moveEnd;
+ * the dwell ends on the timer, or on the 'N' of a gated scan. x and y are
+ * where the step counters had the stage at rest, in usteps. */
+/* Start and end: a scan sets off from wherever the stage is, straight to
+ * its first point, and leaves the stage at its last one: SCAN_DONE and the
+ * position follow it, as for a path. Homing is the host's call, with an '8'
+ * ahead of the scan command while the sketch still reads commands.
+ * Resume: <K,n,0> ahead of a scan command makes that scan start at its
+ * point n, i.e. the one that would have had SCAN_INDEX n; the points before
+ * are passed over without moving, and n keeps counting from the whole scan.
+ * Like a mask it applies to the next scan only; send it after the mask. */
+/* Power-up: the sketch sends <ID,SCANNER_ID,SCANNER_PROTOCOL_VERSION,0>
+ * at once, then homes, or takes the position it stored in EEPROM at its
+ * last clean stop (see StoredPosition in the sketch), then sends the
+ * position as after a stop and <READY,n>, n = 1 restored, 0 homed. Both on
+ * the ASCII link, which a reset returns to. Commands sent before READY may
+ * be lost. <I,0,0> gets the same ID with a last field of 1, as the sketch
+ * only reads commands once it is ready; that is how the GUI finds a board
+ * its opening the port did not reset (see SerialWorker::discoverPort()).
+ * Identify is ASCII only: on the binary link <I> gets its PKT_ACK and no ID. */
+#define SCANNER_ID "UCN_SCANNER"
+#define SCANNER_PROTOCOL_VERSION 1
+
+#define MASK_MAX_RUNS 48
+#define MASK_RUNS_PER_PACKET 5
+#define MASK_SPANS_PER_LINE 4 // fits numChars of the sketch
+
+#pragma pack(push, 1)
+
+struct CmdPacket {
+  char cmd;
+  float val1;
+  float val2;
+};
+
+struct ScanPacket {
+  float spacing; // cm
+  float timing;  // s
+  int16_t rowMin;
+  int16_t rowMax;
+  int16_t colMin;
+  int16_t colMax;
+  uint8_t order; // SCAN_ORDER_*, and SCAN_FROM_* for another start corner
+};
+
+struct WaypointPacket {
+  float x;     // cm
+  float y;     // cm
+  float dwell; // s
+  int16_t row; // reported back in SCAN_INDEX, -1 if not a grid cell
+  int16_t col;
+};
+
+struct MaskRun {
+  int16_t row;
+  int16_t col; // first selected cell
+  int16_t len; // selected cells from col on
+};
+
+struct AckPacket {
+  uint8_t seq; // host seq being acknowledged
+};
+
+struct ScanIndexPacket {
+  int16_t row;
+  int16_t col;
+  uint32_t point; // cells scanned before it, i.e. position in the scan order
+};
+
+struct PositionPacket {
+  int32_t x; // usteps from (0,0)
+  int32_t y;
+};
+
+struct StopStatusPacket {
+  char status; // '9' scan stopped, '0' no scan was running
+};
+
+struct CreditPacket {
+  uint8_t credits; // waypoints the host may send on top of those in flight
+};
+
+struct PointTimePacket {
+  uint32_t point;       // SCAN_INDEX n of the point
+  uint32_t moveStartUs; // the stage set off for it
+  uint32_t moveEndUs;   // it came to rest there
+  uint32_t triggerUs;   // the trigger pulse went high
+  uint32_t dwellEndUs;  // the dwell was over, just before this was sent
+  int32_t x;            // usteps from (0,0), as stepped
+  int32_t y;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(float) == 4, "protocol floats are IEEE single precision");
+static_assert(sizeof(CmdPacket) == 9, "CmdPacket layout");
+static_assert(sizeof(ScanPacket) == 17, "ScanPacket layout");
+static_assert(sizeof(WaypointPacket) == 16, "WaypointPacket layout");
+static_assert(PATH_RX_CREDITS_BINARY == 2, "two 22 byte PKT_WAYPOINTs fit the RX buffer");
+static_assert(PATH_RX_CREDITS_ASCII == 2, "two <W,...> lines fit the RX buffer");
+static_assert(sizeof(MaskRun) * MASK_RUNS_PER_PACKET <= PROTO_MAX_PAYLOAD, "PKT_MASK fits a packet");
+static_assert(sizeof(ScanIndexPacket) == 8, "ScanIndexPacket layout");
+static_assert(sizeof(PositionPacket) == 8, "PositionPacket layout");
+static_assert(sizeof(PointTimePacket) == 28, "PointTimePacket layout");
+
+inline uint16_t protoCrc16(const uint8_t *data, uint8_t len, uint16_t crc)
+{
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t b = 0; b < 8; b++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+// Point n of a scan over nRows x nCols, as row/col offsets from rowMin/colMin.
+// The sketch walks the scan with this and the GUI estimates it with it.
+inline void scanOrderPoint(uint8_t order, long n, int nRows, int nCols, int &row, int &col)
+{
+  switch (order & SCAN_ORDER_MASK) {
+    case SCAN_ORDER_COLUMNS:
+    case SCAN_ORDER_COLUMN_SERPENTINE:
+      col = (int)(n / nRows);
+      row = (int)(n % nRows);
+      if ((order & SCAN_ORDER_MASK) == SCAN_ORDER_COLUMN_SERPENTINE && (col & 1))
+        row = nRows - 1 - row;
+      break;
+    default:
+      row = (int)(n / nCols);
+      col = (int)(n % nCols);
+      if ((order & SCAN_ORDER_MASK) == SCAN_ORDER_SERPENTINE && (row & 1))
+        col = nCols - 1 - col;
+      break;
+  }
+  if (order & SCAN_FROM_ROW_MAX)
+    row = nRows - 1 - row;
+  if (order & SCAN_FROM_COL_MAX)
+    col = nCols - 1 - col;
+}
+
+// Whether a scan over the given mask visits (row, col); no runs means every cell
+inline bool maskHasCell(const MaskRun *runs, int count, int row, int col)
+{
+  if (count == 0)
+    return true;
+  for (int k = 0; k < count; k++) {
+    if (runs[k].row == row && col >= runs[k].col && col < runs[k].col + runs[k].len)
+      return true;
+  }
+  return false;
+}
+
+#endif // SCANNER_PROTOCOL_H
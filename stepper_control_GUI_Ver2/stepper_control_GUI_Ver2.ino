@@ -13,9 +13,25 @@
 *  Current Version as of Saturday June, 14th 2025 18:41PM                  *
 *                                                                         *
 ***************************************************************************/
- 
-void setMicrostepRes();
-void takeStep(int, int);
+
+#include <EEPROM.h>
+#include <stddef.h>
+
+#include "scanner_protocol.h"
+#include "motion_profile.h"
+
+void setMicrostepRes(byte);
+void stepTick();
+void stepTimerStart(unsigned int);
+void stepTimerPeriod(unsigned int);
+void stepTimerStop();
+void queueMove(long, long, bool);
+void queueHoming(long, long, byte, const RampTable*);
+void homeSwitchChange();
+void homeSwitchAttach();
+bool waitForMotion(bool);
+void stopMotion();
+void setPosition(long, long);
 void scan();
 void returnHome();
 void updatePosition();
@@ -24,9 +40,30 @@ void recDataWithMarkers();
 void parseData();
 void sendCurrentPos();
 void sendExtTrg();
+void recBinary();
+void decodePacket(byte, byte, const byte*, byte);
+void sendPacket(byte, const void*, byte);
+void sendText(const char*);
+void sendScanIndex(int, int, long);
+void sendScanDone();
+void sendId(bool);
+void sendReady(bool);
+void sendPointTime(long);
+void sendStopStatus(char);
+void sendCredit(byte);
+void grantCredits();
+void startPath(long);
+void queueWaypoint();
+void runPath();
+void addMaskRuns();
+bool waitForNext();
+void setLink(long);
+void buildRamps();
+bool restorePosition();
+void storePosition();
 
 /* Variables for serial communication and data handling*/
-const byte numChars = 32;
+const byte numChars = 48; // room for <5,...> with the scan order
 char receivedChars[numChars];
 char tempChars[numChars]; // parsing array
 boolean newData = false;
@@ -35,16 +72,47 @@ char cmd[1] = {'0'};
 float fltVal1 = 0;
 float fltVal2 = 0; 
 
+// Binary link (see scanner_protocol.h), off until the GUI asks for it
+bool binaryMode = false;
+byte txSeq = 0;
+
+// Everything the sketch sends goes through txBuf, which hands it to the UART
+// as it has room (pump() from the loops), so prints never wait for the line
+#define TX_BUFFER_LEN 256 // power of two
+class TxBuffer : public Print
+{
+public:
+  using Print::write;
+  size_t write(uint8_t b);
+  void pump();
+  void flush();
+
+private:
+  byte buf[TX_BUFFER_LEN];
+  unsigned int head = 0; // next free
+  unsigned int tail = 0; // next to send
+};
+TxBuffer txBuf;
+
 // for scanning region
 int rowMin = 0;
 int rowMax = 0;
 int colMin = 0;
 int colMax = 0;
+byte scanOrder = SCAN_ORDER_ROWS;
+MaskRun scanMask[MASK_MAX_RUNS]; // cells of the box to scan, see scanner_protocol.h
+int maskRuns = 0;                // 0: the whole box
+long scanFrom = 0; // 'K': points of the next scan already done, see scanner_protocol.h
+MaskRun maskIn[MASK_RUNS_PER_PACKET]; // 'M' as parsed or decoded
+byte maskInCount = 0;
+bool daqGated = false; // 'G': the host's 'N' ends each wait instead of a timer, see scanner_protocol.h
 bool debug = false;
 
 // make sure to update the QT Code with all of these values
 // in the mainwindow.h header file
+#ifndef SPEED // the virtual Arduino sets these from its command line
 #define SPEED 60.0 // Speed (v) in RPM, update QT code with this value too, like usteps
+#endif
 #define ANGLE 1.8 // Step angle for full step (1.8 deg for our steppers)
 
 #define MAX_STEPS_LENGTH 4214.8215 // 59 cm
@@ -58,31 +126,166 @@ bool debug = false;
 // and especially the QtCreator project code
 // even though much of the arduino code auto calculates values
 // as STEP_RES is changed
-int STEP_RES = 5;
+#define STEP_RES 5
+const int usteps = (STEP_RES >= 1 && STEP_RES <= 5) ? (1 << STEP_RES) : 1; // per full step
+
+// Positions are int32 usteps; the conversions from cm and the travel are
+// worked out by the compiler
+const float stepsPerCmX = (71.0 + 15.0 / 32.0) * usteps; // long side, motor 1
+const float stepsPerCmY = (71.0 + 5.0 / 32.0) * usteps;  // short side, motor 2
+const int32_t maxStepsX = (int32_t)(MAX_STEPS_LENGTH * usteps);
+const int32_t maxStepsY = (int32_t)(MAX_STEPS_WIDTH * usteps);
 
 // Set digital pin values
-int extTrgPin = 2; // Added Jun 17 2025 for External Trigger signal for SIS-3316
-
-int mode0 = 3; // Microstepping MODE0 pin
-int mode1 = 4; // Microstepping MODE1 pin
-int mode2 = 5; // Microstepping MODE2 pin
-int sleepPin = 6; // SLEEP pin, set LOW for low power (delay 1ms)
-int resetPin = 7; // RESET pin, set LOW for index reset
-int stepPin1 = 9; // Step pin; Stepper 1
-int dirPin1 = 8; // Direction pin; Stepper 1
-int stepPin2 = 11; // Step pin; Stepper 2
-int dirPin2 = 10; // Direction pin; Stepper 2
-int homeXPin = 12; // Pin to know if X is home;
-int homeYPin = 13; // Pin to know if Y is home;
+const int extTrgPin = 2; // Added Jun 17 2025 for External Trigger signal for SIS-3316
+
+const int mode0 = 3; // Microstepping MODE0 pin
+const int mode1 = 4; // Microstepping MODE1 pin
+const int mode2 = 5; // Microstepping MODE2 pin
+const int sleepPin = 6; // SLEEP pin, set LOW for low power (delay 1ms)
+const int resetPin = 7; // RESET pin, set LOW for index reset
+const int stepPin1 = 9; // Step pin; Stepper 1
+const int dirPin1 = 8; // Direction pin; Stepper 1
+const int stepPin2 = 11; // Step pin; Stepper 2
+const int dirPin2 = 10; // Direction pin; Stepper 2
+const int homeXPin = 12; // Pin to know if X is home;
+const int homeYPin = 13; // Pin to know if Y is home;
+
+/* The step interrupt's pins. On the Uno the step, dir and home pins are
+ * all on port B, so an edge is a single sbi/cbi instead of digitalWrite()'s
+ * pin table lookups and timer checks; other builds (virtual_arduino) go
+ * through the core. */
+#if defined(__AVR_ATmega328P__)
+static_assert(dirPin1 == 8 && stepPin1 == 9 && dirPin2 == 10 && stepPin2 == 11 && homeXPin == 12 && homeYPin == 13,
+              "the port B bits below");
+static_assert(mode0 == 3 && mode1 == 4 && mode2 == 5, "MODE_SET()'s port D bits");
+#define MODE_SET(res) (PORTD = (PORTD & ~(_BV(PORTD3) | _BV(PORTD4) | _BV(PORTD5))) | ((res) << PORTD3))
+#define STEP_X_HIGH() (PORTB |= _BV(PORTB1))
+#define STEP_X_LOW() (PORTB &= ~_BV(PORTB1))
+#define STEP_Y_HIGH() (PORTB |= _BV(PORTB3))
+#define STEP_Y_LOW() (PORTB &= ~_BV(PORTB3))
+#define DIR_X_BACK() (PORTB |= _BV(PORTB0))
+#define DIR_X_FORWARD() (PORTB &= ~_BV(PORTB0))
+#define DIR_Y_BACK() (PORTB |= _BV(PORTB2))
+#define DIR_Y_FORWARD() (PORTB &= ~_BV(PORTB2))
+#define HOME_X_OPEN() ((PINB & _BV(PINB4)) == 0)
+#define HOME_Y_OPEN() ((PINB & _BV(PINB5)) == 0)
+#else
+#define STEP_X_HIGH() digitalWrite(stepPin1, HIGH)
+#define STEP_X_LOW() digitalWrite(stepPin1, LOW)
+#define STEP_Y_HIGH() digitalWrite(stepPin2, HIGH)
+#define STEP_Y_LOW() digitalWrite(stepPin2, LOW)
+#define DIR_X_BACK() digitalWrite(dirPin1, HIGH)
+#define DIR_X_FORWARD() digitalWrite(dirPin1, LOW)
+#define DIR_Y_BACK() digitalWrite(dirPin2, HIGH)
+#define DIR_Y_FORWARD() digitalWrite(dirPin2, LOW)
+#define HOME_X_OPEN() (digitalRead(homeXPin) == LOW)
+#define HOME_Y_OPEN() (digitalRead(homeYPin) == LOW)
+#define MODE_SET(res) (digitalWrite(mode0, (res) & 1), digitalWrite(mode1, ((res) >> 1) & 1), digitalWrite(mode2, ((res) >> 2) & 1))
+#endif
 
 // Other variable initialization
-double usteps = 1.0;
 double stepFreq= 0.0;
 double pulseWidth = 0.0;
-double currentX = 0.0; // usteps from (0,0)
-double currentY = 0.0; // usteps from (0,0)
+unsigned int startPeriodUs = 0; // pulseWidth as an integer
+unsigned int creepPeriodUs = 0; // HOME_CREEP_RPM
+
+// Ramped moves, set from the GUI with 'V', 'A' and 'J' (see motion_profile.h)
+AxisLimits limitsX = { (float)SPEED, MOTION_DEFAULT_ACCEL, MOTION_DEFAULT_JERK };
+AxisLimits limitsY = { (float)SPEED, MOTION_DEFAULT_ACCEL, MOTION_DEFAULT_JERK };
+RampTable ramps[3]; // X only, Y only, both
+
+// Moves waiting for the step interrupt, see stepTick()
+#define SEGMENT_QUEUE_LEN 4 // power of two
+struct MoveSegment {
+  long n;                // step periods
+  long ax;               // usteps on X
+  long ay;               // usteps on Y
+  bool backX;
+  bool backY;
+  bool homing;           // step each axis until its switch closes, at most ax, ay pulses
+  const RampTable *ramp; // NULL: the start speed throughout
+  byte shift;            // usteps per pulse = 1 << shift, 0 at STEP_RES
+};
+MoveSegment segQueue[SEGMENT_QUEUE_LEN];
+volatile byte segHead = 0; // next segment for the interrupt
+volatile byte segTail = 0; // next free slot
+volatile bool stepperBusy = false;
+unsigned long moveStartUs = 0;        // micros() when the stage last set off from rest
+volatile unsigned long moveDoneUs = 0; // and when it came to rest, from stepTick()
+volatile int32_t stepPosX = 0; // usteps, where the motors are right now
+volatile int32_t stepPosY = 0;
+volatile bool homeHitX = false; // switch closed since the homing segment started, see homeSwitchChange()
+volatile bool homeHitY = false;
+int32_t phaseOriginX = 0; // stepPos of the drivers' indexer home state, from their reset
+int32_t phaseOriginY = 0;
+
+// The segment being stepped, owned by the interrupt
+MoveSegment seg;
+bool segActive = false;
+long segStep = 0;
+long segErrX = 0;
+long segErrY = 0;
+int32_t segIncX = 0; // signed usteps per pulse
+int32_t segIncY = 0;
+byte stepShift = 0; // the resolution on the MODE pins
+
+int32_t currentX = 0; // usteps from (0,0)
+int32_t currentY = 0; // usteps from (0,0)
+
+// Waypoint path from the GUI (see scanner_protocol.h), run by runPath()
+// from loop() so the serial input keeps being read
+#define PATH_IDLE 0
+#define PATH_NEXT 1   // take the next waypoint as soon as it is queued
+#define PATH_MOVING 2
+#define PATH_DWELL 3
+#define PATH_START 4  // DAQ gated: waits for the host's 'N' before the first move
+struct Waypoint {
+  long x; // usteps
+  long y;
+  unsigned long dwellMs;
+  int row;
+  int col;
+};
+Waypoint pathQueue[PATH_QUEUE_LEN];
+byte pathHead = 0;   // next waypoint to drive to
+byte pathQueued = 0;
+byte pathCredits = 0; // granted to the host and not used yet
+byte pathState = PATH_IDLE;
+long pathPoints = 0;  // waypoints in the path
+long pathReceived = 0;
+long pathReached = 0;
+Waypoint pathAt;     // the waypoint being driven to or dwelt at
+unsigned long dwellStartMs = 0;
+unsigned long trgUs = 0;  // micros() of the last trigger pulse
+WaypointPacket waypointIn; // 'W' as parsed or decoded
+ScanPacket scanIn;         // '5' as parsed or decoded, taken on only when the scan starts
 bool initHomeFlag = false;
 
+/* Last clean stop in EEPROM, so a reset (the GUI opening the port, or power)
+ * can skip homing. Stored once the stage has been at rest for
+ * POSITION_SAVE_MS after moves that ended as planned; cleared before the
+ * next move sets off, so a clean record is where the stage is. A reset puts
+ * the drivers' indexers back to their home state, which pulls each rotor to
+ * the nearest position of that state: the stored phase says which one, and
+ * near the middle between two it is not safe to guess (see restorePosition()). */
+#define POSITION_SAVE_MS 1000
+#define POSITION_MAGIC 0x5350
+#define PHASE_CYCLE (4 * usteps)         // usteps per electrical cycle of the drivers
+#define PHASE_TRUSTED (3 * usteps / 2)   // furthest from the indexer home restored
+struct StoredPosition {
+  uint16_t magic;
+  int32_t x; // usteps
+  int32_t y;
+  uint8_t phaseX; // (x - phaseOriginX) mod PHASE_CYCLE
+  uint8_t phaseY;
+  uint8_t clean;  // 0 from the moment a move sets off
+  uint8_t check;  // sum of the bytes before it
+};
+bool positionTrusted = false; // homed, or restored, and nothing lost since
+bool storedClean = true;      // the EEPROM record may have its clean flag set
+bool storedHere = false;      // and is this position
+
 void setup() 
 {
   Serial.begin(9600);
@@ -101,53 +304,338 @@ void setup()
   pinMode(homeXPin, INPUT);
   pinMode(homeYPin, INPUT);
   
-  setMicrostepRes();
+  setMicrostepRes(STEP_RES);
   stepFreq = (SPEED * 360 * usteps) / (60 * ANGLE);
   pulseWidth = (1.0 / stepFreq) * 1000000.0; // Pulse width in microseconds
+  startPeriodUs = pulseWidth;
+  creepPeriodUs = 60000000.0 / (HOME_CREEP_RPM * (360.0 / ANGLE) * usteps);
+  homeSwitchAttach();
+  buildRamps();
 
   digitalWrite(sleepPin, HIGH);
   digitalWrite(resetPin, HIGH);
   delay(10);
 
+  sendId(false); // READY follows once homed
+  txBuf.flush();
 }
 
 void loop() 
 {
   if (initHomeFlag == false)
   {
-    int i = 0;
-    
-    for (i = 0; i < (100 * usteps); i++)
-    {
-      takeStep(0, 1);
-    }
-    currentX = 0.0;
-    
-    for (i = 0; i < (100 * usteps); i++)
+    bool restored = restorePosition();
+    if (!restored)
     {
-      takeStep(0, 2);
+      returnHome(); // also gets off a switch the stage is sitting on
     }
-    currentY = 0.0;
-    
-    returnHome();
-    currentX  = 0.0;
-    currentY = 0.0;
+    sendCurrentPos();
+    sendReady(restored);
     
     initHomeFlag = true;
   }
 
   
-  digitalWrite(sleepPin, LOW);
-  recDataWithMarkers();
+  txBuf.pump();
+  runPath();
+  if (!stepperBusy && pathState == PATH_IDLE) // moves run on while commands are read
+  {
+    digitalWrite(sleepPin, LOW);
+    if (positionTrusted && !storedHere && micros() - moveDoneUs >= POSITION_SAVE_MS * 1000UL)
+    {
+      storePosition();
+    }
+  }
+  if (binaryMode)
+  {
+    recBinary(); // fills cmd/fltVal1/fltVal2 directly, no parsing needed
+  }
+  else
+  {
+    recDataWithMarkers();
+  }
   if (newData == true)
   {
-    strcpy(tempChars, receivedChars); // temp copy for data protection
-    parseData();
+    if (!binaryMode)
+    {
+      strcpy(tempChars, receivedChars); // temp copy for data protection
+      parseData();
+    }
     executeCmd();
     newData = false;
   }
 }
 
+void recBinary()
+{
+  static byte state = 0; // 0 sync, 1 header, 2 payload, 3 crc lo, 4 crc hi
+  static byte header[3]; // type, seq, len
+  static byte payload[PROTO_MAX_PAYLOAD];
+  static byte ndx = 0;
+  static byte crcLo = 0;
+  byte readByte = 0;
+
+  while (Serial.available() > 0 && newData == false)
+  {
+    readByte = Serial.read();
+
+    switch (state)
+    {
+      case 0:
+        if (readByte == PROTO_SYNC)
+        {
+          ndx = 0;
+          state = 1;
+        }
+        break;
+      case 1:
+        header[ndx++] = readByte;
+        if (ndx == 3)
+        {
+          ndx = 0;
+          if (header[2] > PROTO_MAX_PAYLOAD) state = 0;
+          else state = (header[2] > 0) ? 2 : 3;
+        }
+        break;
+      case 2:
+        payload[ndx++] = readByte;
+        if (ndx == header[2]) state = 3;
+        break;
+      case 3:
+        crcLo = readByte;
+        state = 4;
+        break;
+      default:
+      {
+        state = 0;
+        uint16_t crc = protoCrc16(header, 3, 0xFFFF);
+        crc = protoCrc16(payload, header[2], crc);
+        if (crc == (uint16_t)(crcLo | (readByte << 8)))
+        {
+          decodePacket(header[0], header[1], payload, header[2]);
+        }
+        break;
+      }
+    }
+  }
+}
+
+void decodePacket(byte type, byte seq, const byte *payload, byte len)
+{
+  if (type == PKT_CMD && len == sizeof(CmdPacket))
+  {
+    CmdPacket p;
+    memcpy(&p, payload, sizeof(p));
+    cmd[0] = p.cmd;
+    fltVal1 = p.val1;
+    fltVal2 = p.val2;
+  }
+  else if (type == PKT_WAYPOINT && len == sizeof(WaypointPacket))
+  {
+    memcpy(&waypointIn, payload, sizeof(waypointIn));
+    cmd[0] = 'W';
+  }
+  else if (type == PKT_MASK && len > 0 && len <= sizeof(maskIn) && len % sizeof(MaskRun) == 0)
+  {
+    memcpy(maskIn, payload, len);
+    maskInCount = len / sizeof(MaskRun);
+    cmd[0] = 'M';
+  }
+  else if (type == PKT_SCAN && len == sizeof(ScanPacket))
+  {
+    memcpy(&scanIn, payload, sizeof(scanIn));
+    cmd[0] = '5';
+  }
+  else
+  {
+    return; // unknown packet, ignore
+  }
+
+  // Acknowledge instead of the ASCII "Received:" echo
+  AckPacket ack = { seq };
+  sendPacket(PKT_ACK, &ack, sizeof(ack));
+  newData = true;
+}
+
+size_t TxBuffer::write(uint8_t b)
+{
+  unsigned int next = (head + 1) & (TX_BUFFER_LEN - 1);
+  if (next == tail) // full, this one waits for the UART
+  {
+    Serial.write(buf[tail]);
+    tail = (tail + 1) & (TX_BUFFER_LEN - 1);
+  }
+  buf[head] = b;
+  head = next;
+  return 1;
+}
+
+void TxBuffer::pump()
+{
+  int room = Serial.availableForWrite();
+  while (room-- > 0 && tail != head)
+  {
+    Serial.write(buf[tail]);
+    tail = (tail + 1) & (TX_BUFFER_LEN - 1);
+  }
+}
+
+// Everything out on the line, e.g. before a baud rate change
+void TxBuffer::flush()
+{
+  while (tail != head)
+  {
+    Serial.write(buf[tail]);
+    tail = (tail + 1) & (TX_BUFFER_LEN - 1);
+  }
+  Serial.flush();
+}
+
+void sendPacket(byte type, const void *payload, byte len)
+{
+  byte header[PROTO_HEADER_LEN] = { PROTO_SYNC, type, txSeq++, len };
+  uint16_t crc = protoCrc16(header + 1, PROTO_HEADER_LEN - 1, 0xFFFF);
+  crc = protoCrc16((const byte*)payload, len, crc);
+
+  txBuf.write(header, PROTO_HEADER_LEN);
+  txBuf.write((const byte*)payload, len);
+  txBuf.write((byte)(crc & 0xFF));
+  txBuf.write((byte)(crc >> 8));
+}
+
+// Status text, as a line in ASCII mode or a PKT_TEXT in binary mode
+void sendText(const char *msg)
+{
+  if (binaryMode)
+  {
+    byte len = strlen(msg) > PROTO_MAX_PAYLOAD ? PROTO_MAX_PAYLOAD : strlen(msg);
+    sendPacket(PKT_TEXT, msg, len);
+  }
+  else
+  {
+    txBuf.println(msg);
+  }
+}
+
+void sendScanIndex(int i, int j, long n)
+{
+  if (binaryMode)
+  {
+    ScanIndexPacket p = { (int16_t)i, (int16_t)j, (uint32_t)n };
+    sendPacket(PKT_SCAN_INDEX, &p, sizeof(p));
+    return;
+  }
+  txBuf.print("<SCAN_INDEX,");
+  txBuf.print(i);
+  txBuf.print(",");
+  txBuf.print(j);
+  txBuf.print(",");
+  txBuf.print(n);
+  txBuf.println(">");
+}
+
+void sendScanDone()
+{
+  if (binaryMode)
+  {
+    sendPacket(PKT_SCAN_DONE, 0, 0);
+    return;
+  }
+  txBuf.println("<SCAN_DONE>");
+}
+
+// Identify reply, and unasked at power-up; ASCII link only, see scanner_protocol.h
+void sendId(bool ready)
+{
+  txBuf.print("<ID," SCANNER_ID ",");
+  txBuf.print(SCANNER_PROTOCOL_VERSION);
+  txBuf.print(",");
+  txBuf.print(ready ? 1 : 0);
+  txBuf.println(">");
+}
+
+// After a reset, always on the ASCII link
+void sendReady(bool restored)
+{
+  txBuf.print("<READY,");
+  txBuf.print(restored ? 1 : 0);
+  txBuf.println(">");
+}
+
+// Where point n's time went, in micros() of this board; see scanner_protocol.h
+void sendPointTime(long n)
+{
+  PointTimePacket p = { (uint32_t)n, (uint32_t)moveStartUs, (uint32_t)moveDoneUs, (uint32_t)trgUs, (uint32_t)micros(),
+                        (int32_t)stepPosX, (int32_t)stepPosY };
+  if (binaryMode)
+  {
+    sendPacket(PKT_POINT_TIME, &p, sizeof(p));
+    return;
+  }
+  txBuf.print("<POINT_TIME,");
+  txBuf.print(p.point);
+  txBuf.print(",");
+  txBuf.print(p.moveStartUs);
+  txBuf.print(",");
+  txBuf.print(p.moveEndUs);
+  txBuf.print(",");
+  txBuf.print(p.triggerUs);
+  txBuf.print(",");
+  txBuf.print(p.dwellEndUs);
+  txBuf.print(",");
+  txBuf.print(p.x);
+  txBuf.print(",");
+  txBuf.print(p.y);
+  txBuf.println(">");
+}
+
+void sendStopStatus(char status)
+{
+  if (binaryMode)
+  {
+    StopStatusPacket p = { status };
+    sendPacket(PKT_STOP_STATUS, &p, sizeof(p));
+    return;
+  }
+  txBuf.write(status);
+}
+
+void sendCredit(byte credits)
+{
+  if (binaryMode)
+  {
+    CreditPacket p = { credits };
+    sendPacket(PKT_CREDIT, &p, sizeof(p));
+    return;
+  }
+  txBuf.print("<CREDIT,");
+  txBuf.print(credits);
+  txBuf.println(">");
+}
+
+// Switch the link; 9600 means ASCII, anything else the binary protocol
+void setLink(long baud)
+{
+  if (baud != PROTO_ASCII_BAUD && baud != 115200 && baud != 250000 &&
+      baud != 500000 && baud != 1000000)
+  {
+    sendText("Unsupported link baud rate");
+    return;
+  }
+
+  if (!binaryMode)
+  {
+    // In binary mode the PKT_ACK already answered
+    txBuf.print("<LINK,");
+    txBuf.print(baud);
+    txBuf.println(">");
+  }
+  txBuf.flush();
+  Serial.end();
+  Serial.begin(baud);
+  binaryMode = (baud != PROTO_ASCII_BAUD);
+}
+
 void recDataWithMarkers()
 {
   static boolean recvInProgress = false;
@@ -170,7 +658,7 @@ void recDataWithMarkers()
         } else {
           recvInProgress = false;
           ndx = 0;
-          Serial.println("⚠️ Error: input too long, discarding.");
+          txBuf.println("⚠️ Error: input too long, discarding.");
         }
       }
       else
@@ -193,23 +681,43 @@ void parseData()
 
   char * strtokIndx; // this is used by strtok() as an index
 
-  Serial.print("Received: <"); 
-  Serial.print(tempChars);
-  Serial.println(">");
-  delay(150);
+  txBuf.print("Received: <"); 
+  txBuf.print(tempChars);
+  txBuf.println(">");
 
   strtokIndx = strtok(tempChars,",");      // get cmd char
-  strcpy(cmd, strtokIndx); // copy char to cmd
+  cmd[0] = strtokIndx[0]; // cmd is a single char, strcpy would run past it
 
-  if (strcmp(cmd, "5") == 0) { // Scanning Regions
+  if (cmd[0] == '5') { // Scanning Regions
     
-    strtokIndx = strtok(NULL, ","); fltVal1 = atof(strtokIndx); // spacing
-    strtokIndx = strtok(NULL, ","); fltVal2 = atof(strtokIndx); // timing
+    strtokIndx = strtok(NULL, ","); scanIn.spacing = atof(strtokIndx); // spacing
+    strtokIndx = strtok(NULL, ","); scanIn.timing = atof(strtokIndx); // timing
     
-    strtokIndx = strtok(NULL, ","); rowMin = atoi(strtokIndx); // min row index
-    strtokIndx = strtok(NULL, ","); rowMax = atoi(strtokIndx); // max row index
-    strtokIndx = strtok(NULL, ","); colMin = atoi(strtokIndx); // min col index
-    strtokIndx = strtok(NULL, ","); colMax = atoi(strtokIndx); // maxn col index
+    strtokIndx = strtok(NULL, ","); scanIn.rowMin = atoi(strtokIndx); // min row index
+    strtokIndx = strtok(NULL, ","); scanIn.rowMax = atoi(strtokIndx); // max row index
+    strtokIndx = strtok(NULL, ","); scanIn.colMin = atoi(strtokIndx); // min col index
+    strtokIndx = strtok(NULL, ","); scanIn.colMax = atoi(strtokIndx); // maxn col index
+    strtokIndx = strtok(NULL, ","); scanIn.order = strtokIndx ? atoi(strtokIndx) : SCAN_ORDER_ROWS; // optional
+  } else if (cmd[0] == 'W') { // Path waypoint
+    strtokIndx = strtok(NULL, ","); waypointIn.x = atof(strtokIndx); // cm
+    strtokIndx = strtok(NULL, ","); waypointIn.y = atof(strtokIndx); // cm
+    strtokIndx = strtok(NULL, ","); waypointIn.dwell = atof(strtokIndx); // s
+    strtokIndx = strtok(NULL, ","); waypointIn.row = strtokIndx ? atoi(strtokIndx) : -1; // optional
+    strtokIndx = strtok(NULL, ","); waypointIn.col = strtokIndx ? atoi(strtokIndx) : -1; // optional
+  } else if (cmd[0] == 'M') { // Scan mask, runs of one row
+    strtokIndx = strtok(NULL, ",");
+    int row = strtokIndx ? atoi(strtokIndx) : -1;
+    maskInCount = 0;
+    while (maskInCount < MASK_RUNS_PER_PACKET && (strtokIndx = strtok(NULL, ",")) != NULL) {
+      maskIn[maskInCount].row = row;
+      maskIn[maskInCount].col = atoi(strtokIndx);
+      strtokIndx = strtok(NULL, ","); maskIn[maskInCount].len = strtokIndx ? atoi(strtokIndx) : 0;
+      maskInCount++;
+    }
+    if (row < 0) { // clear
+      maskIn[0].row = -1;
+      maskInCount = 1;
+    }
   } else {
     strtokIndx = strtok(NULL, ","); // this continues where the previous call left off
     fltVal1 = atof(strtokIndx);     // convert this part to an integer
@@ -221,17 +729,22 @@ void parseData()
 
 void sendCurrentPos()
 {
-  Serial.write('<');
-  Serial.print(currentX, 6);
-  Serial.write('>');
-  Serial.write('<');
-  Serial.print(currentY, 6);
-  Serial.write('>');
-  Serial.flush();
-  delay(150);
+  if (binaryMode)
+  {
+    PositionPacket p = { (int32_t)currentX, (int32_t)currentY };
+    sendPacket(PKT_POSITION, &p, sizeof(p));
+    return;
+  }
+  txBuf.write('<');
+  txBuf.print(currentX);
+  txBuf.write('>');
+  txBuf.write('<');
+  txBuf.print(currentY);
+  txBuf.write('>');
 }
 
 void sendExtTrg() {
+  trgUs = micros();
   digitalWrite(extTrgPin, HIGH); // Set pin 0 to HIGH (5V)
   delay(1);           // Wait 1 ms
   digitalWrite(extTrgPin, LOW);
@@ -250,285 +763,707 @@ void scan()
   double timing = fltVal2;
   int delayMs = (int)(timing * 1000.0);
 
-  double cmToStepsLen = spacing * (71.0 + 15.0 / 32.0);
-  double cmToStepsWid = spacing * (71.0 + 5.0 / 32.0);
-  double lenSteps = cmToStepsLen * usteps;
-  double widSteps = cmToStepsWid * usteps;
 
-  Serial.print("Starting scan...");
-  Serial.print("Spacing: "); Serial.println(spacing, 3);
-  Serial.print("Timing: "); Serial.println(timing, 3);
-  Serial.flush();
-  delay(150);
+  if (!binaryMode) // the GUI already knows what it asked for
+  {
+    txBuf.print("Starting scan...");
+    txBuf.print("Spacing: "); txBuf.println(spacing, 3);
+    txBuf.print("Timing: "); txBuf.println(timing, 3);
 
-  if (debug) {
-    Serial.print("lenSteps: "); Serial.println(lenSteps);
-    Serial.print("widSteps: "); Serial.println(widSteps);
-    Serial.flush();
-    delay(150);
-  }
+    if (debug) {
+      txBuf.print("lenSteps: "); txBuf.println(spacing * stepsPerCmX);
+      txBuf.print("widSteps: "); txBuf.println(spacing * stepsPerCmY);
+    }
   
-  Serial.print("Scan region: rows ["); Serial.print(rowMin); Serial.print(", ");
-  Serial.print(rowMax); Serial.print("], cols ["); Serial.print(colMin); Serial.print(", ");
-  Serial.print(colMax); Serial.print("]");
-  Serial.flush();
-  delay(150);
+    txBuf.print("Scan region: rows ["); txBuf.print(rowMin); txBuf.print(", ");
+    txBuf.print(rowMax); txBuf.print("], cols ["); txBuf.print(colMin); txBuf.print(", ");
+    txBuf.print(colMax); txBuf.print("], order "); txBuf.print(scanOrder);
+
+    txBuf.println(daqGated ? "Waiting for the DAQ run to start..." : "Waiting 2 seconds for acquisition setup...");
+  }
 
   fltVal1 = 0;
   fltVal2 = 0;
+  newData = false; // this scan's command, taken; waitForNext() reads on
 
-  // Wait for acquisition setup (2s wait time)
-  Serial.println("Waiting 2 seconds for acquisition setup...");
-  for (int m = 0; m < 2000; m++) {
-    if (Serial.available()) return;
-    delay(1);
-  }
-
-  // Custom region scan
-  for (int i = rowMin; i <= rowMax; ++i) {
-    for (int j = colMin; j <= colMax; ++j) {
-      double y_cm = i * spacing;
-      double x_cm = j * spacing;
-      fltVal1 = x_cm;
-      fltVal2 = y_cm;
-
-      bool clipped = false;
-      if (x_cm > 59.0) {
-        x_cm = 59.0;
-        clipped = true;
-      }
-      if (y_cm > 28.0) {
-        y_cm = 28.0;
-        clipped = true;
-      }
+  // Wait for acquisition setup: the host's go once the DAQ run is up,
+  // or 2 s without the DAQ
+  if (daqGated)
+  {
+    if (!waitForNext()) return;
+  }
+  else
+  {
+    for (int m = 0; m < 2000; m++) {
+      if (Serial.available()) return;
+      txBuf.pump();
+      delay(1);
+    }
+  }
 
-      if (clipped) {
-        Serial.println("⚠️  WARNING: Requested position exceeded bounds and was clipped.");
-        delay(150);
-      }
-      
-      updatePosition();
+  // Custom region scan, in the order the GUI asked for; cells outside
+  // the mask are passed over without moving
+  int nRows = rowMax - rowMin + 1;
+  int nCols = colMax - colMin + 1;
+  long points = (nRows > 0 && nCols > 0) ? (long)nRows * nCols : 0;
+  long scanned = 0;
+  for (long n = 0; n < points; ++n) {
+    int i, j;
+    scanOrderPoint(scanOrder, n, nRows, nCols, i, j);
+    i += rowMin;
+    j += colMin;
+    if (!maskHasCell(scanMask, maskRuns, i, j)) continue;
+    if (scanned < scanFrom) // done before the scan was cut short
+    {
+      scanned++;
+      continue;
+    }
+
+    double y_cm = i * spacing;
+    double x_cm = j * spacing;
+    fltVal1 = x_cm;
+    fltVal2 = y_cm;
 
-      Serial.print("<SCAN_INDEX,");
-      Serial.print(i);
-      Serial.print(",");
-      Serial.print(j);
-      Serial.println(">");
-      Serial.flush();
-      delay(150);
-      
-      sendExtTrg();
+    bool clipped = false;
+    if (x_cm > 59.0) {
+      x_cm = 59.0;
+      clipped = true;
+    }
+    if (y_cm > 28.0) {
+      y_cm = 28.0;
+      clipped = true;
+    }
+
+    if (clipped) {
+      sendText("⚠️  WARNING: Requested position exceeded bounds and was clipped.");
+    }
+    
+    moveStartUs = moveDoneUs = micros(); // stays so if there is nothing to move
+    updatePosition();
+    if (!waitForMotion(true)) return; // the stop is read next
+
+    sendScanIndex(i, j, scanned);
+    
+    sendExtTrg();
 
+    // Dwell: until the DAQ has closed this point's window, or timed
+    if (daqGated)
+    {
+      if (!waitForNext()) return;
+    }
+    else
+    {
       for (int t = 0; t < delayMs; ++t) {
         if (Serial.available()) return;
+        txBuf.pump();
         delay(1);
       }
     }
+    sendPointTime(scanned++);
   }
 
-  Serial.println("Scan complete. Returning home...");
-  delay(150);
-  Serial.println("<SCAN_DONE>");
-  Serial.flush();
-  delay(150);
-  returnHome();
+  if (!binaryMode)
+  {
+    txBuf.println("Scan complete.");
+  }
+  sendScanDone();
+  sendCurrentPos(); // the stage stays at the last point
   isScanning = false;
 }
 
-// 0 means forward, !0 means back
-void takeStep(int dir, int motor)
+void startPath(long points)
+{
+  pathHead = 0;
+  pathQueued = 0;
+  pathCredits = 0;
+  pathPoints = points;
+  pathReceived = 0;
+  pathReached = 0;
+  pathState = daqGated ? PATH_START : PATH_NEXT;
+  isScanning = true;
+  grantCredits();
+}
+
+// DAQ gated scans: waits for the host's 'N', true when it came. A stop is
+// carried out and ends the wait with false; the harmless commands are
+// carried out on the way, anything else is refused like during a path.
+bool waitForNext()
 {
-  if (motor == 1) // Stepper 1
+  while (true)
   {
-    if (dir == 0)
+    txBuf.pump();
+    if (binaryMode)
     {
-      digitalWrite(dirPin1, LOW); 
-      currentX++;
+      recBinary();
     }
     else
     {
-      digitalWrite(dirPin1, HIGH);  
-      currentX--;
+      recDataWithMarkers();
     }
-    delay(0.005);
-    
-    digitalWrite(stepPin1, HIGH);
-    delayMicroseconds(pulseWidth / 2.0);
-    digitalWrite(stepPin1, LOW);
-    delayMicroseconds(pulseWidth / 2.0);
-  
-  } 
-  else // Stepper 2
-  {
-    if (dir == 0)
+    if (!newData)
+    {
+      continue;
+    }
+    if (!binaryMode)
+    {
+      strcpy(tempChars, receivedChars);
+      parseData();
+    }
+    newData = false;
+    if (cmd[0] == 'N')
+    {
+      cmd[0] = '0';
+      return true;
+    }
+    if (cmd[0] == '6')
+    {
+      executeCmd();
+      return false;
+    }
+    if (strchr("9T", cmd[0]) != NULL)
     {
-      digitalWrite(dirPin2, LOW); 
-      currentY++;
+      executeCmd();
     }
     else
     {
-      digitalWrite(dirPin2, HIGH);  
-      currentY--;
+      sendText("Scan running, stop it first");
     }
-    delay(0.005);
+    cmd[0] = '0';
+  }
+}
 
-    digitalWrite(stepPin2, HIGH);
-    delayMicroseconds(pulseWidth / 2.0);  
-    digitalWrite(stepPin2, LOW);
-    delayMicroseconds(pulseWidth / 2.0);
+// As many waypoints as fit in the RX buffer and the queue, see scanner_protocol.h
+void grantCredits()
+{
+  byte rx = binaryMode ? PATH_RX_CREDITS_BINARY : PATH_RX_CREDITS_ASCII;
+  long n = PATH_QUEUE_LEN - pathQueued - pathCredits;
+  if (n > rx - pathCredits) n = rx - pathCredits;
+  if (n > pathPoints - pathReceived - pathCredits) n = pathPoints - pathReceived - pathCredits;
+  if (n > 0)
+  {
+    pathCredits += n;
+    sendCredit(n);
   }
-  
-  return ;
 }
 
-void setMicrostepRes() 
+void queueWaypoint()
 {
-  switch(STEP_RES) 
+  if (pathState == PATH_IDLE || pathCredits == 0)
   {
-    case 1: // 1/2 step
-      digitalWrite(mode0, HIGH);
-      digitalWrite(mode1, LOW);
-      digitalWrite(mode2, LOW);
-      usteps = 2.0;
-      break;
-    case 2: // 1/4 step
-      digitalWrite(mode0, LOW);
-      digitalWrite(mode1, HIGH);
-      digitalWrite(mode2, LOW);
-      usteps = 4.0;
-      break;
-    case 3: // 1/8 step
-      digitalWrite(mode0, HIGH);
-      digitalWrite(mode1, HIGH);
-      digitalWrite(mode2, LOW);
-      usteps = 8.0;
-      break;
-    case 4: // 1/16 step
-      digitalWrite(mode0, LOW);
-      digitalWrite(mode1, LOW);
-      digitalWrite(mode2, HIGH);
-      usteps = 16.0;
-      break;
-    case 5: // 1/32 step
-      digitalWrite(mode0, HIGH);
-      digitalWrite(mode1, LOW);
-      digitalWrite(mode2, HIGH);
-      usteps = 32.0;
-      break;
-    default: // Full step
-      digitalWrite(mode0, LOW);
-      digitalWrite(mode1, LOW);
-      digitalWrite(mode2, LOW);
-      usteps = 1.0;
-      break;
+    sendText("Waypoint dropped: no path running or no credit for it");
+    return;
   }
-  
-  return ;
+
+  // Clipped to the travel like scan points: in cm first to keep the casts in
+  // range, then in usteps, as 59 cm is a few dozen usteps past maxStepsX
+  float x = constrain(waypointIn.x, 0.0, 59.0);
+  float y = constrain(waypointIn.y, 0.0, 28.0);
+  Waypoint &w = pathQueue[(pathHead + pathQueued) & (PATH_QUEUE_LEN - 1)];
+  w.x = constrain((long)(x * stepsPerCmX + 0.5), 0L, (long)maxStepsX);
+  w.y = constrain((long)(y * stepsPerCmY + 0.5), 0L, (long)maxStepsY);
+  w.dwellMs = (waypointIn.dwell > 0) ? (unsigned long)(waypointIn.dwell * 1000.0) : 0;
+  w.row = waypointIn.row;
+  w.col = waypointIn.col;
+  pathQueued++;
+  pathCredits--;
+  pathReceived++;
+  grantCredits();
 }
 
-void returnHome()
+void addMaskRuns()
 {
-  while (digitalRead(homeYPin) == LOW)
+  for (byte k = 0; k < maskInCount; k++)
   {
-    takeStep(1, 2);
+    if (maskIn[k].row < 0)
+    {
+      maskRuns = 0;
+    }
+    else if (maskRuns == MASK_MAX_RUNS)
+    {
+      sendText("Mask full, runs dropped");
+      return;
+    }
+    else if (maskIn[k].len > 0)
+    {
+      scanMask[maskRuns++] = maskIn[k];
+    }
   }
-  while (digitalRead(homeXPin) == LOW)
+}
+
+// One look at the path from loop(); never waits, so waypoints and a stop
+// are read while the stage moves and dwells
+void runPath()
+{
+  switch (pathState)
   {
-    takeStep(1, 1);
+    case PATH_NEXT:
+      if (pathReached == pathPoints)
+      {
+        pathState = PATH_IDLE;
+        isScanning = false;
+        sendScanDone();
+        sendCurrentPos(); // the stage stays at the last waypoint
+      }
+      else if (pathQueued > 0) // else the next one is still on its way
+      {
+        pathAt = pathQueue[pathHead];
+        pathHead = (pathHead + 1) & (PATH_QUEUE_LEN - 1);
+        pathQueued--;
+        grantCredits();
+        moveStartUs = moveDoneUs = micros();
+        queueMove(pathAt.x - currentX, pathAt.y - currentY, true);
+        pathState = PATH_MOVING;
+      }
+      break;
+    case PATH_MOVING:
+      if (!stepperBusy)
+      {
+        sendScanIndex(pathAt.row, pathAt.col, pathReached);
+        sendExtTrg();
+        dwellStartMs = millis();
+        pathState = PATH_DWELL;
+      }
+      break;
+    case PATH_DWELL: // DAQ gated: until 'N'
+      if (!daqGated && millis() - dwellStartMs >= pathAt.dwellMs)
+      {
+        sendPointTime(pathReached++);
+        pathState = PATH_NEXT;
+      }
+      break;
   }
+}
 
-  currentX = 0.000;
-  currentY = 0.000;
-  
-  return ;
+// 0 means forward, !0 means back
+// MODE2..MODE0 read as a binary number are the resolution: 0 = full step,
+// 1 = 1/2, 2 = 1/4, 3 = 1/8, 4 = 1/16, 5 = 1/32 step. Also switched per
+// segment by the step interrupt, see splitMove() in motion_profile.h.
+void setMicrostepRes(byte res)
+{
+  MODE_SET(res > 5 ? 0 : res);
 }
 
-void updatePosition()
-{    
-  double xToGo = 0; // number of steps to be made by Motor 1
-  double yToGo = 0; // number of steps to be made by Motor 2
-  double xRec = 0; // new desired position for x
-  double yRec = 0; // new desired position for yRec
-  double xUSteps = 0;
-  double yUSteps = 0;
-  double cmToStepsWid;
-  double cmToStepsLen;
-  double i = 0; // steps to go counter
-
-  xRec = fltVal1;
-  yRec = fltVal2;
-  
-  cmToStepsWid = yRec * (71.0 + (5.0 / 32.0));
-  cmToStepsLen = xRec * (71.0 + (15.0 / 32.0));
+// Ramp tables for the current limits; float work, only when they change.
+// The step interrupt reads them, so the motors stop first.
+void buildRamps()
+{
+  float stepsPerRev = (360.0 / ANGLE) * usteps;
+  waitForMotion(false);
+  buildRamp(ramps[0], SPEED, limitsX, stepsPerRev);
+  buildRamp(ramps[1], SPEED, limitsY, stepsPerRev);
+  buildRamp(ramps[2], SPEED, tighterLimits(limitsX, limitsY), stepsPerRev);
+}
 
-  xUSteps = cmToStepsLen * usteps;
-  yUSteps = cmToStepsWid * usteps;
+/* Step generation. Moves are queued as segments and stepped from a timer
+ * compare-match interrupt, so the main loop keeps reading commands while
+ * the motors run. Each interrupt is one step period: both axes step on the
+ * same edge (Bresenham), so a move takes max(|dx|, |dy|) periods, and the
+ * timer is reprogrammed with the next period from the segment's ramp table,
+ * up from the start and mirrored down to the end. No float work per step. */
 
-  xToGo = round(xUSteps - currentX);
-  yToGo = round(yUSteps - currentY);
+#ifdef __AVR__
+// Timer1 in CTC mode at 2 counts per microsecond (16 MHz / 8)
+unsigned int stepTimerCounts(unsigned int periodUs)
+{
+  return (periodUs > 32767) ? 65535 : 2 * periodUs - 1;
+}
 
-  if (debug){
-    Serial.println("Updating Position");
-    Serial.print("<DEBUG,xToGo=");
-    Serial.print(xToGo);
-    Serial.print(",yToGo=");
-    Serial.print(yToGo);
-    Serial.println(">");
-    delay(150);
-  }
+void stepTimerStart(unsigned int periodUs)
+{
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11);
+  OCR1A = stepTimerCounts(periodUs);
+  TCNT1 = 0;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+}
+
+void stepTimerPeriod(unsigned int periodUs)
+{
+  OCR1A = stepTimerCounts(periodUs);
+}
+
+void stepTimerStop()
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+  stepTick();
+}
+#else
+// virtual_arduino runs stepTick() on its simulated clock
+void stepTimerStart(unsigned int periodUs) { hostTimerStart(stepTick, periodUs); }
+void stepTimerPeriod(unsigned int periodUs) { hostTimerPeriod(periodUs); }
+void stepTimerStop() { hostTimerStop(); }
+#endif
+
+// Step interrupt: one step period of the current segment
+void stepTick()
+{
+  bool stepX = false;
+  bool stepY = false;
+  long r = 0;
+  unsigned long us = 0;
 
-  if (xToGo > 0 && currentX < (MAX_STEPS_LENGTH * usteps)) // advance forward
+  while (true)
   {
-    for (i = 0; i < xToGo; i++)
+    if (!segActive)
     {
-      if (Serial.available())
+      if (segHead == segTail)
       {
-          return;
+        stepTimerStop();
+        moveDoneUs = micros();
+        stepperBusy = false;
+        return;
+      }
+      seg = segQueue[segHead];
+      segStep = 0;
+      segErrX = seg.n / 2;
+      segErrY = seg.n / 2;
+      segActive = true;
+      if (seg.homing)
+      {
+        homeHitX = !HOME_X_OPEN(); // from here on the interrupt latches them
+        homeHitY = !HOME_Y_OPEN();
+      }
+      segIncX = seg.backX ? -(1L << seg.shift) : (1L << seg.shift);
+      segIncY = seg.backY ? -(1L << seg.shift) : (1L << seg.shift);
+      if (seg.backX) DIR_X_BACK(); else DIR_X_FORWARD();
+      if (seg.backY) DIR_Y_BACK(); else DIR_Y_FORWARD();
+      if (seg.shift != stepShift)
+      {
+        // a period of its own before the first pulse at the new resolution
+        stepShift = seg.shift;
+        setMicrostepRes(STEP_RES - stepShift);
+        stepTimerPeriod(startPeriodUs);
+        return;
       }
-      takeStep(0, 1);
     }
-  }
-  else // go back
-  {
-    if (currentX > 0)
+    if (seg.homing)
     {
-      for (i = 0; i < abs(xToGo); i++)
+#if defined(__AVR__) && !defined(__AVR_ATmega328P__)
+      homeSwitchChange(); // no pin-change interrupt wired up, read them every step
+#endif
+      stepX = segStep < seg.ax && !homeHitX;
+      stepY = segStep < seg.ay && !homeHitY;
+      if (stepX || stepY)
       {
-        if (Serial.available())
-        {
-          return;
-        }
-        takeStep(1, 1);
-      }  
+        break;
+      }
     }
+    else if (segStep < seg.n)
+    {
+      segErrX -= seg.ax;
+      if (segErrX < 0)
+      {
+        segErrX += seg.n;
+        stepX = true;
+      }
+      segErrY -= seg.ay;
+      if (segErrY < 0)
+      {
+        segErrY += seg.n;
+        stepY = true;
+      }
+      break;
+    }
+    segActive = false;
+    segHead = (segHead + 1) & (SEGMENT_QUEUE_LEN - 1);
+  }
+
+  if (stepX) STEP_X_HIGH();
+  if (stepY) STEP_Y_HIGH();
+
+  // the bookkeeping doubles as the step pulse width
+  if (stepX) stepPosX += segIncX;
+  if (stepY) stepPosY += segIncY;
+  // homing only ramps up, it ends on the switches
+  r = (seg.homing || segStep < seg.n - 1 - segStep) ? segStep : seg.n - 1 - segStep;
+  if (seg.ramp)
+  {
+    us = (unsigned long)rampDelay(*seg.ramp, r << seg.shift) << seg.shift;
+  }
+  else
+  {
+    us = (unsigned long)(seg.homing ? creepPeriodUs : startPeriodUs) << seg.shift;
+  }
+  stepTimerPeriod(us > 32767 ? 32767 : us);
+  segStep++;
+
+  if (stepX) STEP_X_LOW();
+  if (stepY) STEP_Y_LOW();
+}
+
+// Hands a segment to the step interrupt, waiting for room in the queue
+void queueSegment(const MoveSegment &s)
+{
+  while (((segTail + 1) & (SEGMENT_QUEUE_LEN - 1)) == segHead)
+  {
+    txBuf.pump();
+    delayMicroseconds(100);
+  }
+  if (storedClean)
+  {
+    EEPROM.update(offsetof(StoredPosition, clean), 0); // before a step is made
+    storedClean = false;
+  }
+  storedHere = false;
+  noInterrupts();
+  segQueue[segTail] = s;
+  segTail = (segTail + 1) & (SEGMENT_QUEUE_LEN - 1);
+  if (!stepperBusy)
+  {
+    stepperBusy = true;
+    moveStartUs = micros();
+    stepTimerStart(20);
   }
+  interrupts();
+}
+
+// Straight line of dx, dy usteps from the end of the queued moves, ramped
+// with the table for the axes that move, or at the start speed throughout.
+// Ramped moves cross in coarse steps when long enough (splitMove()).
+// currentX/Y become the end of the line right away.
+void queueMove(long dx, long dy, bool ramped)
+{
+  MovePart part[3] = { { dx, dy, 0 } };
+  int parts = 1;
+  int i = 0;
 
-  if (yToGo > 0 & currentY < (MAX_STEPS_WIDTH * usteps)) // advance forward
+  if (ramped)
+  {
+    parts = splitMove(currentX - phaseOriginX, currentY - phaseOriginY, dx, dy, part);
+  }
+  for (i = 0; i < parts; i++)
   {
-    for (i = 0; i < yToGo; i++)
+    MoveSegment s;
+    s.ax = ((part[i].dx < 0) ? -part[i].dx : part[i].dx) >> part[i].shift;
+    s.ay = ((part[i].dy < 0) ? -part[i].dy : part[i].dy) >> part[i].shift;
+    s.n = (s.ax > s.ay) ? s.ax : s.ay;
+    if (s.n == 0)
     {
-      if (Serial.available())
-      {
-          return;
-      }
-      takeStep(0, 2);
+      continue;
     }
+    s.backX = part[i].dx < 0;
+    s.backY = part[i].dy < 0;
+    s.homing = false;
+    s.ramp = ramped ? &ramps[(s.ax ? 1 : 0) + (s.ay ? 2 : 0) - 1] : NULL;
+    s.shift = part[i].shift;
+    queueSegment(s);
+    currentX += part[i].dx;
+    currentY += part[i].dy;
   }
-  else // go back
+}
+
+// Both axes back, each until its own switch closes or it has made nx, ny
+// pulses of 1 << shift usteps; ramped up, or at the creep speed throughout
+void queueHoming(long nx, long ny, byte shift, const RampTable *ramp)
+{
+  MoveSegment s = { (nx > ny) ? nx : ny, nx, ny, true, true, true, ramp, shift };
+  if (s.n > 0)
   {
-    if (currentY > 0)
+    queueSegment(s);
+  }
+}
+
+/* Home switches. A switch closing during a homing segment is latched by its
+ * pin-change interrupt, so the axis makes no further pulse however fast it
+ * was going; pins 12 and 13 are PCINT4 and PCINT5 on the Uno. */
+void homeSwitchChange()
+{
+  if (!HOME_X_OPEN()) homeHitX = true;
+  if (!HOME_Y_OPEN()) homeHitY = true;
+}
+
+#if defined(__AVR_ATmega328P__)
+ISR(PCINT0_vect)
+{
+  homeSwitchChange();
+}
+#endif
+
+void homeSwitchAttach()
+{
+#if defined(__AVR_ATmega328P__)
+  PCMSK0 |= _BV(PCINT4) | _BV(PCINT5);
+  PCIFR = _BV(PCIF0);
+  PCICR |= _BV(PCIE0);
+#elif !defined(__AVR__)
+  hostPinChange(homeXPin, homeSwitchChange);
+  hostPinChange(homeYPin, homeSwitchChange);
+#endif
+}
+
+// Waits for the queued moves to finish. An interruptible wait returns false
+// as soon as serial input arrives; the motors keep going.
+bool waitForMotion(bool interruptible)
+{
+  while (stepperBusy)
+  {
+    if (interruptible && Serial.available())
     {
-      for (i = 0; i < abs(yToGo); i++)
-      {
-        if (Serial.available())
-        {
-          return;
-        }
-        takeStep(1, 2);
-      }  
+      return false;
     }
+    txBuf.pump();
+    delayMicroseconds(100);
+  }
+  return true;
+}
+
+// Drops the queued moves and stops the motors where they are
+void stopMotion()
+{
+  if (stepperBusy)
+  {
+    positionTrusted = false; // cut short at speed, steps may be lost
+  }
+  noInterrupts();
+  stepTimerStop();
+  segHead = segTail;
+  segActive = false;
+  stepperBusy = false;
+  currentX = stepPosX;
+  currentY = stepPosY;
+  interrupts();
+}
+
+void setPosition(long x, long y)
+{
+  noInterrupts();
+  phaseOriginX += x - stepPosX; // the indexers stay where they are
+  phaseOriginY += y - stepPosY;
+  stepPosX = x;
+  stepPosY = y;
+  interrupts();
+  currentX = x;
+  currentY = y;
+}
+
+// Two passes over the switches (HOME_BACKOFF in motion_profile.h); the
+// first needs no trusted position, so this is also the power-up homing
+void returnHome()
+{
+  const long c = 1L << COARSE_SHIFT;
+  const long backoff = (long)HOME_BACKOFF * usteps;
+
+  // Fast, both axes at once for up to the whole travel and an eighth
+  queueHoming((currentX - phaseOriginX) & (c - 1), (currentY - phaseOriginY) & (c - 1), 0, &ramps[2]);
+  queueHoming((maxStepsX + maxStepsX / 8) >> COARSE_SHIFT, (maxStepsY + maxStepsY / 8) >> COARSE_SHIFT,
+              COARSE_SHIFT, &ramps[2]);
+  waitForMotion(false);
+  currentX = stepPosX; // wherever the switches stopped them
+  currentY = stepPosY;
+
+  // Slow, for where 0 is
+  queueMove(backoff, backoff, false);
+  queueHoming(2 * backoff, 2 * backoff, 0, NULL);
+  waitForMotion(false);
+  positionTrusted = homeHitX && homeHitY;
+  if (!positionTrusted)
+  {
+    sendText(!homeHitX ? "Homing: X switch not found" : "Homing: Y switch not found");
+  }
+  setPosition(0, 0);
+}
+
+// At power-up: takes the EEPROM's clean stop if it is safe to, see StoredPosition
+bool restorePosition()
+{
+  StoredPosition p;
+  const byte *b = (const byte *)&p;
+  byte sum = 0;
+  long offX = 0;
+  long offY = 0;
+  size_t i = 0;
+
+  EEPROM.get(0, p);
+  for (i = 0; i < offsetof(StoredPosition, check); i++)
+  {
+    sum += b[i];
+  }
+  if (p.magic != POSITION_MAGIC || !p.clean || p.check != sum)
+  {
+    return false;
+  }
+  // the rotors went to the indexers' home state, the nearest one
+  offX = (p.phaseX < PHASE_CYCLE / 2) ? p.phaseX : (long)p.phaseX - PHASE_CYCLE;
+  offY = (p.phaseY < PHASE_CYCLE / 2) ? p.phaseY : (long)p.phaseY - PHASE_CYCLE;
+  if (labs(offX) > PHASE_TRUSTED || labs(offY) > PHASE_TRUSTED)
+  {
+    return false;
+  }
+  if (p.x - offX < 0 || p.y - offY < 0 || p.x - offX > maxStepsX || p.y - offY > maxStepsY)
+  {
+    return false;
+  }
+  setPosition(p.x - offX, p.y - offY);
+  positionTrusted = true;
+  storedHere = offX == 0 && offY == 0;
+  return true;
+}
+
+void storePosition()
+{
+  StoredPosition p;
+  const byte *b = (const byte *)&p;
+  size_t i = 0;
+
+  p.magic = POSITION_MAGIC;
+  p.x = currentX;
+  p.y = currentY;
+  p.phaseX = (currentX - phaseOriginX) & (PHASE_CYCLE - 1);
+  p.phaseY = (currentY - phaseOriginY) & (PHASE_CYCLE - 1);
+  p.clean = 1;
+  p.check = 0;
+  for (i = 0; i < offsetof(StoredPosition, check); i++)
+  {
+    p.check += b[i];
+  }
+  EEPROM.put(0, p); // byte by byte, clean and check last
+  storedClean = true;
+  storedHere = true;
+}
+
+void updatePosition()
+{    
+  long dx = 0; // signed usteps for Motor 1
+  long dy = 0; // signed usteps for Motor 2
+
+  // One float multiply per axis for the target, integers from there on
+  int32_t xToGo = lround(fltVal1 * stepsPerCmX) - currentX; // number of steps to be made by Motor 1
+  int32_t yToGo = lround(fltVal2 * stepsPerCmY) - currentY; // number of steps to be made by Motor 2
+
+  if (debug && !binaryMode){
+    txBuf.println("Updating Position");
+    txBuf.print("<DEBUG,xToGo=");
+    txBuf.print(xToGo);
+    txBuf.print(",yToGo=");
+    txBuf.print(yToGo);
+    txBuf.println(">");
   }
 
+  if (xToGo > 0 && currentX < maxStepsX) // advance forward
+  {
+    dx = xToGo;
+  }
+  else if (currentX > 0) // go back
+  {
+    dx = -labs(xToGo);
+  }
+
+  if (yToGo > 0 && currentY < maxStepsY) // advance forward
+  {
+    dy = yToGo;
+  }
+  else if (currentY > 0) // go back
+  {
+    dy = -labs(yToGo);
+  }
+
+  queueMove(dx, dy, true);
+
   fltVal1 = 0;
   fltVal2 = 0;
   
@@ -537,67 +1472,67 @@ void updatePosition()
 
 void executeCmd()
 { 
-  int i = 0;
-  
   digitalWrite(sleepPin, HIGH);
+
+  // A running path has the motors; only a stop, its waypoints, the DAQ's
+  // go and the harmless commands get through
+  if (pathState != PATH_IDLE && strchr("69TWN", cmd[0]) == NULL)
+  {
+    sendText("Path running, stop it first");
+    cmd[0] = '0';
+    return;
+  }
   
   switch(cmd[0])
   {
     case '1': // X Back
       if(currentX > 0)
       {
-        for (i = 0; i < (1 * usteps); i++)
-        {
-          takeStep(1, 1);  
-        }
+        queueMove(-usteps, 0, false);
       }
       break;
     case '2': // Y Back
       if(currentY > 0)
       {
-        for (i = 0; i < (1 * usteps); i++)
-        {
-          takeStep(1, 2);  
-        }
+        queueMove(0, -usteps, false);
       }
       break;
     case '3': // X Forward
-      if(currentX < MAX_STEPS_LENGTH * usteps)
+      if(currentX < maxStepsX)
       {
-        for (i = 0; i < (1 * usteps); i++)
-        {
-          takeStep(0, 1);
-        }
+        queueMove(usteps, 0, false);
       }
       break;
     case '4': // Y Forward
-      if(currentY < MAX_STEPS_WIDTH * usteps)
+      if(currentY < maxStepsY)
       {
-        for (i = 0; i < (1 * usteps); i++)
-        {
-          takeStep(0, 2);
-        }
+        queueMove(0, usteps, false);
       }
       break;
-    case '5': // Run Scan
-      if (currentX == 0 & currentY == 0)
-      {
-        scan();
-      }
+    case '5': // Run Scan, from wherever the stage is; homing is the host's call
+      // Only now: a '5' refused while a scan waits must not change the running one
+      fltVal1 = scanIn.spacing;
+      fltVal2 = scanIn.timing;
+      rowMin = scanIn.rowMin;
+      rowMax = scanIn.rowMax;
+      colMin = scanIn.colMin;
+      colMax = scanIn.colMax;
+      scanOrder = scanIn.order;
+      scan();
+      maskRuns = 0; // a mask is for one scan
+      scanFrom = 0; // and so is a resume
       break;
     case '6': // Stop
+      stopMotion();
+      pathState = PATH_IDLE;
       if (!isScanning)
       {
-        Serial.write('0');
-        Serial.flush();
-        delay(150);  
+        sendStopStatus('0');
       }
       else
       {
         isScanning = false;
-        Serial.write('9');
-        Serial.flush();
-        delay(150);  
+        sendStopStatus('9');
       }
       sendCurrentPos();
       break;
@@ -609,12 +1544,69 @@ void executeCmd()
       break;
     case '9': // Debug Mode
       debug = (fltVal1 == 1);
-      Serial.print("Debug mode is now ");
-      Serial.println(debug ? "ON" : "OFF");
-      delay(150);
+      sendText(debug ? "Debug mode is now ON" : "Debug mode is now OFF");
+      break;
+    case 'V': // Max speed in RPM, X and Y
+      if (fltVal1 > 0 && fltVal2 > 0)
+      {
+        limitsX.maxRpm = fltVal1;
+        limitsY.maxRpm = fltVal2;
+        buildRamps();
+      }
+      break;
+    case 'A': // Acceleration in RPM/s, X and Y
+      if (fltVal1 >= 0 && fltVal2 >= 0)
+      {
+        limitsX.accelRpm = fltVal1;
+        limitsY.accelRpm = fltVal2;
+        buildRamps();
+      }
+      break;
+    case 'J': // Jerk in RPM/s^2, X and Y; 0 = trapezoid
+      if (fltVal1 >= 0 && fltVal2 >= 0)
+      {
+        limitsX.jerkRpm = fltVal1;
+        limitsY.jerkRpm = fltVal2;
+        buildRamps();
+      }
+      break;
+    case 'B': // Serial link: 9600 = ASCII, else binary at that baud
+      setLink((long)fltVal1);
       break;
     case 'T': // Test Serial Port
       break;
+    case 'I': // Identify, on the ASCII link only
+      if (!binaryMode)
+      {
+        sendId(true);
+      }
+      break;
+    case 'P': // Path of fltVal1 waypoints, see scanner_protocol.h
+      startPath((long)fltVal1);
+      break;
+    case 'W': // Next waypoint of the path
+      queueWaypoint();
+      break;
+    case 'M': // Scan mask runs, see scanner_protocol.h
+      addMaskRuns();
+      break;
+    case 'K': // Resume the next scan at point fltVal1, see scanner_protocol.h
+      scanFrom = fltVal1 > 0 ? (long)fltVal1 : 0;
+      break;
+    case 'G': // DAQ gating on (1) or off, see scanner_protocol.h
+      daqGated = (fltVal1 == 1);
+      sendText(daqGated ? "DAQ gating is now ON" : "DAQ gating is now OFF");
+      break;
+    case 'N': // DAQ go: a gated path starts or leaves its waypoint
+      if (daqGated && pathState == PATH_DWELL)
+      {
+        sendPointTime(pathReached++);
+      }
+      if (daqGated && (pathState == PATH_START || pathState == PATH_DWELL))
+      {
+        pathState = PATH_NEXT;
+      }
+      break;
     default:
       cmd[0] = '0';
   }
@@ -0,0 +1,105 @@
+#ifndef VIRTUAL_ARDUINO_H
+#define VIRTUAL_ARDUINO_H
+
+// Host-side stand-in for the parts of the Arduino core that
+// stepper_control_GUI_Ver2.ino uses, so the real sketch runs on a PC.
+// Serial is a pseudo-terminal; the stage is simulated from the step/dir pin
+// writes and drives the home switches. See virtual_arduino.cpp, and EEPROM.h
+// for the EEPROM library.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef std::uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define DEC 10
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual std::size_t write(std::uint8_t b) = 0;
+    virtual std::size_t write(const std::uint8_t *buf, std::size_t len);
+    std::size_t write(const char *str);
+
+    std::size_t print(const char *s);
+    std::size_t print(char c);
+    std::size_t print(unsigned char n, int base = DEC);
+    std::size_t print(int n, int base = DEC);
+    std::size_t print(unsigned int n, int base = DEC);
+    std::size_t print(long n, int base = DEC);
+    std::size_t print(unsigned long n, int base = DEC);
+    std::size_t print(double n, int digits = 2);
+
+    std::size_t println();
+    template <typename T>
+    std::size_t println(T value) { std::size_t n = print(value); return n + println(); }
+    template <typename T>
+    std::size_t println(T value, int format) { std::size_t n = print(value, format); return n + println(); }
+
+private:
+    std::size_t printNumber(unsigned long n, int base, bool negative);
+};
+
+class HardwareSerial : public Print
+{
+public:
+    void begin(unsigned long baud);
+    void end();
+    int available();
+    int read();
+    int availableForWrite();
+    void flush();
+
+    using Print::write;
+    std::size_t write(std::uint8_t b) override;
+};
+
+extern HardwareSerial Serial;
+
+void pinMode(std::uint8_t pin, std::uint8_t mode);
+void digitalWrite(std::uint8_t pin, std::uint8_t value);
+int digitalRead(std::uint8_t pin);
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis();
+unsigned long micros();
+
+// Interrupts only run inside delays and Serial.available(), so these have nothing to mask
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Stand-in for a compare-match timer: isr runs every periodUs of simulated
+// time, at the exact due times, while the sketch sits in a delay or polls
+// Serial.available(). Called from isr, hostTimerPeriod() sets the time to the
+// next match like rewriting the compare register does.
+void hostTimerStart(void (*isr)(), unsigned long periodUs);
+void hostTimerPeriod(unsigned long periodUs);
+void hostTimerStop();
+
+// Stand-in for a pin-change interrupt: isr runs when the level of pin
+// changes, right after the timer interrupt whose step moved the stage onto
+// or off a home switch (only those two pins change on their own)
+void hostPinChange(std::uint8_t pin, void (*isr)());
+
+// The EEPROM's bytes, kept across resets; see EEPROM.h
+#define EEPROM_SIZE 1024 // Uno
+std::uint8_t *hostEeprom();
+
+// Run-time value behind the sketch's compile-time SPEED, see sketch.cpp
+extern double va_speed_rpm;
+
+#endif // VIRTUAL_ARDUINO_H
@@ -0,0 +1,45 @@
+#ifndef VIRTUAL_EEPROM_H
+#define VIRTUAL_EEPROM_H
+
+// Host-side stand-in for the Arduino EEPROM library, over the bytes
+// virtual_arduino.cpp keeps across resets. A byte written takes the 3.3 ms
+// the Uno's EEPROM does.
+
+#include "Arduino.h"
+
+class EEPROMClass
+{
+public:
+    std::uint8_t read(int idx) const { return hostEeprom()[idx]; }
+    void write(int idx, std::uint8_t value)
+    {
+        delayMicroseconds(3300);
+        hostEeprom()[idx] = value;
+    }
+    void update(int idx, std::uint8_t value)
+    {
+        if (read(idx) != value)
+            write(idx, value);
+    }
+
+    template <typename T>
+    T &get(int idx, T &t) const
+    {
+        std::memcpy(&t, hostEeprom() + idx, sizeof(T));
+        return t;
+    }
+    template <typename T>
+    const T &put(int idx, const T &t)
+    {
+        const std::uint8_t *p = reinterpret_cast<const std::uint8_t *>(&t);
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            update(idx + int(i), p[i]);
+        return t;
+    }
+
+    std::uint16_t length() const { return EEPROM_SIZE; }
+};
+
+static EEPROMClass EEPROM;
+
+#endif // VIRTUAL_EEPROM_H
@@ -0,0 +1,12 @@
+// The real firmware, built for the host against the core in Arduino.h.
+// SPEED becomes a variable set from the command line.
+
+#include "Arduino.h"
+
+#define SPEED va_speed_rpm
+
+#include "stepper_control_GUI_Ver2.ino"
+
+// Entry points for virtual_arduino.cpp
+void sketchSetup() { setup(); }
+void sketchLoop() { loop(); }
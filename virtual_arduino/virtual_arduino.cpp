@@ -0,0 +1,580 @@
+// Virtual Arduino: runs stepper_control_GUI_Ver2.ino on the host behind a
+// pseudo-terminal, so the GUI and the benchmarks can talk to it like the real
+// board. The protocol is the sketch's own code, nothing is re-implemented here.
+//
+// usage: virtual_arduino [options]
+//   --link PATH          symlink to the pty, for the GUI to open (default /tmp/ttyVACM0)
+//   --speed-rpm N        motor speed, the sketch's SPEED (default 60)
+//   --time-scale F       wall time per simulated time (default 1, 0.01 runs 100x faster)
+//   --no-wire-model      deliver bytes at once instead of at the sketch's baud rate
+//   --no-reset           keep running when a client opens the port (no DTR reset)
+//   --start X Y          stage position at power-up in usteps (default 0 0)
+//
+// Linux only (pty, prctl).
+
+#include "Arduino.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+void sketchSetup();
+void sketchLoop();
+
+HardwareSerial Serial;
+double va_speed_rpm = 60.0;
+
+namespace {
+
+// Pin table of stepper_control_GUI_Ver2.ino
+const int stepPin1 = 9;
+const int dirPin1 = 8;
+const int stepPin2 = 11;
+const int dirPin2 = 10;
+const int homeXPin = 12;
+const int homeYPin = 13;
+const int mode0 = 3;
+const int mode1 = 4;
+const int mode2 = 5;
+
+const std::size_t serialBufferSize = 64; // Arduino Uno RX and TX buffers
+
+struct Options {
+    std::string link = "/tmp/ttyVACM0";
+    double timeScale = 1.0;
+    bool wireModel = true;
+    bool resetOnOpen = true;
+    long startX = 0;
+    long startY = 0;
+} opts;
+
+int masterFd = -1;
+
+// ---- Time ------------------------------------------------------------------
+// Simulated time in microseconds. While the sketch is busy only delays move
+// it, so sleep overshoot and host overhead do not stretch step timing; it
+// catches up with the (scaled) wall clock while the sketch sits polling
+// Serial.available(). delay() sleeps only once it is more than half a
+// millisecond ahead, so per-step delayMicroseconds() calls stay accurate on average.
+// The host timer's interrupt runs at its due times on the way.
+
+using Clock = std::chrono::steady_clock;
+Clock::time_point t0;
+double virtualUs = 0.0;
+bool idle = true; // no delay since the last Serial.available()
+
+double wallUs()
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - t0).count() / opts.timeScale;
+}
+
+Clock::time_point wallAt(double us)
+{
+    return t0 + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::micro>(us * opts.timeScale));
+}
+
+void (*timerIsr)() = nullptr;
+double timerDue = 0.0;
+double timerPeriodUs = 0.0;
+bool inTimerIsr = false;
+void (*pinChangeIsr[2])() = {}; // home X, home Y
+bool pinChanged = false; // during the timer interrupt, runs after it
+
+double nowUs()
+{
+    return virtualUs;
+}
+
+void runPinChange()
+{
+    pinChanged = false;
+    for (auto isr : pinChangeIsr)
+        if (isr)
+            isr();
+}
+
+// Moves simulated time forward to t, running the timer interrupt on the way
+void runUntil(double t)
+{
+    while (timerIsr && timerDue <= t) {
+        virtualUs = std::max(virtualUs, timerDue);
+        inTimerIsr = true;
+        timerIsr();
+        inTimerIsr = false;
+        timerDue += timerPeriodUs;
+        if (pinChanged)
+            runPinChange();
+    }
+    virtualUs = std::max(virtualUs, t);
+}
+
+void advance(double us)
+{
+    runUntil(virtualUs + us);
+    idle = false;
+    if ((virtualUs - wallUs()) * opts.timeScale > 500.0)
+        std::this_thread::sleep_until(wallAt(virtualUs));
+}
+
+// ---- Stage -----------------------------------------------------------------
+
+// What outlives the sketch's resets, each one a fork: the stage stays where it
+// is and the EEPROM keeps its bytes (erased, 0xFF, when the virtual Arduino starts)
+struct Board {
+    long stageX; // usteps, the home switch closes at 0
+    long stageY;
+    long indexerX; // each driver's indexer, usteps from its home state
+    long indexerY;
+    std::uint8_t eeprom[EEPROM_SIZE];
+};
+Board &board = *static_cast<Board *>(
+    ::mmap(nullptr, sizeof(Board), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+
+std::uint8_t pins[64] = {};
+long &stageX = board.stageX;
+long &stageY = board.stageY;
+long &indexerX = board.indexerX;
+long &indexerY = board.indexerY;
+
+// One STEP pulse of a DRV8825: the indexer goes to the next state of the
+// resolution on the MODE pins, a whole pulse only from a state of it, so a
+// resolution switched off the boundary loses usteps here as on the board
+long driverStep(long &indexer, bool back)
+{
+    const int res = std::min(5, pins[mode0] | pins[mode1] << 1 | pins[mode2] << 2);
+    const long c = 32L >> res;
+    const long from = indexer;
+    indexer = back ? ((indexer + c - 1) & ~(c - 1)) - c : (indexer & ~(c - 1)) + c;
+    return indexer - from;
+}
+
+// The drivers' RESET pins are pulled low with the board's: each indexer goes
+// back to its home state and the rotor to the nearest position of that state
+void driverReset(long &stage, long &indexer)
+{
+    const long cycle = 4 * 32; // usteps per electrical cycle
+    long off = ((indexer % cycle) + cycle) % cycle;
+    if (off >= cycle / 2)
+        off -= cycle;
+    stage = std::max(0L, stage - off);
+    indexer = 0;
+}
+
+// ---- Serial ----------------------------------------------------------------
+// Each byte becomes visible on the other side 10 bit times after the previous
+// one at the rate passed to Serial.begin(), like a real UART.
+
+double byteUs = 0.0;
+
+std::deque<std::pair<double, std::uint8_t>> rxQueue; // (due time, byte)
+double rxLastDue = 0.0;
+unsigned long rxOverflows = 0;
+
+std::mutex txMutex;
+std::condition_variable txCv;
+std::deque<std::pair<double, std::uint8_t>> txQueue;
+double txLastDue = 0.0;
+
+void pumpRx(int timeoutMs)
+{
+    pollfd p = {masterFd, POLLIN, 0};
+    if (::poll(&p, 1, timeoutMs) > 0 && (p.revents & POLLHUP) && timeoutMs > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs)); // nobody connected
+
+    std::uint8_t buf[256];
+    ssize_t n;
+    while ((n = ::read(masterFd, buf, sizeof(buf))) > 0) {
+        double now = nowUs();
+        std::size_t arrived = std::count_if(rxQueue.begin(), rxQueue.end(),
+                                            [now](const std::pair<double, std::uint8_t> &b) { return b.first <= now; });
+        for (ssize_t i = 0; i < n; ++i) {
+            if (arrived >= serialBufferSize) {
+                ++rxOverflows; // the real RX ring drops it too
+                std::fprintf(stderr, "virtual_arduino: RX buffer overflow (%lu bytes lost)\n", rxOverflows);
+                continue;
+            }
+            rxLastDue = std::max(rxLastDue, now) + byteUs;
+            rxQueue.emplace_back(rxLastDue, buf[i]);
+        }
+    }
+}
+
+void writerThread()
+{
+    std::vector<std::uint8_t> batch;
+    for (;;) {
+        std::unique_lock<std::mutex> lock(txMutex);
+        txCv.wait(lock, [] { return !txQueue.empty(); });
+        double due = txQueue.front().first;
+        lock.unlock();
+        std::this_thread::sleep_until(wallAt(due));
+
+        lock.lock();
+        double now = wallUs();
+        while (!txQueue.empty() && txQueue.front().first <= now) {
+            batch.push_back(txQueue.front().second);
+            txQueue.pop_front();
+        }
+        lock.unlock();
+
+        if (!batch.empty()) {
+            // Non-blocking; with no client attached the bytes are simply lost
+            ssize_t ignored = ::write(masterFd, batch.data(), batch.size());
+            (void)ignored;
+            batch.clear();
+        }
+    }
+}
+
+void runSketch()
+{
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    t0 = Clock::now();
+    driverReset(stageX, indexerX);
+    driverReset(stageY, indexerY);
+    std::thread(writerThread).detach();
+
+    sketchSetup();
+    for (;;)
+        sketchLoop();
+}
+
+pid_t startSketch()
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        runSketch();
+        std::_Exit(0);
+    }
+    return pid;
+}
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: virtual_arduino [--link PATH] [--speed-rpm N] [--time-scale F]\n"
+                 "                       [--no-wire-model] [--no-reset] [--start X Y]\n");
+}
+
+} // namespace
+
+// ---- Arduino core ----------------------------------------------------------
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    byteUs = opts.wireModel ? 10.0e6 / double(baud) : 0.0;
+}
+
+void HardwareSerial::end()
+{
+    flush();
+}
+
+int HardwareSerial::available()
+{
+    // A sketch spinning on available() alone would burn a core; poll() still
+    // returns as soon as a byte comes in, so this adds no latency. Not while
+    // bytes are waiting, though: reading them one by one must not sleep.
+    bool waiting = !rxQueue.empty() && rxQueue.front().first <= nowUs();
+    pumpRx(idle && !waiting ? 1 : 0);
+    if (idle)
+        runUntil(wallUs());
+    idle = true;
+
+    double now = nowUs();
+    int count = 0;
+    for (const auto &b : rxQueue) {
+        if (b.first > now)
+            break;
+        ++count;
+    }
+    return count;
+}
+
+int HardwareSerial::read()
+{
+    pumpRx(0);
+    if (rxQueue.empty() || rxQueue.front().first > nowUs())
+        return -1;
+    int b = rxQueue.front().second;
+    rxQueue.pop_front();
+    return b;
+}
+
+void HardwareSerial::flush()
+{
+    double now = nowUs();
+    if (txLastDue > now)
+        advance(txLastDue - now);
+}
+
+std::size_t HardwareSerial::write(std::uint8_t b)
+{
+    // Blocks like the real one once its TX buffer is full
+    double now = nowUs();
+    double backlog = txLastDue - now;
+    if (backlog > serialBufferSize * byteUs)
+        advance(backlog - serialBufferSize * byteUs);
+
+    std::lock_guard<std::mutex> lock(txMutex);
+    txLastDue = std::max(txLastDue, nowUs()) + byteUs;
+    txQueue.emplace_back(txLastDue, b);
+    txCv.notify_one();
+    return 1;
+}
+
+int HardwareSerial::availableForWrite()
+{
+    // What write() takes without blocking
+    if (byteUs <= 0.0)
+        return int(serialBufferSize) - 1;
+    double backlog = std::max(0.0, txLastDue - nowUs());
+    return std::max(0, int(serialBufferSize) - 1 - int(std::ceil(backlog / byteUs)));
+}
+
+std::size_t Print::write(const std::uint8_t *buf, std::size_t len)
+{
+    for (std::size_t i = 0; i < len; ++i)
+        write(buf[i]);
+    return len;
+}
+
+std::size_t Print::write(const char *str)
+{
+    return write(reinterpret_cast<const std::uint8_t *>(str), std::strlen(str));
+}
+
+std::size_t Print::printNumber(unsigned long n, int base, bool negative)
+{
+    char buf[8 * sizeof(long) + 2];
+    char *p = buf + sizeof(buf);
+    if (base < 2)
+        base = 10;
+    do {
+        int digit = int(n % unsigned(base));
+        *--p = char(digit < 10 ? '0' + digit : 'A' + digit - 10);
+        n /= unsigned(base);
+    } while (n);
+    if (negative)
+        *--p = '-';
+    return write(reinterpret_cast<const std::uint8_t *>(p), std::size_t(buf + sizeof(buf) - p));
+}
+
+std::size_t Print::print(const char *s) { return write(s); }
+std::size_t Print::print(char c) { return write(std::uint8_t(c)); }
+std::size_t Print::print(unsigned char n, int base) { return printNumber(n, base, false); }
+std::size_t Print::print(unsigned int n, int base) { return printNumber(n, base, false); }
+std::size_t Print::print(unsigned long n, int base) { return printNumber(n, base, false); }
+std::size_t Print::print(int n, int base) { return print(long(n), base); }
+
+std::size_t Print::print(long n, int base)
+{
+    if (base == 10 && n < 0)
+        return printNumber(0ul - (unsigned long)n, base, true);
+    return printNumber((unsigned long)n, base, false);
+}
+
+std::size_t Print::print(double n, int digits)
+{
+    char buf[64];
+    int len = std::snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(reinterpret_cast<const std::uint8_t *>(buf), std::size_t(std::max(len, 0)));
+}
+
+std::size_t Print::println()
+{
+    return write("\r\n");
+}
+
+void pinMode(std::uint8_t, std::uint8_t)
+{
+}
+
+void digitalWrite(std::uint8_t pin, std::uint8_t value)
+{
+    if (pin >= sizeof(pins))
+        return;
+    // Step on the rising edge; dir LOW is forward, as in takeStep()
+    if (value == HIGH && pins[pin] == LOW) {
+        const bool homeX = stageX <= 0;
+        const bool homeY = stageY <= 0;
+        if (pin == stepPin1)
+            stageX = std::max(0L, stageX + driverStep(indexerX, pins[dirPin1] == HIGH));
+        else if (pin == stepPin2)
+            stageY = std::max(0L, stageY + driverStep(indexerY, pins[dirPin2] == HIGH));
+        if ((homeX != (stageX <= 0) && pinChangeIsr[0]) || (homeY != (stageY <= 0) && pinChangeIsr[1])) {
+            pinChanged = true;
+            if (!inTimerIsr)
+                runPinChange(); // a step outside the interrupt: right away
+        }
+    }
+    pins[pin] = value;
+}
+
+std::uint8_t *hostEeprom()
+{
+    return board.eeprom;
+}
+
+void hostPinChange(std::uint8_t pin, void (*isr)())
+{
+    if (pin == homeXPin)
+        pinChangeIsr[0] = isr;
+    else if (pin == homeYPin)
+        pinChangeIsr[1] = isr;
+}
+
+int digitalRead(std::uint8_t pin)
+{
+    if (pin == homeXPin)
+        return stageX <= 0 ? HIGH : LOW;
+    if (pin == homeYPin)
+        return stageY <= 0 ? HIGH : LOW;
+    return pin < sizeof(pins) ? pins[pin] : LOW;
+}
+
+void delay(unsigned long ms)
+{
+    advance(ms * 1000.0);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    advance(us);
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(nowUs() / 1000.0);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)nowUs();
+}
+
+void hostTimerStart(void (*isr)(), unsigned long periodUs)
+{
+    timerIsr = isr;
+    timerPeriodUs = double(std::max(1ul, periodUs));
+    timerDue = nowUs() + timerPeriodUs;
+}
+
+void hostTimerPeriod(unsigned long periodUs)
+{
+    timerPeriodUs = double(std::max(1ul, periodUs));
+    if (!inTimerIsr)
+        timerDue = nowUs() + timerPeriodUs;
+}
+
+void hostTimerStop()
+{
+    timerIsr = nullptr;
+}
+
+// ---- Main ------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+        if (arg == "--link" && more) {
+            opts.link = argv[++i];
+        } else if (arg == "--speed-rpm" && more) {
+            va_speed_rpm = std::atof(argv[++i]);
+        } else if (arg == "--time-scale" && more) {
+            opts.timeScale = std::atof(argv[++i]);
+        } else if (arg == "--no-wire-model") {
+            opts.wireModel = false;
+        } else if (arg == "--no-reset") {
+            opts.resetOnOpen = false;
+        } else if (arg == "--start" && i + 2 < argc) {
+            opts.startX = std::atol(argv[++i]);
+            opts.startY = std::atol(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (opts.timeScale <= 0.0 || va_speed_rpm <= 0.0) {
+        usage();
+        return 2;
+    }
+    if (&board == MAP_FAILED) {
+        std::perror("virtual_arduino: mmap");
+        return 1;
+    }
+    stageX = opts.startX;
+    stageY = opts.startY;
+    std::memset(board.eeprom, 0xFF, sizeof(board.eeprom));
+
+    masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd < 0 || grantpt(masterFd) != 0 || unlockpt(masterFd) != 0) {
+        std::perror("virtual_arduino: pty");
+        return 1;
+    }
+    const char *slave = ptsname(masterFd);
+
+    // Raw until the client configures it, so nothing rewrites \r\n or eats bytes
+    int slaveFd = ::open(slave, O_RDWR | O_NOCTTY);
+    if (slaveFd >= 0) {
+        termios tio;
+        tcgetattr(slaveFd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slaveFd, TCSANOW, &tio);
+        ::close(slaveFd);
+    }
+    fcntl(masterFd, F_SETFL, fcntl(masterFd, F_GETFL) | O_NONBLOCK);
+
+    ::unlink(opts.link.c_str());
+    if (::symlink(slave, opts.link.c_str()) != 0)
+        std::perror("virtual_arduino: symlink");
+    std::printf("virtual Arduino on %s (%s), %.1f RPM, time scale %g\n",
+                slave, opts.link.c_str(), va_speed_rpm, opts.timeScale);
+    std::fflush(stdout);
+
+    if (!opts.resetOnOpen)
+        runSketch();
+
+    // Like the Uno's DTR reset: a client opening the port restarts the sketch
+    pid_t child = startSketch();
+    bool connected = false;
+    for (;;) {
+        pollfd p = {masterFd, 0, 0};
+        ::poll(&p, 1, 20);
+        bool open = !(p.revents & POLLHUP);
+        if (open && !connected) {
+            ::kill(child, SIGKILL);
+            ::waitpid(child, nullptr, 0);
+            tcflush(masterFd, TCIOFLUSH);
+            std::printf("client connected, resetting\n");
+            std::fflush(stdout);
+            child = startSketch();
+        }
+        connected = open;
+
+        int status = 0;
+        if (::waitpid(child, &status, WNOHANG) == child) {
+            std::fprintf(stderr, "virtual_arduino: sketch exited\n");
+            return 1;
+        }
+    }
+}
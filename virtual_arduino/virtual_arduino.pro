@@ -0,0 +1,17 @@
+TEMPLATE = app
+TARGET = virtual_arduino
+
+CONFIG += console c++17 thread
+CONFIG -= qt app_bundle
+
+# Arduino.h here stands in for the Arduino core; the sketch folder provides the rest
+INCLUDEPATH += . ../stepper_control_GUI_Ver2
+
+SOURCES += \
+    sketch.cpp \
+    virtual_arduino.cpp
+
+HEADERS += \
+    Arduino.h \
+    EEPROM.h \
+    ../stepper_control_GUI_Ver2/scanner_protocol.h